@@ -0,0 +1,17 @@
+local suites = {
+    "benchembedfs",
+    "benchhap",
+    "benchjson",
+    "benchmq",
+    "benchthread",
+    "benchtimer",
+    "benchtlv8"
+}
+
+local function runSuite(s)
+    print(("== %s"):format(s))
+    require(s)
+end
+for i, suite in ipairs(suites) do
+    runSuite(suite)
+end
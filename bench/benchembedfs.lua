@@ -0,0 +1,46 @@
+---Benchmark of the bridge embedfs.
+---
+---Reports the image size, the time and memory to load all embedded modules.
+---Run it on builds with BRIDGE_EMBEDFS_COMPRESS ON and OFF to compare.
+local core = require "core"
+
+local ROUNDS = 20
+
+---Find the loader of the module without running it.
+local function load(name)
+    for _, searcher in ipairs(package.searchers) do
+        local loader = searcher(name)
+        if type(loader) == "function" then
+            return loader
+        end
+    end
+    error(("module '%s' not found"):format(name))
+end
+
+local stats = core.embedfsStats()
+print(("files: %d, size: %d, raw size: %d, ratio: %.1f%%"):format(
+    stats.files, stats.size, stats.rawSize, stats.size / stats.rawSize * 100))
+
+local names = {}
+for i, path in ipairs(stats.paths) do
+    names[i] = path:gsub("%.luac$", ""):gsub("/", ".")
+end
+
+local start = core.time()
+for _ = 1, ROUNDS do
+    for _, name in ipairs(names) do
+        load(name)
+    end
+end
+local elapsed = core.time() - start
+print(("load: %d modules x %d rounds in %d ms, %.3f ms/module"):format(
+    #names, ROUNDS, elapsed, elapsed / (#names * ROUNDS)))
+
+collectgarbage()
+local mem = collectgarbage("count")
+local loaders = {}
+for i, name in ipairs(names) do
+    loaders[i] = load(name)
+end
+collectgarbage()
+print(("memory: %.1f KB for all loaded modules"):format(collectgarbage("count") - mem))
@@ -0,0 +1,105 @@
+---Benchmark of the event notifications and the request dispatch.
+---
+---Starts the accessory server with many bridged accessories, and measures
+---raising the events one characteristic at a time and in batches.
+---Only the time of the raise calls is measured, that is the calls from Lua
+---and the lookups of the characteristics. The notifications delivered to the
+---controllers are not measured, and nothing is sent unless controllers are
+---paired and subscribed by hand.
+---
+---Then it dispatches reads and writes straight to the handlers of a characteristic
+---with hap.benchDispatch, and measures the time and the allocations per request.
+local hap = require "hap"
+local On = require "hap.char.On"
+
+local ACCESSORIES = 32
+local SERVICES = 4
+local ROUNDS = 200
+local DISPATCH = 10000
+local INDEXES = 100000
+
+local requests = 0
+local indexed = false
+
+local function index(request)
+    local start = core.time()
+    for _ = 1, INDEXES do
+        local _ = request.aid + request.sid + request.cid
+    end
+    local ms = core.time() - start
+    print(("request fields: %d indexes in %d ms (%.0f indexes/s)"):format(
+        INDEXES * 3, ms, INDEXES * 3 * 1000 / math.max(ms, 1)))
+end
+
+local function read(request)
+    requests = requests + 1
+    if not indexed then
+        indexed = true
+        index(request)
+    end
+    return false
+end
+
+local function write(request, value)
+    requests = requests + 1
+end
+
+local bridged = {}
+for aid = 2, ACCESSORIES + 1 do
+    local services = { hap.AccessoryInformationService }
+    for i = 1, SERVICES do
+        services[i + 1] = hap.newService(i * 10, "Switch", i == 1, false, {
+            On.new(i * 10 + 1, read, write)
+        })
+    end
+    bridged[#bridged + 1] = hap.newAccessory(aid, "BridgedAccessory", "Switch " .. aid,
+        "bench", "bench", tostring(aid), "1.0", nil, services)
+end
+
+hap.start(hap.newAccessory(1, "Bridges", "Bench Bridge", "bench", "bench", "1", "1.0", nil, {
+    hap.AccessoryInformationService,
+    hap.HAPProtocolInformationService,
+    hap.PairingService,
+}), bridged, true)
+
+local function report(name, events, ms)
+    print(("%s: %d events in %d ms (%.0f events/s)"):format(name, events, ms, events * 1000 / math.max(ms, 1)))
+end
+
+local events = 0
+local start = core.time()
+for _ = 1, ROUNDS do
+    for aid = 2, ACCESSORIES + 1 do
+        for i = 1, SERVICES do
+            hap.raiseEvent(aid, i * 10, i * 10 + 1)
+            events = events + 1
+        end
+    end
+    core.sleep(0)
+end
+report("raiseEvent calls", events, core.time() - start)
+
+events = 0
+start = core.time()
+for _ = 1, ROUNDS do
+    for aid = 2, ACCESSORIES + 1 do
+        events = events + hap.raiseEvents(aid)
+    end
+    core.sleep(0)
+end
+report("raiseEvents calls", events, core.time() - start)
+
+local function dispatch(name, value)
+    requests = 0
+    local us, allocs, bytes = hap.benchDispatch(2, 10, 11, DISPATCH, value)
+    assert(requests == DISPATCH)
+    print(("%s: %d requests in %d us (%.0f ns/request), %.2f allocs/request, %.1f bytes/request"):format(
+        name, DISPATCH, us, us * 1000 / DISPATCH, allocs / DISPATCH, bytes / DISPATCH))
+end
+
+-- The first read indexes the request fields, keep it out of the measurements.
+hap.benchDispatch(2, 10, 11, 1)
+dispatch("read dispatch")
+dispatch("write dispatch", true)
+
+hap.stop()
@@ -0,0 +1,28 @@
+---Benchmark of the JSON module loader.
+---
+---Reports the time and peak memory to require large JSON config files.
+---Generate the files with "cmake -P bench/genjson.cmake" first.
+local core = require "core"
+
+local ROUNDS = 5
+
+for _, name in ipairs({"benchjson_1m", "benchjson_4m"}) do
+    if not pcall(require, name) then
+        print(("%s: not found, skipped"):format(name))
+    else
+        local elapsed = 0
+        local peak = 0
+        for _ = 1, ROUNDS do
+            package.loaded[name] = nil
+            collectgarbage()
+            local live = core.memStats().live
+            local start = core.time()
+            require(name)
+            elapsed = elapsed + core.time() - start
+            -- the pool peak is global, it's only accurate when the load exceeds it
+            peak = math.max(peak, core.memStats().peak - live)
+        end
+        package.loaded[name] = nil
+        print(("%s: %.1f ms/load, %.1f KB peak"):format(name, elapsed / ROUNDS, peak / 1024))
+    end
+end
@@ -0,0 +1,74 @@
+---Benchmark of the message queues.
+---
+---Measures messages per second when the queue is buffered, when each
+---message wakes a waiting receiver like the miio property reads, and
+---when the sender waits for free slots.
+local core = require "core"
+
+local COUNT = 100000
+
+local function report(name, ms)
+    print(("%s: %d messages in %d ms (%.0f msg/s)"):format(name, COUNT, ms, COUNT * 1000 / math.max(ms, 1)))
+end
+
+local function buffered()
+    local mq = core.createMQ(64)
+    local start = core.time()
+    for _ = 1, COUNT // 64 do
+        for i = 1, 64 do
+            mq:send(true, i)
+        end
+        for _ = 1, 64 do
+            mq:recv()
+        end
+    end
+    report("buffered", core.time() - start)
+end
+
+local function wakeup()
+    local mq = core.createMQ(1)
+    local received = 0
+    local timer = core.createTimer(function ()
+        while received < COUNT do
+            local success, result = mq:recv()
+            assert(success and result)
+            received = received + 1
+        end
+    end)
+    timer:start(0)
+    core.sleep(10)
+
+    local start = core.time()
+    for i = 1, COUNT do
+        mq:send(true, i)
+    end
+    report("wakeup", core.time() - start)
+end
+
+local function backpressure()
+    local mq = core.createMQ(16)
+    local done = false
+    local timer = core.createTimer(function ()
+        for i = 1, COUNT do
+            mq:sendWait(true, i)
+        end
+        done = true
+    end)
+
+    local start = core.time()
+    timer:start(0)
+    core.sleep(0)
+    for _ = 1, COUNT do
+        mq:recv()
+    end
+    while not done do
+        core.sleep(1)
+    end
+    report("backpressure", core.time() - start)
+end
+
+buffered()
+wakeup()
+if core.createMQ(1).sendWait then
+    backpressure()
+end
@@ -0,0 +1,64 @@
+---Benchmark of the coroutine pool.
+---
+---Starts the accessory server with many bridged accessories, and drives
+---bursts of concurrent reads across them with hap.benchDispatch, more than
+---the reads the server handles at the same time, so the others wait in the
+---read queues. Each read runs in a coroutine and yields while waiting
+---for the device.
+local hap = require "hap"
+local On = require "hap.char.On"
+
+local ACCESSORIES = 64
+local READS = 4
+local ROUNDS = 50
+
+local function read(request)
+    core.sleep(1)
+    return false
+end
+
+local function write(request, value)
+end
+
+local bridged = {}
+for aid = 2, ACCESSORIES + 1 do
+    bridged[#bridged + 1] = hap.newAccessory(aid, "BridgedAccessory", "Switch " .. aid,
+        "bench", "bench", tostring(aid), "1.0", nil, {
+            hap.AccessoryInformationService,
+            hap.newService(10, "Switch", true, false, {
+                On.new(11, read, write)
+            })
+        })
+end
+
+hap.start(hap.newAccessory(1, "Bridges", "Bench Bridge", "bench", "bench", "1", "1.0", nil, {
+    hap.AccessoryInformationService,
+    hap.HAPProtocolInformationService,
+    hap.PairingService,
+}), bridged, true)
+
+local function burst()
+    local tasks = {}
+    for aid = 2, ACCESSORIES + 1 do
+        tasks[#tasks + 1] = core.spawn(hap.benchDispatch, aid, 10, 11, READS)
+    end
+    for _, task in ipairs(tasks) do
+        assert(task:join())
+    end
+end
+
+local before = core.threadStats()
+local start = core.time()
+for _ = 1, ROUNDS do
+    burst()
+end
+local elapsed = core.time() - start
+local after = core.threadStats()
+
+hap.stop()
+
+local hits = after.hits - before.hits
+local misses = after.misses - before.misses
+print(("%d bursts of %d reads in %d ms, hits: %d, misses: %d (%.1f%%), high water: %d, capacity: %d"):format(
+    ROUNDS, ACCESSORIES * READS, elapsed, hits, misses, misses / (hits + misses) * 100,
+    after.highWater, after.capacity))
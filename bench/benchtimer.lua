@@ -0,0 +1,66 @@
+---Benchmark of the Lua timers.
+---
+---Keeps many timers alive at once like per-device polling timers,
+---and measures starting, restarting, stopping and firing them.
+local core = require "core"
+
+local COUNT = 10000
+
+local function report(name, ms)
+    print(("%s %d timers in %d ms (%.2f us/timer)"):format(name, COUNT, ms, ms * 1000 / COUNT))
+end
+
+local fired = 0
+local function cb()
+    fired = fired + 1
+end
+
+local timers = {}
+for i = 1, COUNT do
+    timers[i] = core.createTimer(cb)
+end
+
+local start = core.time()
+for i = 1, COUNT do
+    timers[i]:start(60000 + i)
+end
+report("start", core.time() - start)
+
+start = core.time()
+for i = 1, COUNT do
+    timers[i]:start(30000 + (i * 7919) % COUNT)
+end
+report("restart", core.time() - start)
+
+start = core.time()
+for i = 1, COUNT do
+    timers[i]:stop()
+end
+report("stop", core.time() - start)
+
+start = core.time()
+for i = 1, COUNT do
+    timers[i]:start(i % 100)
+end
+while fired < COUNT do
+    core.sleep(10)
+end
+report("fire", core.time() - start)
+
+---Periodic timers polling at the same rate, with and without a slack window.
+for _, slack in ipairs({0, 100}) do
+    fired = 0
+    local gcCalls = core.gcStats().calls
+    start = core.time()
+    for i = 1, COUNT do
+        timers[i]:start(i % 100, 100, slack)
+    end
+    while fired < COUNT * 5 do
+        core.sleep(10)
+    end
+    for i = 1, COUNT do
+        timers[i]:stop()
+    end
+    print(("periodic slack %d: %d expirations in %d ms, %d GC calls"):format(slack,
+        fired, core.time() - start, core.gcStats().calls - gcCalls))
+end
@@ -0,0 +1,108 @@
+---Benchmark of the TLV8 codec.
+---
+---Compares hap.encodeTLV8() and hap.decodeTLV8() with a codec in pure Lua
+---built on string.pack(), on items like the ones of the camera and
+---network characteristics.
+local hap = require "hap"
+
+local ROUNDS = 10000
+
+local function intlen(v)
+    if v <= 0xff then
+        return 1
+    elseif v <= 0xffff then
+        return 2
+    elseif v <= 0xffffffff then
+        return 4
+    end
+    return 8
+end
+
+local function encode(items)
+    local parts = {}
+    for _, item in ipairs(items) do
+        local value = item.value
+        local t = type(value)
+        if t == "nil" then
+            value = ""
+        elseif t == "boolean" then
+            value = value and "\1" or "\0"
+        elseif t == "number" then
+            value = string.pack("<I" .. intlen(value), value)
+        elseif t == "table" then
+            value = encode(value)
+        end
+        local len = #value
+        if len == 0 then
+            parts[#parts + 1] = string.pack("BB", item.type, 0)
+        end
+        for i = 1, len, 255 do
+            local fragment = value:sub(i, i + 254)
+            parts[#parts + 1] = string.pack("Bs1", item.type, fragment)
+        end
+    end
+    return table.concat(parts)
+end
+
+local function decode(data)
+    local items = {}
+    local pos = 1
+    local last
+    while pos <= #data do
+        local t, value, nextPos = string.unpack("Bs1", data, pos)
+        -- merge the fragments of a long value
+        if last and last.type == t and #last.value % 255 == 0 and #last.value > 0 then
+            last.value = last.value .. value
+        else
+            last = { type = t, value = value }
+            items[#items + 1] = last
+        end
+        pos = nextPos
+    end
+    return items
+end
+
+local items = {
+    { type = 1, value = 1 },
+    { type = 2, value = true },
+    { type = 3, value = "192.168.1.100" },
+    { type = 4, value = 51827 },
+    { type = 5, value = {
+        { type = 1, value = 0 },
+        { type = 2, value = 1920 },
+        { type = 3, value = 1080 },
+        { type = 4, value = 30 },
+    } },
+    { type = 6, value = string.rep("k", 16) },
+    { type = 7, value = string.rep("s", 14) },
+    { type = 0 },
+    { type = 8, value = 0x12345678 },
+}
+
+local function run(name, fn)
+    local start = core.time()
+    local bytes = 0
+    for _ = 1, ROUNDS do
+        bytes = bytes + fn()
+    end
+    local ms = core.time() - start
+    print(("%s: %d rounds in %d ms (%.0f rounds/s, %.1f MB/s)"):format(name, ROUNDS, ms,
+        ROUNDS * 1000 / math.max(ms, 1), bytes / 1024 / 1024 * 1000 / math.max(ms, 1)))
+end
+
+local data = hap.encodeTLV8(items)
+assert(data == encode(items), "the codecs encode differently")
+assert(#hap.decodeTLV8(data) == #decode(data), "the codecs decode differently")
+
+run("encode (string.pack)", function ()
+    return #encode(items)
+end)
+run("encode (hap.encodeTLV8)", function ()
+    return #hap.encodeTLV8(items)
+end)
+run("decode (string.unpack)", function ()
+    return #data, decode(data)
+end)
+run("decode (hap.decodeTLV8)", function ()
+    return #data, hap.decodeTLV8(data)
+end)
@@ -0,0 +1,19 @@
+# Copyright (c) 2021-2023 Zebin Wu and homekit-bridge contributors
+#
+# Licensed under the Apache License, Version 2.0 (the “License”);
+# you may not use this file except in compliance with the License.
+# See [CONTRIBUTORS.md] for the list of homekit-bridge project authors.
+
+# Generate the JSON config files used by benchjson.lua.
+#
+# cmake -P bench/genjson.cmake
+
+get_filename_component(dir ${CMAKE_CURRENT_LIST_FILE} DIRECTORY)
+
+foreach(mb 1 4)
+    set(device "{\"name\": \"device\", \"model\": \"zhimi.fan.za4\", \"token\": \"0123456789abcdef0123456789abcdef\", \"values\": [1, 2.5, true, null, \"on\"]}")
+    string(LENGTH "${device}" len)
+    math(EXPR count "${mb} * 1024 * 1024 / (${len} + 1)")
+    string(REPEAT "${device}," ${count} devices)
+    file(WRITE ${dir}/benchjson_${mb}m.json "{\"devices\": [${devices}${device}]}")
+endforeach()
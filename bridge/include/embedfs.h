@@ -12,6 +12,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 
 /**
  * File description.
@@ -23,10 +24,16 @@ typedef struct embedfs_file embedfs_file;
  */
 typedef struct embedfs_dir embedfs_dir;
 
+/**
+ * Perfect hash index of all files in the root directory.
+ */
+typedef struct embedfs_index embedfs_index;
+
 struct embedfs_file {
     const char *name;       /**< File name. */
     const char *data;       /**< File data. */
     size_t len;            /**< Data length in bytes. */
+    size_t size;           /**< Uncompressed size in bytes, 0 if the data is not compressed. */
 };
 
 struct embedfs_dir {
@@ -35,10 +42,60 @@ struct embedfs_dir {
     const int file_count;
     const struct embedfs_dir * const *children;
     const int child_count;
+    const embedfs_index *index;         /**< Only set in the root directory. */
 };
 
+struct embedfs_index {
+    const uint16_t *disps;              /**< Displacements, indexed by hash % count. */
+    const char * const *paths;          /**< Full paths, indexed by slot. */
+    const embedfs_file * const *files;  /**< Files, indexed by slot. */
+    size_t count;                       /**< Number of files. */
+};
+
+/**
+ * Window size of the compressed data, must be the same as window_size in bin2hex.cmake.
+ */
+#define EMBEDFS_LZ_WINDOW 1024
+
+/**
+ * File reader, decompresses the data in a window instead of a full-size buffer.
+ */
+typedef struct embedfs_reader {
+    const embedfs_file *file;
+    size_t pos;             /**< Position in the data. */
+    size_t literal;         /**< Remaining literal bytes. */
+    size_t match;           /**< Remaining bytes to copy from the window. */
+    size_t distance;        /**< Distance of the match. */
+    size_t wpos;            /**< Position in the window. */
+    char window[EMBEDFS_LZ_WINDOW];
+} embedfs_reader;
+
+/**
+ * Find a file by the path relative to the directory.
+ *
+ * The index is used if the directory has one.
+ */
 const embedfs_file *embedfs_find_file(const embedfs_dir *dir, const char *path);
 
+/**
+ * Find a file by the full path in the index.
+ */
+const embedfs_file *embedfs_lookup(const embedfs_index *index, const char *path);
+
+/**
+ * Initialize a reader of the file.
+ */
+void embedfs_reader_init(embedfs_reader *reader, const embedfs_file *file);
+
+/**
+ * Read the next piece of the file.
+ *
+ * The piece is valid until the next read.
+ *
+ * @returns a pointer to the piece, or NULL if the end of the file is reached.
+ */
+const char *embedfs_read(embedfs_reader *reader, size_t *size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -9,6 +9,9 @@ local timer = {}
 ---@class MessageQueue:userdata Message queue.
 local mq = {}
 
+---@class Task:userdata Task.
+local task = {}
+
 ---Get current time in milliseconds.
 function core.time() end
 
@@ -23,6 +26,55 @@ function core.atexit(func) end
 ---@param ms integer Milliseconds.
 function core.sleep(ms) end
 
+---Wait until one of the objects is ready.
+---
+---A message queue is ready when it has messages, a timer is ready
+---when it expires or stops, a task is ready when it is done,
+---a socket or a stream client is ready when it is readable. The objects are checked in order, and the waiting on
+---the others is canceled once one is ready.
+---
+---A ready object may be taken by another coroutine before the current
+---coroutine is resumed, so receiving from it may still wait.
+---@param objs (MessageQueue|Timer|Task|Socket|StreamClient)[] Objects to wait.
+---@param ms? integer Timeout in milliseconds, 0 means not to wait, wait forever if it is nil.
+---@return integer|nil idx Index of the ready object, nil if timed out.
+function core.select(objs, ms) end
+
+---Run a function in a new coroutine.
+---
+---The function starts running in the next round of the run loop.
+---@param func async fun(...) Function to run.
+---@param ... any Arguments passed to the function.
+---@return Task task
+function core.spawn(func, ...) end
+
+---Wait for all tasks to finish.
+---
+---The coroutine is woken up once, when the last task finishes, the tasks
+---not finished before the timeout keep running.
+---@param tasks Task[] Tasks to wait.
+---@param ms? integer Timeout in milliseconds, 0 means not to wait, wait forever if it is nil.
+---@return boolean done false if timed out.
+function core.joinAll(tasks, ms) end
+
+---Wait for the task to finish.
+---@return boolean success false if the task raised an error or was canceled.
+---@return ... The results of the function, or the error message.
+function task:join() end
+
+---Cancel the task.
+---
+---The operation the task is waiting for is torn down. A socket receiving
+---or accepting can be used again, a socket connecting or sending and the
+---stream clients it is waiting on are closed.
+---Nothing will happen if the task is done.
+function task:cancel() end
+
+---Whether the task is done, failed or canceled.
+---@return boolean
+---@nodiscard
+function task:done() end
+
 ---Create a timer.
 ---@param cb async fun(...) Function to call when the timer expires.
 ---@param ... any Arguments passed to the callback.
@@ -32,17 +84,35 @@ function core.createTimer(cb, ...) end
 
 ---Start the timer.
 ---If the timer has already started, it will start again.
+---
+---A periodic timer expires every ``period`` milliseconds after the first
+---expiration, the expirations are scheduled from the start time so the
+---timer does not drift, and the periods missed are skipped.
+---
+---The expirations are delayed to the next multiple of ``slack``,
+---so the timers with the same slack expiring in the same window
+---are called together, which reduces the wakeups.
 ---@param ms integer The timeout period in milliseconds.
-function timer:start(ms) end
+---@param period? integer The period in milliseconds, 0 or nil means not periodic.
+---@param slack? integer Max delay of the expirations in milliseconds, default is 0.
+function timer:start(ms, period, slack) end
 
 ---Stop the timer before trigger.
 ---If the timer has not started, nothing will happen.
 function timer:stop() end
 
 ---Send message.
----@param ... any
+---
+---If there are coroutines waiting for messages, all of them
+---receive the message.
+---An error is raised when the message queue is full.
+---@param ... any At most ``width`` values.
 function mq:send(...) end
 
+---Send message, waiting for a free slot when the message queue is full.
+---@param ... any At most ``width`` values.
+function mq:sendWait(...) end
+
 ---Receive message.
 ---
 ---When the message queue is empty, the current coroutine
@@ -53,8 +123,88 @@ function mq:recv() end
 
 ---Create a message queue.
 ---@param size integer Queue size.
+---@param width? integer Max number of values in a message, default is 4.
 ---@return MessageQueue
 ---@nodiscard
-function core.createMQ(size) end
+function core.createMQ(size, width) end
+
+---@class GCStats:table GC statistics.
+---
+---@field calls integer Number of garbage collections done after callbacks.
+---@field steps integer Number of incremental steps.
+---@field cycles integer Number of cycles finished by steps.
+---@field fulls integer Number of full collections due to memory pressure.
+---@field freed integer Memory freed in KBytes.
+---@field time integer Total time spent in microseconds.
+---@field maxTime integer Max time spent by one collection in microseconds.
+---@field count integer Memory in use in KBytes.
+
+---Get GC statistics.
+---@return GCStats stats
+---@nodiscard
+function core.gcStats() end
+
+---@class ThreadStats:table Coroutine pool statistics.
+---
+---@field hits integer Coroutines reused from the pool.
+---@field misses integer Coroutines created because the pool is empty.
+---@field active integer Coroutines in use.
+---@field highWater integer Max coroutines in use at the same time.
+---@field pooled integer Idle coroutines in the pool.
+---@field capacity integer Max idle coroutines kept in the pool.
+
+---Get coroutine pool statistics.
+---@return ThreadStats stats
+---@nodiscard
+function core.threadStats() end
+
+---@class MemStats:table Lua memory statistics.
+---
+---@field live integer Bytes in use.
+---@field peak integer Max bytes in use.
+---@field reserved integer Bytes obtained from the platform.
+---@field slabs integer Number of slabs used by small blocks.
+---@field allocs integer Number of blocks allocated since the start.
+---@field allocated integer Bytes allocated since the start, including the growth of the blocks.
+---@field fragmentation number Ratio of the reserved bytes not in use, between 0 and 1.
+---@field owners table<string, MemOwnerStats> Statistics of the memory owners, empty if the accounting is disabled.
+
+---@class MemOwnerStats:table Memory owner statistics.
+---
+---@field live integer Bytes in use.
+---@field peak integer Max bytes in use.
+---@field limit integer Max bytes can be used, 0 means no limit.
+
+---Get Lua memory statistics.
+---@return MemStats stats
+---@nodiscard
+function core.memStats() end
+
+---Set the memory owner of the current coroutine.
+---
+---The memory allocated by the coroutine, the coroutines and the timers
+---it creates is charged to the owner. The default owner is "bridge".
+---@param name? string Owner name, the owner is not changed if it is nil.
+---@return string prev The previous owner name.
+function core.memOwner(name) end
+
+---Set the max bytes can be used by the memory owner.
+---
+---The allocation fails with a memory error when the limit is exceeded.
+---@param name string Owner name.
+---@param limit integer Max bytes, 0 means no limit.
+function core.setMemLimit(name, limit) end
+
+---@class EmbedfsStats:table Bridge embedfs statistics.
+---
+---@field files integer Number of files.
+---@field size integer Bytes stored in the image.
+---@field rawSize integer Bytes after decompression, equal to size if the image is not compressed.
+---@field paths string[] File paths.
+
+---Get bridge embedfs statistics.
+---@return EmbedfsStats stats
+---@nodiscard
+function core.embedfsStats() end
 
 return core
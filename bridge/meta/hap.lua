@@ -51,14 +51,26 @@ function characteristic:setValidVals(...) end
 ---@return HAPCharacteristic self
 function characteristic:setValidValsRanges(...) end
 
----@class HAPAccessoryIdentifyRequest:table Accessory identify request.
+---Set whether to coalesce the concurrent reads, enabled by default.
+---
+---While the read callback of the characteristic is waiting, the later
+---reads do not call the callback again, they get the same result.
+---Disable it if the result depends on the controller or the session.
+---@param enabled boolean
+---@return HAPCharacteristic self
+function characteristic:setCoalesceReads(enabled) end
+
+---@class HAPAccessoryIdentifyRequest:userdata Accessory identify request.
+---
+---The identify, read and write requests are reused by the server, they are only valid
+---until the callback returns, copy the fields to keep them.
 ---
 ---@field transportType HAPTransportType Transport type over which the request has been received.
 ---@field remote boolean Whether the request appears to have originated from a remote controller, e.g. via Apple TV.
 ---@field session HAPSession The session over which the request has been received.
 ---@field aid integer Accessory instance ID.
 
----@class HAPCharacteristicReadRequest:table Characteristic read request.
+---@class HAPCharacteristicReadRequest:userdata Characteristic read request.
 ---
 ---@field transportType HAPTransportType Transport type over which the request has been received.
 ---@field session HAPSession The session over which the request has been received.
@@ -66,7 +78,7 @@ function characteristic:setValidValsRanges(...) end
 ---@field sid integer Service instance ID.
 ---@field cid integer Characteristic intstance ID.
 
----@class HAPCharacteristicWriteRequest:table Characteristic write request.
+---@class HAPCharacteristicWriteRequest:userdata Characteristic write request.
 ---
 ---@field transportType HAPTransportType Transport type over which the request has been received.
 ---@field session HAPSession The session over which the request has been received.
@@ -83,6 +95,26 @@ function characteristic:setValidValsRanges(...) end
 ---@field sid integer Service instance ID.
 ---@field cid integer Characteristic intstance ID.
 
+---@class HAPCharacteristicCache:table Cache of the characteristic value.
+---
+---A fresh value is answered without calling the read callback.
+---A stale value is answered while the read callback refreshes it.
+---The value is invalidated by writes and ``hap.raiseEvent()``.
+---
+---@field ttl integer Time in milliseconds the value is fresh.
+---@field stale? integer Time in milliseconds the value is stale after it is not fresh, default is 0.
+
+---@class HAPTLV8Item:table Item of a TLV8 value.
+---
+---The value of a TLV8 characteristic is an array of items. The read callback
+---must answer without waiting, enable the cache if the value is slow to get.
+---Integers are encoded in the minimal number of bytes in little-endian,
+---and the values of the written items are strings. The items can be nested
+---at most 8 levels deep.
+---
+---@field type integer Type, between 0 and 255.
+---@field value nil|boolean|integer|string|HAPTLV8Item[] Value, the nested items are encoded as a TLV8 value.
+
 ---@class HAPCharacteristicProperties:table Properties that HomeKit characteristics can have.
 ---
 ---@field readable boolean The characteristic is readable.
@@ -361,8 +393,9 @@ function M.newService(iid, type, primary, hidden, characteristics) end
 ---@param write? async fun(request: HAPCharacteristicWriteRequest, value: any) The callback used to handle write requests.
 ---@param sub? async fun(request: HAPCharacteristicSubscriptionRequest) The callback used to handle subscribe requests.
 ---@param unsub? async fun(request: HAPCharacteristicSubscriptionRequest) The callback used to handle unsubscribe requests.
+---@param cache? HAPCharacteristicCache Cache of the value returned by the read callback.
 ---@return HAPCharacteristic
-function M.newCharacteristic(iid, format, type, props, read, write, sub, unsub) end
+function M.newCharacteristic(iid, format, type, props, read, write, sub, unsub, cache) end
 
 ---Whether the accessory is valid.
 ---@param accessory HAPAccessory HAP accessory.
@@ -380,8 +413,25 @@ function M.start(primaryAccessory, bridgedAccessories, confChanged, sessionAccep
 ---Stop accessory server.
 function M.stop() end
 
+---Replace the bridged accessories without restarting the accessory server.
+---
+---The accessories are applied from the run loop once no controller is
+---fetching the accessory database, the configuration number is increased
+---and the Bonjour service is updated, the sessions are kept and the
+---controllers fetch the accessories again.
+---The server must be started with ``bridgedAccessories``, and at most 149
+---bridged accessories are supported.
+---
+---If the bridge is not built with ``BRIDGE_HAP_LAZY_SESSIONS``, an error is
+---raised when the accessories need more session memory than the started ones.
+---The waiting reads of the removed accessories are answered with an error,
+---and the accessories are released when their callbacks return.
+---@param bridgedAccessories HAPAccessory[] Bridged accessories.
+function M.updateBridgedAccessories(bridgedAccessories) end
+
 ---Raises an event notification for a given characteristic in a given service provided by a given accessory.
 ---If has session, it raises event on a given session.
+---The cached value of the characteristic is invalidated.
 ---@overload fun(aid: integer, sid: integer, cid: integer)
 ---@param aid integer Accessory instance ID.
 ---@param sid integer Service instance ID.
@@ -389,6 +439,109 @@ function M.stop() end
 ---@param session? HAPSession The session on which to raise the event.
 function M.raiseEvent(aid, sid, cid, session) end
 
+---Raises event notifications for several characteristics at once.
+---
+---If ``cids`` is nil, raises events for all characteristics supporting
+---event notification in the service, or in the accessory if ``sid`` is nil.
+---The characteristics are looked up once and raised from a single call,
+---but each event is still raised on the server as by ``raiseEvent``,
+---and delivered to the controllers the same way.
+---The cached values of the characteristics are invalidated.
+---@param aid integer Accessory instance ID.
+---@param sid? integer Service instance ID.
+---@param cids? integer[] Characteristic instance IDs in the service.
+---@param session? HAPSession The session on which to raise the events.
+---@return integer n Number of events raised.
+function M.raiseEvents(aid, sid, cids, session) end
+
+---Dispatch requests to the handlers of a characteristic to measure the dispatch cost.
+---
+---Makes ``n`` reads, or ``n`` writes of ``value`` if it is not nil, from the run loop
+---as the server does, and waits until all of them are answered. The requests have
+---a session of their own that must not be used, their responses are not sent.
+---@param aid integer Accessory instance ID.
+---@param sid integer Service instance ID.
+---@param cid integer Characteristic instance ID.
+---@param n integer Number of requests.
+---@param value? any Value to write.
+---@return integer us Time in microseconds until all requests are answered.
+---@return integer allocs Number of blocks allocated meanwhile.
+---@return integer bytes Bytes allocated meanwhile.
+function M.benchDispatch(aid, sid, cid, n, value) end
+
+---@class HAPCacheStats:table Characteristic cache statistics.
+---
+---@field hits integer Reads answered by fresh values.
+---@field misses integer Reads calling the read callback.
+---@field stale integer Reads answered by stale values.
+---@field chars integer Characteristics with a cache.
+
+---Get characteristic cache statistics.
+---@return HAPCacheStats
+---@nodiscard
+function M.cacheStats() end
+
+---@class HAPSessionStats:table IP session statistics.
+---
+---@field sessions integer Sessions in use.
+---@field peakSessions integer Max sessions in use at the same time.
+---@field bytes integer Memory of the session storage in bytes.
+---@field peakBytes integer Max memory of the session storage in bytes.
+---@field capacity integer Max sessions.
+
+---Get IP session statistics.
+---
+---If the bridge is built with ``BRIDGE_HAP_LAZY_SESSIONS``, the memory of
+---a session is allocated when it is accepted and released when it is closed.
+---@return HAPSessionStats
+---@nodiscard
+function M.sessionStats() end
+
+---@class HAPLatencyHist:table Latency histogram in microseconds.
+---
+---@field count integer Number of samples.
+---@field max integer Max latency.
+---@field sum integer Sum of the latencies.
+---@field buckets integer[] 24 buckets, the first counts 0 us and the bucket ``i`` counts ``[2^(i-2), 2^(i-1))`` us, the last one is open.
+
+---@class HAPCharLatency:table Latency of a characteristic.
+---
+---@field aid integer Accessory ID.
+---@field sid integer Service ID.
+---@field cid integer Characteristic ID.
+---@field queue HAPLatencyHist Time in the read queue.
+---@field handler HAPLatencyHist Time in the read or write callback.
+---@field total HAPLatencyHist Time from the request to the response.
+
+---Enable or disable latency recording, disabled by default.
+---@param enabled boolean
+function M.setLatencyEnabled(enabled) end
+
+---Get the latency of the characteristics accessed while recording.
+---@return HAPCharLatency[]
+---@nodiscard
+function M.latencyStats() end
+
+---Reset the latency of all characteristics.
+function M.resetLatencyStats() end
+
+---Encode TLV8 items to a string.
+---@param items HAPTLV8Item[] TLV8 items.
+---@param maxBytes? integer Max length of the result.
+---@return string data
+---@nodiscard
+function M.encodeTLV8(items, maxBytes) end
+
+---Decode TLV8 items from a string.
+---
+---The values are strings, the nested items are not decoded, so decoding
+---does not round-trip the items with nested items given to ``encodeTLV8``.
+---Decode the value of a nested item again to get its items.
+---@param data string TLV8 data.
+---@return HAPTLV8Item[] items
+---@nodiscard
+function M.decodeTLV8(data) end
+
 ---Get a new Instance ID for bridged accessory or service or characteristic.
 ---@param bridgedAccessory? boolean Whether or not to get new IID for bridged accessory.
 ---@return integer iid Instance ID.
@@ -0,0 +1,40 @@
+---@meta
+
+---@class proflib Sampling profiler of Lua code.
+---
+---The stacks of the main thread and the coroutines running the callbacks
+---are sampled every count VM instructions, and aggregated in
+---collapsed-stack format which can be rendered as a flamegraph.
+---The coroutines created by the ``coroutine`` library are not sampled.
+---There is no hook and no memory used before the profiler is started.
+local M = {}
+
+---@class ProfStats:table Profiler statistics.
+---
+---@field running boolean Whether the profiler is running.
+---@field samples integer Number of recorded samples.
+---@field dropped integer Number of samples dropped because the tables are full.
+---@field stacks integer Number of distinct stacks.
+---@field frames integer Number of distinct functions.
+
+---Start sampling.
+---@param count? integer VM instructions between two samples, default is 1000.
+function M.start(count) end
+
+---Stop sampling, the samples are kept.
+function M.stop() end
+
+---Stop sampling and release the samples.
+function M.reset() end
+
+---Dump the samples in collapsed-stack format, one "root;...;leaf count" line per stack.
+---@return string
+---@nodiscard
+function M.dump() end
+
+---Get profiler statistics.
+---@return ProfStats stats
+---@nodiscard
+function M.stats() end
+
+return M
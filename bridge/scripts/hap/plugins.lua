@@ -6,6 +6,9 @@ local M = {}
 
 local logger = log.getLogger("hap.plugins")
 
+---Default max time in milliseconds to initialize all plugins.
+local DEFAULT_TIMEOUT = 60000
+
 ---@class Plugin:table Plugin.
 ---
 ---@field init fun() Initialize plugin and generate accessories in initialization.
@@ -38,26 +41,62 @@ local function loadPlugin(name)
             error(("%s.%s: type error, expected %s, got %s."):format(name, k, t, _t))
         end
     end
+    -- Mark it before initializing, the other plugins run while it waits.
+    priv.plugins[name] = plugin
     logger:info(("Plugin '%s' initializing ..."):format(name))
     local accessories = plugin.init()
     logger:info(("Plugin '%s' initialized."):format(name))
-    priv.plugins[name] = plugin
     return accessories
 end
 
+---Initialize the plugin in the current coroutine.
+---@param name string Plugin name.
+---@return HAPAccessory[] accessories
+local function initPlugin(name)
+    local memLimit = config.get(name .. ".memLimit")
+    if memLimit then
+        core.setMemLimit(name, memLimit)
+    end
+    core.memOwner(name)
+    local success, result = xpcall(loadPlugin, traceback, name)
+    if success == false then
+        logger:error(result)
+        return {}
+    end
+    return result or {}
+end
+
 ---Load plugins and generate bridged accessories.
+---
+---The plugins are initialized concurrently, each one in its own coroutine,
+---and the accessories are gathered once all of them finish. The plugins not
+---finished in ``bridge.pluginsTimeout`` milliseconds are canceled.
 ---@return HAPAccessory[] bridgedAccessories # Bridges Accessories.
 function M.init()
     local names = config.getall("bridge.plugins")
     local accessories = {}
     if names then
-        for _, name in ipairs(names) do
-            local success, result = xpcall(loadPlugin, traceback, name)
-            if success == false then
-                logger:error(result)
-            end
-            for _, accessory in ipairs(result) do
-                table.insert(accessories, accessory)
+        local timeout = math.tointeger(tonumber(config.get("bridge.pluginsTimeout"))) or DEFAULT_TIMEOUT
+        local tasks = {}
+        for i, name in ipairs(names) do
+            tasks[i] = core.spawn(initPlugin, name)
+        end
+        core.joinAll(tasks, timeout)
+
+        -- Keep the order of the configuration.
+        for i, task in ipairs(tasks) do
+            if task:done() then
+                local success, result = task:join()
+                if success then
+                    for _, accessory in ipairs(result) do
+                        table.insert(accessories, accessory)
+                    end
+                else
+                    logger:error(("Plugin '%s' failed: %s"):format(names[i], result))
+                end
+            else
+                logger:error(("Plugin '%s' is not initialized in %d ms, canceled."):format(names[i], timeout))
+                task:cancel()
             end
         end
         local loaded = package.loaded
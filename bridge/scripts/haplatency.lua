@@ -0,0 +1,65 @@
+local hap = require "hap"
+
+local M = {}
+
+local function help()
+    print("usage: haplatency start | stop | reset | dump")
+end
+
+---Get the upper bound of the bucket in microseconds.
+---@param i integer Bucket index starting from 1.
+local function bound(i)
+    return i == 1 and 0 or (1 << (i - 1)) - 1
+end
+
+---Estimate the percentile from the buckets.
+---@param hist HAPLatencyHist
+---@param p number Percentile between 0 and 1.
+local function percentile(hist, p)
+    local rank = hist.count * p
+    local n = 0
+    for i, count in ipairs(hist.buckets) do
+        n = n + count
+        if n >= rank then
+            return math.min(bound(i), hist.max)
+        end
+    end
+    return hist.max
+end
+
+local function fmt(hist)
+    if hist.count == 0 then
+        return "-"
+    end
+    return ("n=%d avg=%d p50=%d p90=%d p99=%d max=%d"):format(hist.count, hist.sum // hist.count,
+        percentile(hist, 0.5), percentile(hist, 0.9), percentile(hist, 0.99), hist.max)
+end
+
+local function dump()
+    local stats = hap.latencyStats()
+    -- the slowest characteristics first
+    table.sort(stats, function (a, b)
+        return a.total.max > b.total.max
+    end)
+    print("latency in us, aid/sid/cid: total | handler | queue")
+    for _, s in ipairs(stats) do
+        print(("%d/%d/%d: %s | %s | %s"):format(s.aid, s.sid, s.cid,
+            fmt(s.total), fmt(s.handler), fmt(s.queue)))
+    end
+end
+
+function M.main(op)
+    if op == "start" then
+        hap.setLatencyEnabled(true)
+    elseif op == "stop" then
+        hap.setLatencyEnabled(false)
+    elseif op == "reset" then
+        hap.resetLatencyStats()
+    elseif op == "dump" then
+        dump()
+    else
+        help()
+    end
+end
+
+return M
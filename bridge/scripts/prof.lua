@@ -0,0 +1,40 @@
+local prof = require "prof"
+local core = require "core"
+
+local M = {}
+
+local function help()
+    print("usage: prof start [count] | stop | reset | stats | dump | record <seconds> [count]")
+end
+
+function M.main(op, ...)
+    if op == "start" then
+        local count = ...
+        prof.start(count and math.tointeger(tonumber(count)))
+    elseif op == "stop" then
+        prof.stop()
+    elseif op == "reset" then
+        prof.reset()
+    elseif op == "stats" then
+        local stats = prof.stats()
+        print(("running: %s, samples: %d, dropped: %d, stacks: %d, frames: %d"):format(
+            stats.running, stats.samples, stats.dropped, stats.stacks, stats.frames))
+    elseif op == "dump" then
+        print(prof.dump())
+    elseif op == "record" then
+        local seconds, count = ...
+        seconds = tonumber(seconds)
+        if not seconds then
+            error("missing seconds")
+        end
+        prof.reset()
+        prof.start(count and math.tointeger(tonumber(count)))
+        core.sleep(math.floor(seconds * 1000))
+        prof.stop()
+        print(prof.dump())
+    else
+        help()
+    end
+end
+
+return M
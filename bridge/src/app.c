@@ -5,6 +5,14 @@
 // See [CONTRIBUTORS.md] for the list of homekit-bridge project authors.
 
 #include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if defined(_POSIX_MAPPED_FILES) && _POSIX_MAPPED_FILES > 0
+#include <sys/mman.h>
+#define APP_USE_MMAP 1
+#endif
 #include <lauxlib.h>
 #include <lualib.h>
 #include <embedfs.h>
@@ -14,6 +22,7 @@
 
 #include "app_int.h"
 #include "lc.h"
+#include "mempool.h"
 
 // Declare the function of lua-cjson.
 #define LUA_CJSON_NAME "cjson"
@@ -29,6 +38,22 @@ extern int luaopen_cjson(lua_State *L);
 // Bridge embedfs root.
 extern const embedfs_dir BRIDGE_EMBEDFS_ROOT;
 
+// Bytecode cache of the scripts in the work directory, stored next to the source.
+#define APP_CACHE_SUFFIX ".cache"
+#define APP_CACHE_MAGIC "LCC\x01"
+
+/**
+ * Bytecode cache header, followed by the stripped bytecode.
+ *
+ * The cache is valid only if the source has the same mtime, size and hash.
+ */
+struct app_cache_header {
+    char magic[4];
+    uint32_t hash;      /* FNV-1a hash of the source */
+    int64_t mtime;
+    int64_t size;
+};
+
 struct app_exec_ctx {
     bool in_progress;
     int argc;
@@ -66,6 +91,7 @@ static const luaL_Reg dynamiclibs[] = {
     {LUA_BASE64_NAME, luaopen_base64},
     {LUA_ARC4_NAME, luaopen_arc4},
     {LUA_NETIF_NAME, luaopen_netif},
+    {LUA_PROF_NAME, luaopen_prof},
     {NULL, NULL}
 };
 
@@ -97,6 +123,10 @@ static void gen_filename(const char *name, char *buf) {
     HAPRawBufferCopyBytes(buf, ".luac", sizeof(".luac"));
 }
 
+static const char *searcher_embedfs_reader(lua_State *L, void *ud, size_t *size) {
+    return embedfs_read(ud, size);
+}
+
 static int searcher_embedfs(lua_State *L) {
     size_t len;
     const char *name = luaL_checklstring(L, 1, &len);
@@ -104,7 +134,13 @@ static int searcher_embedfs(lua_State *L) {
 
     gen_filename(name, filename);
     const embedfs_file *file = embedfs_find_file(&BRIDGE_EMBEDFS_ROOT, filename);
-    if (file) {
+    if (file && file->size) {
+        // decompress the file in the reader window, the strings can't refer to the data
+        embedfs_reader *reader = lua_newuserdatauv(L, sizeof(*reader), 0);
+        embedfs_reader_init(reader, file);
+        lua_load(L, searcher_embedfs_reader, reader, NULL, "b");
+        lua_remove(L, -2);
+    } else if (file) {
         luaL_loadbufferx(L, file->data, file->len, NULL, "const");
     } else {
         lua_pushfstring(L, "no file '%s' in bridge embedfs", filename);
@@ -119,23 +155,74 @@ static int readable(const char *filename) {
     return 1;
 }
 
+#ifdef APP_USE_MMAP
+static int pushmapped(lua_State *L) {
+    lua_pushlstring(L, lua_touserdata(L, 1), lua_tointeger(L, 2));
+    return 1;
+}
+
+// Push the content of the file by mmap, returns false if the file can't be mapped.
+static bool pushfile_mmap(lua_State *L, const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    // copy in protected mode, the mapping must be released on errors
+    lua_pushcfunction(L, pushmapped);
+    lua_pushlightuserdata(L, addr);
+    lua_pushinteger(L, st.st_size);
+    int status = lua_pcall(L, 2, 1, 0);
+    munmap(addr, st.st_size);
+    if (luai_unlikely(status != LUA_OK)) {
+        lua_error(L);
+    }
+    return true;
+}
+#endif
+
+// Push the content of the file with a single read.
+static bool pushfile_read(lua_State *L, const char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    long size = -1;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        size = ftell(f);
+    }
+    if (size < 0 || fseek(f, 0, SEEK_SET) != 0) {
+        fclose(f);
+        return false;
+    }
+    luaL_Buffer B;
+    char *buf = luaL_buffinitsize(L, &B, size);
+    size_t rc = fread(buf, 1, size, f);
+    fclose(f);
+    luaL_pushresultsize(&B, rc);
+    return true;
+}
+
 static int openjson(lua_State *L) {
     const char *filename = lua_tostring(L, lua_upvalueindex(1));
-    FILE *f = fopen(filename, "r");
-    if (f == NULL) {
+    lua_pushvalue(L, lua_upvalueindex(2));
+    bool pushed = false;
+#ifdef APP_USE_MMAP
+    pushed = pushfile_mmap(L, filename);
+#endif
+    if (!pushed && !pushfile_read(L, filename)) {
         lua_pushfstring(L, "no file '%s'", filename);
         lua_error(L);
     }
-    lua_pushvalue(L, lua_upvalueindex(2));
-    char buf[512];
-    luaL_Buffer B;
-    luaL_buffinit(L, &B);
-    while (!feof(f)) {
-        size_t rc = fread(buf, 1, sizeof(buf), f);
-        luaL_addlstring(&B, buf, rc);
-    }
-    fclose(f);
-    luaL_pushresult(&B);
     int status = lua_pcall(L, 1, 1, 0);
     if (luai_unlikely(status != LUA_OK)) {
         luaL_error(L, "decode '%s' failed: %s", filename, lua_tostring(L, -1));
@@ -163,16 +250,150 @@ static int searcher_json(lua_State *L) {
     return 1;
 }
 
-static void *app_lua_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
-    (void)ud; (void)osize; /* not used */
-    if (nsize == 0) {
-        pal_mem_free(ptr);
+static uint32_t cache_hash(const char *s, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)s[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Read the file from the offset to the end to a userdata and push it, returns NULL if failed.
+static char *cache_readfp(lua_State *L, FILE *f, size_t offset, size_t *len) {
+    if (fseek(f, 0, SEEK_END) != 0) {
         return NULL;
-    } else {
-        return pal_mem_realloc(ptr, nsize);
+    }
+    long size = ftell(f);
+    if (size < (long)offset || fseek(f, offset, SEEK_SET) != 0) {
+        return NULL;
+    }
+    *len = size - offset;
+    char *buf = lua_newuserdatauv(L, *len, 0);
+    if (fread(buf, 1, *len, f) != *len) {
+        lua_pop(L, 1);
+        return NULL;
+    }
+    return buf;
+}
+
+// Read the whole file to a userdata and push it, returns NULL if failed.
+static char *cache_readfile(lua_State *L, const char *filename, size_t *len) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        return NULL;
+    }
+    char *buf = cache_readfp(L, f, 0, len);
+    fclose(f);
+    return buf;
+}
+
+// Load the cached bytecode, returns true if the chunk is pushed.
+static bool cache_load(lua_State *L, const char *cachename, const struct app_cache_header *key) {
+    FILE *f = fopen(cachename, "rb");
+    if (!f) {
+        return false;
+    }
+    struct app_cache_header header;
+    size_t len;
+    const char *buf = NULL;
+    if (fread(&header, 1, sizeof(header), f) == sizeof(header) &&
+        memcmp(&header, key, sizeof(header)) == 0) {
+        buf = cache_readfp(L, f, sizeof(header), &len);
+    }
+    fclose(f);
+    if (!buf) {
+        return false;
+    }
+    if (luaL_loadbufferx(L, buf, len, NULL, "b") != LUA_OK) {
+        lua_pop(L, 2);
+        return false;
+    }
+    lua_remove(L, -2);
+    return true;
+}
+
+static int cache_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+    return fwrite(p, 1, sz, ud) != sz;
+}
+
+// Dump the chunk on the top of the stack to the cache, errors are ignored.
+static void cache_save(lua_State *L, const char *cachename, const struct app_cache_header *header) {
+    // a unique name, the bridges sharing the work directory may save the same cache
+    size_t len = strlen(cachename);
+    char tmpname[len + sizeof(".XXXXXX")];
+    memcpy(tmpname, cachename, len);
+    memcpy(tmpname + len, ".XXXXXX", sizeof(".XXXXXX"));
+    int fd = mkstemp(tmpname);
+    if (fd < 0) {
+        return;
+    }
+    FILE *f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        remove(tmpname);
+        return;
+    }
+    bool failed = fwrite(header, 1, sizeof(*header), f) != sizeof(*header) ||
+        lua_dump(L, cache_writer, f, 1) != 0;
+    failed = fclose(f) != 0 || failed;
+    if (failed || rename(tmpname, cachename) != 0) {
+        remove(tmpname);
     }
 }
 
+// searcher_cache(name) loads "${workdir}/${name}.lua" through the bytecode cache.
+static int searcher_cache(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
+    lua_getfield(L, lua_upvalueindex(1), "workdir");
+    const char *workdir = lua_tostring(L, -1);
+    if (luai_unlikely(workdir == NULL)) {
+        lua_pushstring(L, "'package.workdir' must be a string");
+        return 1;
+    }
+    name = luaL_gsub(L, name, ".", "/");
+    const char *filename = lua_pushfstring(L, "%s/%s.lua", workdir, name);
+    int idx = lua_gettop(L);
+
+    struct stat st;
+    if (stat(filename, &st) != 0) {
+        lua_pushfstring(L, "no file '%s'", filename);
+        return 1;
+    }
+    size_t len;
+    const char *src = cache_readfile(L, filename, &len);
+    if (!src) {
+        lua_pushfstring(L, "no file '%s'", filename);
+        return 1;
+    }
+
+    struct app_cache_header key;
+    memset(&key, 0, sizeof(key));
+    memcpy(key.magic, APP_CACHE_MAGIC, sizeof(key.magic));
+    key.hash = cache_hash(src, len);
+    key.mtime = st.st_mtime;
+    key.size = len;
+
+    const char *cachename = lua_pushfstring(L, "%s" APP_CACHE_SUFFIX, filename);
+    if (!cache_load(L, cachename, &key)) {
+        lua_pushfstring(L, "@%s", filename);
+        if (luaL_loadbufferx(L, src, len, lua_tostring(L, -1), NULL) != LUA_OK) {
+            luaL_error(L, "error loading module '%s' from file '%s':\n\t%s",
+                lua_tostring(L, 1), filename, lua_tostring(L, -1));
+        }
+        cache_save(L, cachename, &key);
+    }
+    lua_pushvalue(L, idx);
+    return 2;
+}
+
+static void *app_lua_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    (void)ud; /* not used */
+    if (!ptr) {
+        osize = 0;  /* osize is the type of the object when ptr is NULL */
+    }
+    return mempool_realloc(ptr, osize, nsize);
+}
+
 // app_pinit(dir: lightuserdata)
 static int app_pinit(lua_State *L) {
     const char *dir = lua_touserdata(L, 1);
@@ -185,8 +406,9 @@ static int app_pinit(lua_State *L) {
         lua_pop(L, 1);  /* remove lib */
     }
 
-    // GC in generational mode
-    lua_gc(L, LUA_GCGEN, 0, 0);
+    // GC in incremental mode with the default pause and step multiplier,
+    // lc_collectgarbage() steps it between the callbacks
+    lua_gc(L, LUA_GCINC, 0, 0, 0);
 
     // package.path = "${dir}/?.lua;${dir}/?.luac"
     lua_getglobal(L, "package");
@@ -211,6 +433,14 @@ static int app_pinit(lua_State *L) {
     // remove searchers [searcher_C, searcher_Croot] from table 'searchers'
     len -= 2;
 
+    // put searcher_cache before searcher_Lua, searcher_Lua still loads "${dir}/?.luac"
+    lua_rawgeti(L, -1, len);
+    lua_rawseti(L, -2, len + 1);
+    lua_pushvalue(L, -2);
+    lua_pushcclosure(L, searcher_cache, 1);
+    lua_rawseti(L, -2, len);
+    len++;
+
     static const lua_CFunction searchers[] = {
         searcher_dl, searcher_embedfs, searcher_json, NULL
     };
@@ -250,6 +480,10 @@ void app_init(const char *dir) {
         HAPFatalError();
     }
 
+    // the extra space of the main thread is not initialized,
+    // and it is copied to the new threads
+    lc_setowner(L, MEMPOOL_OWNER_BRIDGE);
+
     lua_atpanic(L, &panic);
 
     // call 'app_pinit' in protected mode
@@ -272,6 +506,8 @@ void app_deinit() {
     if (L) {
         lua_close(L);
         L = NULL;
+        lc_deinit();
+        mempool_deinit();
     }
 }
 
@@ -7,6 +7,36 @@
 #include <string.h>
 #include <embedfs.h>
 
+/**
+ * FNV-1a hash, must be the same as embedfs_hash() in gen_embedfs.cmake.
+ */
+static uint32_t embedfs_hash(const char *path) {
+    uint32_t hash = 2166136261u;
+    for (; *path; path++) {
+        hash = (hash ^ (uint8_t)*path) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Must be the same as embedfs_slot() in gen_embedfs.cmake.
+ */
+static size_t embedfs_slot(uint32_t hash, uint16_t disp, size_t count) {
+    uint32_t x = hash ^ disp;
+    x = ((x >> 16) ^ x) * 73244475u;
+    x = ((x >> 16) ^ x) * 73244475u;
+    return ((x >> 16) ^ x) % count;
+}
+
+const embedfs_file *embedfs_lookup(const embedfs_index *index, const char *path) {
+    uint32_t hash = embedfs_hash(path);
+    size_t slot = embedfs_slot(hash, index->disps[hash % index->count], index->count);
+    if (strcmp(index->paths[slot], path)) {
+        return NULL;
+    }
+    return index->files[slot];
+}
+
 static const embedfs_dir *embedfs_subdir(const embedfs_dir *dir, const char *name) {
     int left = 0;
     int right = dir->child_count - 1;
@@ -26,6 +56,10 @@ static const embedfs_dir *embedfs_subdir(const embedfs_dir *dir, const char *nam
 }
 
 const embedfs_file *embedfs_find_file(const embedfs_dir *dir, const char *path) {
+    if (dir->index) {
+        return embedfs_lookup(dir->index, path);
+    }
+
     size_t len = strlen(path);
     char tmp[len + 1];
     memcpy(tmp, path, len);
@@ -68,3 +102,61 @@ const embedfs_file *embedfs_find_file(const embedfs_dir *dir, const char *path)
     }
     return NULL;
 }
+
+void embedfs_reader_init(embedfs_reader *reader, const embedfs_file *file) {
+    reader->file = file;
+    reader->pos = 0;
+    reader->literal = 0;
+    reader->match = 0;
+    reader->distance = 0;
+    reader->wpos = 0;
+}
+
+const char *embedfs_read(embedfs_reader *reader, size_t *size) {
+    const embedfs_file *file = reader->file;
+    const unsigned char *data = (const unsigned char *)file->data;
+
+    if (!file->size) {
+        if (reader->pos == file->len) {
+            *size = 0;
+            return NULL;
+        }
+        reader->pos = file->len;
+        *size = file->len;
+        return file->data;
+    }
+
+    if (reader->wpos == EMBEDFS_LZ_WINDOW) {
+        reader->wpos = 0;
+    }
+    size_t start = reader->wpos;
+    while (reader->wpos < EMBEDFS_LZ_WINDOW) {
+        if (reader->match) {
+            size_t from = (reader->wpos + EMBEDFS_LZ_WINDOW - reader->distance) % EMBEDFS_LZ_WINDOW;
+            reader->window[reader->wpos++] = reader->window[from];
+            reader->match--;
+        } else if (reader->literal) {
+            size_t n = EMBEDFS_LZ_WINDOW - reader->wpos;
+            if (n > reader->literal) {
+                n = reader->literal;
+            }
+            memcpy(reader->window + reader->wpos, data + reader->pos, n);
+            reader->wpos += n;
+            reader->pos += n;
+            reader->literal -= n;
+        } else if (reader->pos == file->len) {
+            break;
+        } else {
+            unsigned char token = data[reader->pos++];
+            if (token & 0x80) {
+                reader->match = (token & 0x7f) + 4;
+                reader->distance = data[reader->pos] | (data[reader->pos + 1] << 8);
+                reader->pos += 2;
+            } else {
+                reader->literal = token + 1;
+            }
+        }
+    }
+    *size = reader->wpos - start;
+    return *size ? reader->window + start : NULL;
+}
@@ -6,11 +6,70 @@
 
 #include <string.h>
 #include <lauxlib.h>
+#include <pal/clock.h>
 
 #include "app_int.h"
 #include "lc.h"
+#include "mempool.h"
+#include "timerwheel.h"
 
-#define THREAD_POOL_SIZE 8
+/**
+ * Min and max number of idle coroutines kept in the pool.
+ * The pool grows to the max number of coroutines in use at the same time.
+ */
+#ifndef LC_THREAD_POOL_MIN
+#define LC_THREAD_POOL_MIN 8
+#endif
+
+#ifndef LC_THREAD_POOL_MAX
+#define LC_THREAD_POOL_MAX 64
+#endif
+
+/**
+ * Period in milliseconds, after which the pool shrinks to the max number
+ * of coroutines in use during the period. The decay timer runs only while
+ * the pool is larger than LC_THREAD_POOL_MIN.
+ */
+#ifndef LC_THREAD_POOL_DECAY
+#define LC_THREAD_POOL_DECAY 10000
+#endif
+
+/**
+ * The GC knobs below assume the incremental mode set by app_pinit(),
+ * the steps finish the cycles which release the free slabs of the pool.
+ */
+
+/**
+ * Amount of GC work in KBytes done by a single step.
+ */
+#ifndef LC_GC_STEP_SIZE
+#define LC_GC_STEP_SIZE 16
+#endif
+
+/**
+ * Time budget in milliseconds for the GC steps done by lc_collectgarbage().
+ * 0 means only one step is done per call.
+ */
+#ifndef LC_GC_TIME_BUDGET
+#define LC_GC_TIME_BUDGET 0
+#endif
+
+/**
+ * When the memory in use in KBytes is greater than this threshold,
+ * a full garbage-collection cycle is performed. 0 means disabled.
+ */
+#ifndef LC_GC_FULL_THRESHOLD
+#define LC_GC_FULL_THRESHOLD 0
+#endif
+
+/**
+ * Growth in percent over the memory in use after the last full cycle
+ * needed before another full cycle is performed, so that the live data
+ * above the threshold does not trigger a full cycle on every call.
+ */
+#ifndef LC_GC_FULL_GROWTH
+#define LC_GC_FULL_GROWTH 150
+#endif
 
 static const HAPLogObject lc_log = {
     .subsystem = APP_BRIDGE_LOG_SUBSYSTEM,
@@ -18,39 +77,89 @@ static const HAPLogObject lc_log = {
 };
 
 static struct {
-    size_t head, tail;
-    lua_State *pool[THREAD_POOL_SIZE + 1];
-} thread_pool;
+    size_t size;        /* idle coroutines */
+    size_t capacity;    /* max idle coroutines kept */
+    size_t window_max;  /* max coroutines in use in the current period */
+    timerwheel_node decay_timer;
+    lua_State *L;       /* main thread, owning the coroutines in the registry */
+    lua_State *pool[LC_THREAD_POOL_MAX];
+} thread_pool = {
+    .capacity = LC_THREAD_POOL_MIN,
+};
+
+static lc_thread_stats thread_stats;
+
+static lc_gc_stats gc_stats;
+
+// Memory in use in KBytes after the last full garbage-collection cycle.
+static int gc_full_baseline;
 
-static inline size_t thread_pool_size() {
-    return (HAPArrayCount(thread_pool.pool) + thread_pool.tail - thread_pool.head)
-        % HAPArrayCount(thread_pool.pool);
+static struct {
+    lua_Hook func;
+    int mask;
+    int count;
+} thread_hook;
+
+// Install the current hook on a coroutine created or suspended before the hook is set.
+static inline void lc_synchook(lua_State *co) {
+    if (luai_unlikely(lua_gethook(co) != thread_hook.func || lua_gethookcount(co) != thread_hook.count)) {
+        lua_sethook(co, thread_hook.func, thread_hook.mask, thread_hook.count);
+    }
 }
 
-static inline bool thread_pool_full() {
-    return thread_pool_size() == THREAD_POOL_SIZE;
+static void thread_pool_release(lua_State *L, lua_State *co) {
+    lua_pushnil(L);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, co);
 }
 
-static inline bool thread_pool_empty() {
-    return thread_pool.head == thread_pool.tail;
+// Shrink the pool to the max number of coroutines in use in the last period.
+static void thread_pool_decay_cb(timerwheel_node *node) {
+    lua_State *L = thread_pool.L;
+    HAPAssert(lua_gettop(L) == 0);
+
+    thread_pool.capacity = HAPMax(thread_pool.window_max, LC_THREAD_POOL_MIN);
+    thread_pool.window_max = thread_stats.active;
+    while (thread_pool.size > thread_pool.capacity) {
+        thread_pool_release(L, thread_pool.pool[--thread_pool.size]);
+    }
+    if (thread_pool.capacity > LC_THREAD_POOL_MIN) {
+        timerwheel_start(&thread_pool.decay_timer, LC_THREAD_POOL_DECAY, thread_pool_decay_cb);
+    }
 }
 
-static lua_State *thread_pool_deque() {
-    lua_State *L = thread_pool.pool[thread_pool.head];
-    thread_pool.head = (thread_pool.head + 1) % HAPArrayCount(thread_pool.pool);
-    return L;
+static size_t lc_kvs_count(const lc_table_kv *kv_tab) {
+    size_t n = 0;
+    while (kv_tab[n].key != NULL) {
+        n++;
+    }
+    return n;
 }
 
-static void thread_pool_enque(lua_State *L) {
-    thread_pool.pool[thread_pool.tail] = L;
-    thread_pool.tail = (thread_pool.tail + 1) % HAPArrayCount(thread_pool.pool);
+bool lc_kvs_is_sorted(const lc_table_kv *kvs) {
+    for (size_t n = 1; kvs[0].key && kvs[n].key; n++) {
+        if (strcmp(kvs[n - 1].key, kvs[n].key) >= 0) {
+            return false;
+        }
+    }
+    return true;
 }
 
 static const lc_table_kv *
-lc_lookup_kv_by_name(const lc_table_kv *kv_tab, const char *key) {
-    for (; kv_tab->key != NULL; kv_tab++) {
-        if (!strcmp(kv_tab->key, key)) {
-            return kv_tab;
+lc_lookup_kv_by_name(const lc_table_kv *kv_tab, size_t n, const char *key) {
+    if (!key) {
+        return NULL;
+    }
+    size_t lo = 0;
+    size_t hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(key, kv_tab[mid].key);
+        if (cmp == 0) {
+            return kv_tab + mid;
+        } else if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
         }
     }
     return NULL;
@@ -80,6 +189,8 @@ static char *lc_typename(lua_State *L, uint32_t lc_type, char *buf, size_t len)
 }
 
 bool lc_traverse_table(lua_State *L, int idx, const lc_table_kv *kvs, void *arg) {
+    size_t nkvs = lc_kvs_count(kvs);
+
     // Push another reference to the table on top of the stack (so we know
     // where it is, and this function can work for negative, positive and
     // pseudo indices
@@ -93,7 +204,7 @@ bool lc_traverse_table(lua_State *L, int idx, const lc_table_kv *kvs, void *arg)
         lua_pushvalue(L, -2);
         // stack now contains: -1 => key; -2 => value; -3 => key; -4 => table
         const char *key = lua_tostring(L, -1);
-        const lc_table_kv *kv = lc_lookup_kv_by_name(kvs, key);
+        const lc_table_kv *kv = lc_lookup_kv_by_name(kvs, nkvs, key);
         // pop copy of key
         lua_pop(L, 1);
         // stack now contains: -1 => value; -2 => key; -3 => table
@@ -166,7 +277,47 @@ lua_State *lc_getmainthread(lua_State *L) {
 }
 
 void lc_collectgarbage(lua_State *L) {
-    lua_gc(L, LUA_GCCOLLECT);
+    uint64_t start = pal_clock_get_us();
+    int before = lua_gc(L, LUA_GCCOUNT);
+
+    if (LC_GC_FULL_THRESHOLD && before >= LC_GC_FULL_THRESHOLD &&
+        (int64_t)before * 100 >= (int64_t)gc_full_baseline * LC_GC_FULL_GROWTH) {
+        lua_gc(L, LUA_GCCOLLECT);
+        gc_stats.fulls++;
+        gc_full_baseline = lua_gc(L, LUA_GCCOUNT);
+        mempool_trim();
+    } else {
+        do {
+            gc_stats.steps++;
+            if (lua_gc(L, LUA_GCSTEP, LC_GC_STEP_SIZE)) {
+                gc_stats.cycles++;
+                // the garbage of the whole cycle is freed
+                mempool_trim();
+                break;
+            }
+        } while (pal_clock_get_us() - start < LC_GC_TIME_BUDGET * 1000);
+    }
+
+    int after = lua_gc(L, LUA_GCCOUNT);
+    if (after < before) {
+        gc_stats.freed += before - after;
+    }
+    uint64_t elapsed = pal_clock_get_us() - start;
+    gc_stats.calls++;
+    gc_stats.time_us += elapsed;
+    if (elapsed > gc_stats.max_time_us) {
+        gc_stats.max_time_us = elapsed;
+    }
+}
+
+const lc_gc_stats *lc_getgcstats(void) {
+    return &gc_stats;
+}
+
+const lc_thread_stats *lc_getthreadstats(void) {
+    thread_stats.pooled = thread_pool.size;
+    thread_stats.capacity = thread_pool.capacity;
+    return &thread_stats;
 }
 
 static int traceback(lua_State *L) {
@@ -183,33 +334,143 @@ void lc_pushtraceback(lua_State *L) {
     lua_pushcfunction(L, traceback);
 }
 
+int lc_getowner(lua_State *L) {
+    return *(int *)lua_getextraspace(L);
+}
+
+void lc_setowner(lua_State *L, int owner) {
+    *(int *)lua_getextraspace(L) = owner;
+}
+
 lua_State *lc_newthread(lua_State *L) {
-    if (!thread_pool_empty()) {
-        return thread_pool_deque();
+    lua_State *co;
+    if (thread_pool.size) {
+        co = thread_pool.pool[--thread_pool.size];
+        thread_stats.hits++;
+    } else {
+        co = lua_newthread(L);
+        lua_pushthread(co);
+        lua_rawsetp(co, LUA_REGISTRYINDEX, co);
+        thread_stats.misses++;
+    }
+
+    thread_stats.active++;
+    if (thread_stats.active > thread_stats.high_water) {
+        thread_stats.high_water = thread_stats.active;
     }
-    lua_State *co = lua_newthread(L);
-    lua_pushthread(co);
-    lua_rawsetp(co, LUA_REGISTRYINDEX, co);
+    if (thread_stats.active > thread_pool.window_max) {
+        thread_pool.window_max = thread_stats.active;
+    }
+    if (thread_stats.active > thread_pool.capacity) {
+        thread_pool.capacity = HAPMin(thread_stats.active, LC_THREAD_POOL_MAX);
+        if (!timerwheel_is_active(&thread_pool.decay_timer)) {
+            thread_pool.L = lc_getmainthread(L);
+            timerwheel_start(&thread_pool.decay_timer, LC_THREAD_POOL_DECAY, thread_pool_decay_cb);
+        }
+    }
+
+    lc_setowner(co, mempool_getcurrent());
+    lc_synchook(co);
     return co;
 }
 
+void lc_deinit(void) {
+    timerwheel_stop(&thread_pool.decay_timer);
+    thread_pool.size = 0;
+    thread_pool.capacity = LC_THREAD_POOL_MIN;
+    thread_pool.window_max = 0;
+    thread_pool.L = NULL;
+    HAPRawBufferZero(&thread_stats, sizeof(thread_stats));
+}
+
+void lc_sethook(lua_State *L, lua_Hook func, int mask, int count) {
+    thread_hook.func = func;
+    thread_hook.mask = mask;
+    thread_hook.count = count;
+    lua_sethook(lc_getmainthread(L), func, mask, count);
+    lua_sethook(L, func, mask, count);
+    for (size_t i = 0; i < thread_pool.size; i++) {
+        lua_sethook(thread_pool.pool[i], func, mask, count);
+    }
+}
+
 static void lc_freethread(lua_State *L, lua_State *from) {
-    if (thread_pool_full()) {
-        lua_pushnil(L);
-        lua_rawsetp(L, LUA_REGISTRYINDEX, L);
+    thread_stats.active--;
+    if (thread_pool.size < thread_pool.capacity) {
+        thread_pool.pool[thread_pool.size++] = L;
     } else {
-        thread_pool_enque(L);
+        thread_pool_release(L, L);
     }
     lua_closethread(L, from);
 }
 
+// Key of the registry table mapping the suspended coroutines to the pending operations.
+static const char pending_key;
+
+static void lc_setpending_int(lua_State *L, lua_State *co, lc_pending *pending) {
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &pending_key) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        if (!pending) {
+            return;
+        }
+        lua_createtable(L, 0, 4);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &pending_key);
+    }
+    if (pending) {
+        lua_pushlightuserdata(L, pending);
+    } else {
+        lua_pushnil(L);
+    }
+    lua_rawsetp(L, -2, co);
+    lua_pop(L, 1);
+}
+
+void lc_setpending(lua_State *L, lc_pending *pending) {
+    HAPPrecondition(pending);
+    lc_setpending_int(L, L, pending);
+}
+
+void lc_cancel(lua_State *L, lua_State *from) {
+    lc_pending *pending = NULL;
+    if (lua_rawgetp(from, LUA_REGISTRYINDEX, &pending_key) == LUA_TTABLE) {
+        if (lua_rawgetp(from, -1, L) == LUA_TLIGHTUSERDATA) {
+            pending = lua_touserdata(from, -1);
+        }
+        lua_pop(from, 1);
+    }
+    if (luai_unlikely(!pending && lua_status(L) == LUA_YIELD)) {
+        luaL_error(from, "the coroutine is waiting for an operation that cannot be canceled");
+    }
+    if (pending) {
+        lua_pushnil(from);
+        lua_rawsetp(from, -2, L);
+        pending->cancel(pending);
+    }
+    lua_pop(from, 1);
+
+    // the coroutine may be still in the waiting lists, do not put it into the pool
+    thread_stats.active--;
+    if (luai_unlikely(lua_closethread(L, from) != LUA_OK)) {
+        HAPLogError(&lc_log, "%s: %s", __func__, lua_tostring(L, -1));
+    }
+    thread_pool_release(from, L);
+}
+
 int lc_resume(lua_State *L, lua_State *from, int narg, int *nres) {
     int before_status = lua_status(L);
     if (luai_unlikely(before_status != LUA_OK && before_status != LUA_YIELD)) {
         luaL_error(L, "invalid coroutine status");
     }
+    if (before_status == LUA_YIELD) {
+        lc_setpending_int(from, L, NULL);
+    }
 
+    lc_synchook(L);
+    int owner = mempool_getcurrent();
+    mempool_setcurrent(lc_getowner(L));
     int status = lua_resume(L, from, narg, nres);
+    mempool_setcurrent(owner);
     switch (status) {
     case LUA_OK:
         if (luai_unlikely(!lua_checkstack(L, *nres))) {
@@ -227,3 +488,35 @@ int lc_resume(lua_State *L, lua_State *from, int narg, int *nres) {
     }
     return status;
 }
+
+void lc_waiter_link(lc_waiter **head, lc_waiter *waiter, void *obj) {
+    waiter->next = *head;
+    if (waiter->next) {
+        waiter->next->pprev = &waiter->next;
+    }
+    *head = waiter;
+    waiter->pprev = head;
+    waiter->obj = obj;
+}
+
+void lc_waiter_unlink(lc_waiter *waiter) {
+    if (!waiter->obj) {
+        return;
+    }
+    *waiter->pprev = waiter->next;
+    if (waiter->next) {
+        waiter->next->pprev = waiter->pprev;
+    }
+    waiter->next = NULL;
+    waiter->pprev = NULL;
+    waiter->obj = NULL;
+}
+
+void lc_waiter_wakeall(lc_waiter **head) {
+    // the ready callbacks may unlink other waiters in the list
+    while (*head) {
+        lc_waiter *waiter = *head;
+        lc_waiter_unlink(waiter);
+        waiter->ready(waiter);
+    }
+}
@@ -11,6 +11,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <lua.h>
 
 #define LC_TNONE            0                           // none
@@ -49,9 +50,18 @@ typedef struct lc_table_kv {
 
 /**
  * Traverse Lua table.
+ *
+ * @attention The kvs must be sorted by key in strcmp() order and
+ *            end with a NULL key, the fields are looked up by binary search.
+ *            The order is not checked, check it once with lc_kvs_is_sorted().
  */
 bool lc_traverse_table(lua_State *L, int idx, const lc_table_kv *kvs, void *arg);
 
+/**
+ * Check whether the kvs are sorted by key in strcmp() order.
+ */
+bool lc_kvs_is_sorted(const lc_table_kv *kvs);
+
 /**
  * Traverse Lua array.
  *
@@ -66,26 +76,174 @@ bool lc_traverse_array(lua_State *L, int idx,
  */
 lua_State *lc_getmainthread(lua_State *L);
 
+/**
+ * GC statistics.
+ */
+typedef struct lc_gc_stats {
+    size_t calls;       /* number of calls to lc_collectgarbage() */
+    size_t steps;       /* number of incremental steps */
+    size_t cycles;      /* number of cycles finished by steps */
+    size_t fulls;       /* number of full collections due to memory pressure */
+    uint64_t freed;     /* memory freed in KBytes */
+    uint64_t time_us;       /* total time spent in microseconds */
+    uint64_t max_time_us;   /* max time spent by one call in microseconds */
+} lc_gc_stats;
+
 /**
  * Collect garbage.
+ *
+ * Performs a budgeted GC step, and a full garbage-collection cycle
+ * only under memory pressure, when the memory in use has grown enough
+ * since the last full cycle.
  */
 void lc_collectgarbage(lua_State *L);
 
+/**
+ * Get GC statistics.
+ */
+const lc_gc_stats *lc_getgcstats(void);
+
+/**
+ * Coroutine pool statistics.
+ */
+typedef struct lc_thread_stats {
+    size_t hits;        /* coroutines reused from the pool */
+    size_t misses;      /* coroutines created because the pool is empty */
+    size_t active;      /* coroutines in use */
+    size_t high_water;  /* max coroutines in use at the same time */
+    size_t pooled;      /* idle coroutines in the pool */
+    size_t capacity;    /* max idle coroutines kept in the pool */
+} lc_thread_stats;
+
+/**
+ * Get coroutine pool statistics.
+ */
+const lc_thread_stats *lc_getthreadstats(void);
+
+/**
+ * Reset the coroutine pool after the Lua state is closed.
+ */
+void lc_deinit(void);
+
 /**
  * Push traceback function to lua stack.
  */
 void lc_pushtraceback(lua_State *L);
 
 /**
- * New a coroutine.
+ * Get the memory owner of the thread.
+ */
+int lc_getowner(lua_State *L);
+
+/**
+ * Set the memory owner of the thread.
+ *
+ * The memory allocated by the thread resumed by lc_resume() is charged to the owner.
+ */
+void lc_setowner(lua_State *L, int owner);
+
+/**
+ * Set the hook of the main thread, the current thread and the coroutines
+ * returned by lc_newthread(). A NULL func removes the hook.
+ *
+ * The coroutines suspended before are hooked when resumed by lc_resume(),
+ * the coroutines created and resumed by the coroutine library are not hooked.
+ */
+void lc_sethook(lua_State *L, lua_Hook func, int mask, int count);
+
+/**
+ * New a coroutine, the owner is the current memory owner.
  */
 lua_State *lc_newthread(lua_State *L);
 
 /**
  * Resume a coroutine. Must call it in protected mode.
+ *
+ * The pending operation of the coroutine is cleared.
  */
 int lc_resume(lua_State *L, lua_State *from, int narg, int *nres);
 
+/**
+ * Get the struct containing the member pointed by ptr.
+ */
+#define lc_container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+typedef struct lc_pending lc_pending;
+
+/**
+ * Pending operation of a suspended coroutine.
+ */
+struct lc_pending {
+    /**
+     * Tear down the operation, the coroutine must not be resumed by it.
+     */
+    void (*cancel)(lc_pending *pending);
+};
+
+/**
+ * Set the pending operation of the current coroutine before it yields.
+ */
+void lc_setpending(lua_State *L, lc_pending *pending);
+
+/**
+ * Cancel a suspended coroutine returned by lc_newthread().
+ *
+ * The pending operation is torn down and the coroutine is closed,
+ * it is not reused by lc_newthread(). Must call it in protected mode.
+ */
+void lc_cancel(lua_State *L, lua_State *from);
+
+/**
+ * Metatable field of the waitable objects, a light userdata
+ * pointing to lc_waitable_method.
+ */
+#define LC_WAITABLE "__waitable"
+
+typedef struct lc_waiter lc_waiter;
+
+/**
+ * Methods of the waitable objects used by core.select().
+ */
+typedef struct lc_waitable_method {
+    /**
+     * Start waiting the object at index idx.
+     *
+     * @returns true if the object is ready now, otherwise waiter->ready()
+     *          will be called once it is ready.
+     */
+    bool (*wait)(lua_State *L, int idx, lc_waiter *waiter);
+
+    /**
+     * Stop waiting, nothing to do if the waiter is not waiting.
+     */
+    void (*cancel)(lc_waiter *waiter);
+} lc_waitable_method;
+
+/**
+ * Waiter of a waitable object.
+ */
+struct lc_waiter {
+    lc_waiter *next;        /* for the objects keeping a list of waiters */
+    lc_waiter **pprev;
+    void *obj;              /* the object being waited, NULL if not waiting */
+    void (*ready)(lc_waiter *waiter);
+};
+
+/**
+ * Add the waiter to the waiter list of the object.
+ */
+void lc_waiter_link(lc_waiter **head, lc_waiter *waiter, void *obj);
+
+/**
+ * Remove the waiter from the waiter list, nothing to do if it is not waiting.
+ */
+void lc_waiter_unlink(lc_waiter *waiter);
+
+/**
+ * Remove all waiters from the waiter list and tell them the object is ready.
+ */
+void lc_waiter_wakeall(lc_waiter **head);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,16 +5,27 @@
 // See [CONTRIBUTORS.md] for the list of homekit-bridge project authors.
 
 #include <lauxlib.h>
+#include <embedfs.h>
 #include <HAPLog.h>
 #include <HAPPlatformTimer.h>
 
 #include "app_int.h"
 #include "lc.h"
+#include "mempool.h"
+#include "timerwheel.h"
 
 #define LUA_TIMER_NAME "Timer*"
+#define LUA_SLEEP_NAME "Sleep*"
+#define LUA_SELECT_NAME "Select*"
+#define LUA_TASK_NAME "Task*"
+#define LUA_JOIN_NAME "Join*"
+#define LUA_JOIN_ALL_NAME "JoinAll*"
 #define LUA_MQ_OBJ_NAME "MQ*"
 #define LCORE_ATEXITS "_ATEXITS"
 
+// Bridge embedfs root.
+extern const embedfs_dir BRIDGE_EMBEDFS_ROOT;
+
 static const HAPLogObject lcore_log = {
     .subsystem = APP_BRIDGE_LOG_SUBSYSTEM,
     .category = "core",
@@ -24,15 +35,115 @@ static const HAPLogObject lcore_log = {
  * Timer object context.
  */
 typedef struct {
+    timerwheel_node node;   /* Must be the first member. */
     int nargs;
+    int owner;  /* Memory owner of the callback. */
     lua_State *mL;
-    HAPPlatformTimerRef timer;  /* Timer ID. Start from 1. */
+    lc_waiter *selectors;   /* Waiters of core.select(). */
+    HAPTime expire;     /* Expiration time before delayed by the slack. */
+    HAPTime period;     /* 0 if the timer is not periodic. */
+    HAPTime slack;
 } lcore_timer_ctx;
 
+/**
+ * Sleep context, kept on the stack of the sleeping coroutine.
+ */
+typedef struct {
+    timerwheel_node node;   /* Must be the first member. */
+    lua_State *co;
+    lc_pending pending;
+} lcore_sleep_ctx;
+
+struct lcore_select_ctx;
+
+typedef struct {
+    lc_waiter waiter;   /* Must be the first member. */
+    const lc_waitable_method *method;
+    struct lcore_select_ctx *ctx;
+} lcore_select_item;
+
+/**
+ * Select context, kept on the stack of the selecting coroutine.
+ */
+typedef struct lcore_select_ctx {
+    lcore_sleep_ctx sleep;  /* Must be the first member, wakes up the coroutine. */
+    bool waiting;
+    int nitems;     /* number of items started waiting */
+    int ready;      /* index of the ready object, 0 if timed out */
+    lcore_select_item items[];
+} lcore_select_ctx;
+
+HAP_ENUM_BEGIN(uint8_t, lcore_task_state) {
+    LCORE_TASK_PENDING,     /* waiting to start */
+    LCORE_TASK_RUNNING,
+    LCORE_TASK_DONE,
+    LCORE_TASK_FAILED,
+    LCORE_TASK_CANCELED,
+} HAP_ENUM_END(uint8_t, lcore_task_state);
+
+/**
+ * Task object, the results are stored in the uservalue 1 once it finishes.
+ */
+typedef struct {
+    timerwheel_node node;   /* Must be the first member, starts the task. */
+    lua_State *co;          /* coroutine running the task, NULL if finished */
+    lcore_task_state state;
+    lc_waiter *selectors;   /* waiters of join and core.select() */
+} lcore_task;
+
+/**
+ * Join context, kept on the stack of the joining coroutine.
+ */
+typedef struct {
+    lcore_sleep_ctx sleep;  /* Must be the first member, wakes up the coroutine. */
+    lc_waiter waiter;
+} lcore_join_ctx;
+
+struct lcore_join_all_ctx;
+
+typedef struct {
+    lc_waiter waiter;   /* Must be the first member. */
+    struct lcore_join_all_ctx *ctx;
+} lcore_join_all_item;
+
+/**
+ * Join-all context, kept on the stack of the joining coroutine.
+ */
+typedef struct lcore_join_all_ctx {
+    lcore_sleep_ctx sleep;  /* Must be the first member, wakes up the coroutine. */
+    int nitems;     /* number of tasks started waiting */
+    int remaining;  /* number of tasks not done */
+    lcore_join_all_item items[];
+} lcore_join_all_ctx;
+
+/**
+ * Default max number of values in a message.
+ */
+#define LCORE_MQ_DEFAULT_WIDTH 4
+
+/**
+ * Uservalues of the message queue, followed by the message slots.
+ */
+#define LCORE_MQ_RECEIVERS 1    /* coroutines waiting for messages */
+#define LCORE_MQ_SENDERS 2      /* coroutines waiting for free slots */
+#define LCORE_MQ_SLOTS 3
+
+/**
+ * Message queue, a ring buffer of messages.
+ *
+ * The values of a message are stored in the uservalues of the slot,
+ * each slot takes "width" uservalues.
+ */
 typedef struct {
-    size_t first;
-    size_t last;
-    size_t size;
+    size_t first;   /* slot of the first message */
+    size_t count;   /* number of messages */
+    size_t size;    /* number of slots */
+    int width;      /* max number of values in a message */
+    int nreceivers;
+    int senders_first;
+    int senders_last;
+    lc_waiter *selectors;   /* waiters of core.select() */
+    uint8_t nvalues[];  /* number of values in each slot */
 } lcore_mq;
 
 static int lcore_time(lua_State *L) {
@@ -94,8 +205,8 @@ static int lcore_sleep_resume(lua_State *L) {
     return 0;
 }
 
-static void lcore_sleep_cb(HAPPlatformTimerRef timer, void *context) {
-    lua_State *co = context;
+static void lcore_sleep_cb(timerwheel_node *node) {
+    lua_State *co = ((lcore_sleep_ctx *)node)->co;
     lua_State *L = lc_getmainthread(co);
 
     HAPAssert(lua_gettop(L) == 0);
@@ -108,22 +219,275 @@ static void lcore_sleep_cb(HAPPlatformTimerRef timer, void *context) {
     }
 
     lua_settop(L, 0);
-    lc_collectgarbage(L);
+    if (!timerwheel_has_expired()) {
+        lc_collectgarbage(L);
+    }
+}
+
+static void lcore_sleep_cancel(lc_pending *pending) {
+    timerwheel_stop(&lc_container_of(pending, lcore_sleep_ctx, pending)->node);
 }
 
 static int lcore_sleep(lua_State *L) {
     lua_Integer ms = luaL_checkinteger(L, 1);
     luaL_argcheck(L, ms >= 0, 1, "ms out of range");
 
-    HAPPlatformTimerRef timer;
-    if (HAPPlatformTimerRegister(&timer,
-        ms ? (HAPTime)ms + HAPPlatformClockGetCurrent() : 0,
-        lcore_sleep_cb, L) != kHAPError_None) {
-        luaL_error(L, "failed to create a timer");
-    }
+    lcore_sleep_ctx *ctx = lua_newuserdatauv(L, sizeof(*ctx), 0);
+    luaL_setmetatable(L, LUA_SLEEP_NAME);
+    ctx->node.pprev = NULL;
+    ctx->co = L;
+    ctx->pending.cancel = lcore_sleep_cancel;
+    timerwheel_start(&ctx->node, ms, lcore_sleep_cb);
+    lc_setpending(L, &ctx->pending);
     return lua_yield(L, 0);
 }
 
+static int lcore_sleep_gc(lua_State *L) {
+    lcore_sleep_ctx *ctx = lua_touserdata(L, 1);
+    timerwheel_stop(&ctx->node);
+    return 0;
+}
+
+static void lcore_select_cancel(lcore_select_ctx *ctx) {
+    for (int i = 0; i < ctx->nitems; i++) {
+        ctx->items[i].method->cancel(&ctx->items[i].waiter);
+    }
+    ctx->nitems = 0;
+}
+
+static void lcore_select_ready(lc_waiter *waiter) {
+    lcore_select_item *item = (lcore_select_item *)waiter;
+    lcore_select_ctx *ctx = item->ctx;
+    if (!ctx->waiting || ctx->ready) {
+        return;
+    }
+    ctx->ready = item - ctx->items + 1;
+    lcore_select_cancel(ctx);
+
+    // the object may be ready in a Lua call, resume the coroutine from the run loop
+    timerwheel_start(&ctx->sleep.node, 0, lcore_sleep_cb);
+}
+
+static void lcore_select_cancel_pending(lc_pending *pending) {
+    lcore_select_ctx *ctx = (lcore_select_ctx *)lc_container_of(pending, lcore_sleep_ctx, pending);
+    lcore_select_cancel(ctx);
+    timerwheel_stop(&ctx->sleep.node);
+    ctx->waiting = false;
+}
+
+static void lcore_select_timeout_cb(timerwheel_node *node) {
+    lcore_select_cancel((lcore_select_ctx *)node);
+    lcore_sleep_cb(node);
+}
+
+static int lcore_finish_select(lua_State *L, int status, lua_KContext extra) {
+    lcore_select_ctx *ctx = (lcore_select_ctx *)extra;
+    ctx->waiting = false;
+    if (ctx->ready) {
+        lua_pushinteger(L, ctx->ready);
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+static int lcore_select(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    bool forever = lua_isnoneornil(L, 2);
+    lua_Integer ms = forever ? 0 : luaL_checkinteger(L, 2);
+    luaL_argcheck(L, ms >= 0, 2, "ms out of range");
+    lua_Integer n = luaL_len(L, 1);
+    luaL_argcheck(L, n <= UINT16_MAX, 1, "too many objects");
+    luaL_argcheck(L, n > 0 || !forever, 1, "no object to wait");
+    lua_settop(L, 2);
+
+    lcore_select_ctx *ctx = lua_newuserdatauv(L, sizeof(*ctx) + n * sizeof(lcore_select_item), 0);
+    luaL_setmetatable(L, LUA_SELECT_NAME);
+    ctx->sleep.node.pprev = NULL;
+    ctx->sleep.co = L;
+    ctx->waiting = false;
+    ctx->nitems = 0;
+    ctx->ready = 0;
+
+    for (int i = 1; i <= n; i++) {
+        lua_geti(L, 1, i);
+        if (luai_unlikely(luaL_getmetafield(L, -1, LC_WAITABLE) != LUA_TLIGHTUSERDATA)) {
+            lcore_select_cancel(ctx);
+            luaL_error(L, "object #%d is not waitable", i);
+        }
+        lcore_select_item *item = ctx->items + i - 1;
+        item->method = lua_touserdata(L, -1);
+        item->ctx = ctx;
+        item->waiter.next = NULL;
+        item->waiter.pprev = NULL;
+        item->waiter.obj = NULL;
+        item->waiter.ready = lcore_select_ready;
+        lua_pop(L, 1);
+        ctx->nitems = i;
+        bool ready = item->method->wait(L, -1, &item->waiter);
+        lua_pop(L, 1);
+        if (ready) {
+            lcore_select_cancel(ctx);
+            lua_pushinteger(L, i);
+            return 1;
+        }
+    }
+
+    if (!forever && ms == 0) {
+        lcore_select_cancel(ctx);
+        lua_pushnil(L);
+        return 1;
+    }
+    if (luai_unlikely(!lua_isyieldable(L))) {
+        lcore_select_cancel(ctx);
+        luaL_error(L, "attempt to wait outside a coroutine");
+    }
+    ctx->waiting = true;
+    if (!forever) {
+        timerwheel_start(&ctx->sleep.node, ms, lcore_select_timeout_cb);
+    }
+    ctx->sleep.pending.cancel = lcore_select_cancel_pending;
+    lc_setpending(L, &ctx->sleep.pending);
+    return lua_yieldk(L, 0, (lua_KContext)ctx, lcore_finish_select);
+}
+
+static int lcore_select_gc(lua_State *L) {
+    lcore_select_ctx *ctx = lua_touserdata(L, 1);
+    lcore_select_cancel(ctx);
+    timerwheel_stop(&ctx->sleep.node);
+    return 0;
+}
+
+static int lcore_gc_stats(lua_State *L) {
+    const lc_gc_stats *stats = lc_getgcstats();
+    lua_createtable(L, 0, 8);
+    lua_pushinteger(L, stats->calls);
+    lua_setfield(L, -2, "calls");
+    lua_pushinteger(L, stats->steps);
+    lua_setfield(L, -2, "steps");
+    lua_pushinteger(L, stats->cycles);
+    lua_setfield(L, -2, "cycles");
+    lua_pushinteger(L, stats->fulls);
+    lua_setfield(L, -2, "fulls");
+    lua_pushinteger(L, stats->freed);
+    lua_setfield(L, -2, "freed");
+    lua_pushinteger(L, stats->time_us);
+    lua_setfield(L, -2, "time");
+    lua_pushinteger(L, stats->max_time_us);
+    lua_setfield(L, -2, "maxTime");
+    lua_pushinteger(L, lua_gc(L, LUA_GCCOUNT));
+    lua_setfield(L, -2, "count");
+    return 1;
+}
+
+static int lcore_thread_stats(lua_State *L) {
+    const lc_thread_stats *stats = lc_getthreadstats();
+    lua_createtable(L, 0, 6);
+    lua_pushinteger(L, stats->hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushinteger(L, stats->misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushinteger(L, stats->active);
+    lua_setfield(L, -2, "active");
+    lua_pushinteger(L, stats->high_water);
+    lua_setfield(L, -2, "highWater");
+    lua_pushinteger(L, stats->pooled);
+    lua_setfield(L, -2, "pooled");
+    lua_pushinteger(L, stats->capacity);
+    lua_setfield(L, -2, "capacity");
+    return 1;
+}
+
+static int lcore_mem_stats(lua_State *L) {
+    const mempool_stats *stats = mempool_getstats();
+    lua_createtable(L, 0, 8);
+    lua_pushinteger(L, stats->live);
+    lua_setfield(L, -2, "live");
+    lua_pushinteger(L, stats->peak);
+    lua_setfield(L, -2, "peak");
+    lua_pushinteger(L, stats->reserved);
+    lua_setfield(L, -2, "reserved");
+    lua_pushinteger(L, stats->slabs);
+    lua_setfield(L, -2, "slabs");
+    lua_pushinteger(L, stats->allocs);
+    lua_setfield(L, -2, "allocs");
+    lua_pushinteger(L, stats->allocated);
+    lua_setfield(L, -2, "allocated");
+    lua_pushnumber(L, stats->reserved ?
+        (lua_Number)(stats->reserved - stats->live) / stats->reserved : 0);
+    lua_setfield(L, -2, "fragmentation");
+
+    size_t count;
+    const mempool_owner *owners = mempool_getowners(&count);
+    lua_createtable(L, 0, count);
+    for (size_t i = 0; i < count; i++) {
+        lua_createtable(L, 0, 3);
+        lua_pushinteger(L, owners[i].live);
+        lua_setfield(L, -2, "live");
+        lua_pushinteger(L, owners[i].peak);
+        lua_setfield(L, -2, "peak");
+        lua_pushinteger(L, owners[i].limit);
+        lua_setfield(L, -2, "limit");
+        lua_setfield(L, -2, owners[i].name);
+    }
+    lua_setfield(L, -2, "owners");
+    return 1;
+}
+
+static int lcore_check_owner(lua_State *L, int arg) {
+    int owner = mempool_getowner(luaL_checkstring(L, arg));
+    if (luai_unlikely(owner < 0)) {
+        luaL_error(L, "failed to create memory owner");
+    }
+    return owner;
+}
+
+static int lcore_mem_owner(lua_State *L) {
+    size_t count;
+    const mempool_owner *owners = mempool_getowners(&count);
+    int prev = lc_getowner(L);
+    if (!lua_isnoneornil(L, 1)) {
+        int owner = lcore_check_owner(L, 1);
+        lc_setowner(L, owner);
+        mempool_setcurrent(owner);
+    }
+    lua_pushstring(L, owners[prev].name);
+    return 1;
+}
+
+static int lcore_set_mem_limit(lua_State *L) {
+    int owner = lcore_check_owner(L, 1);
+    lua_Integer limit = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, limit >= 0, 2, "limit out of range");
+    mempool_setlimit(owner, limit);
+    return 0;
+}
+
+static int lcore_embedfs_stats(lua_State *L) {
+    const embedfs_index *index = BRIDGE_EMBEDFS_ROOT.index;
+    size_t count = index ? index->count : 0;
+    size_t size = 0;
+    size_t raw_size = 0;
+
+    lua_createtable(L, 0, 4);
+    lua_createtable(L, count, 0);
+    for (size_t i = 0; i < count; i++) {
+        const embedfs_file *file = index->files[i];
+        size += file->len;
+        raw_size += file->size ? file->size : file->len;
+        lua_pushstring(L, index->paths[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "paths");
+    lua_pushinteger(L, count);
+    lua_setfield(L, -2, "files");
+    lua_pushinteger(L, size);
+    lua_setfield(L, -2, "size");
+    lua_pushinteger(L, raw_size);
+    lua_setfield(L, -2, "rawSize");
+    return 1;
+}
+
 static int lcore_create_timer(lua_State *L) {
     luaL_checktype(L, 1, LUA_TFUNCTION);
 
@@ -135,21 +499,28 @@ static int lcore_create_timer(lua_State *L) {
         lua_setiuservalue(L, 1, i);
     }
     ctx->nargs = n - 1;
-    ctx->timer = 0;
+    ctx->owner = mempool_getcurrent();
+    ctx->node.pprev = NULL;
     ctx->mL = lc_getmainthread(L);
+    ctx->selectors = NULL;
     return 1;
 }
 
 static int lcore_create_mq(lua_State *L) {
-    size_t size = luaL_checkinteger(L, 1);
-    luaL_argcheck(L, size > 0, 1, "size out of range");
-    lcore_mq *obj = lua_newuserdatauv(L, sizeof(*obj), 1);
+    lua_Integer size = luaL_checkinteger(L, 1);
+    lua_Integer width = luaL_optinteger(L, 2, LCORE_MQ_DEFAULT_WIDTH);
+    luaL_argcheck(L, width > 0 && width <= UINT8_MAX, 2, "width out of range");
+    luaL_argcheck(L, size > 0 && size <= (UINT16_MAX - LCORE_MQ_SLOTS) / width, 1, "size out of range");
+    lcore_mq *obj = lua_newuserdatauv(L, sizeof(*obj) + size, LCORE_MQ_SLOTS - 1 + size * width);
     luaL_setmetatable(L, LUA_MQ_OBJ_NAME);
-    obj->first = 1;
-    obj->last = 1;
+    obj->first = 0;
+    obj->count = 0;
     obj->size = size;
-    lua_createtable(L, 0, 1);
-    lua_setuservalue(L, -2);
+    obj->width = width;
+    obj->nreceivers = 0;
+    obj->senders_first = 1;
+    obj->senders_last = 1;
+    obj->selectors = NULL;
     return 1;
 }
 
@@ -159,6 +530,7 @@ static int lcore_timer_resume(lua_State *L) {
 
     int nres, status;
     lua_State *co = lc_newthread(L);
+    lc_setowner(co, ctx->owner);
     if (luai_unlikely(lua_rawgetp(co, LUA_REGISTRYINDEX, ctx) != LUA_TUSERDATA)) {
         HAPFatalError();
     }
@@ -169,8 +541,10 @@ static int lcore_timer_resume(lua_State *L) {
         lua_getiuservalue(co, 1, i);
     }
     lua_remove(co, 1);
-    lua_pushnil(co);
-    lua_rawsetp(co, LUA_REGISTRYINDEX, ctx);
+    if (!timerwheel_is_active(&ctx->node)) {
+        lua_pushnil(co);
+        lua_rawsetp(co, LUA_REGISTRYINDEX, ctx);
+    }
     status = lc_resume(co, L, ctx->nargs, &nres);
     if (luai_unlikely(status != LUA_OK && status != LUA_YIELD)) {
         HAPLogError(&lcore_log, "%s: %s", __func__, lua_tostring(L, -1));
@@ -178,11 +552,21 @@ static int lcore_timer_resume(lua_State *L) {
     return 0;
 }
 
-static void lcore_timer_cb(HAPPlatformTimerRef timer, void *context) {
-    lcore_timer_ctx *ctx = context;
+static void lcore_timer_cb(timerwheel_node *node) {
+    lcore_timer_ctx *ctx = (lcore_timer_ctx *)node;
     lua_State *L = ctx->mL;
 
-    ctx->timer = 0;
+    lc_waiter_wakeall(&ctx->selectors);
+
+    if (ctx->period) {
+        // schedule from the expiration time, skip the periods missed
+        HAPTime now = HAPPlatformClockGetCurrent();
+        ctx->expire += ctx->period;
+        if (ctx->expire <= now) {
+            ctx->expire += ((now - ctx->expire) / ctx->period + 1) * ctx->period;
+        }
+        timerwheel_start_at(&ctx->node, ctx->expire, ctx->slack, lcore_timer_cb);
+    }
 
     HAPAssert(lua_gettop(L) == 0);
 
@@ -194,7 +578,11 @@ static void lcore_timer_cb(HAPPlatformTimerRef timer, void *context) {
     }
 
     lua_settop(L, 0);
-    lc_collectgarbage(L);
+
+    // collect garbage once for the timers expired in the same round
+    if (!timerwheel_has_expired()) {
+        lc_collectgarbage(L);
+    }
 }
 
 static int lcore_timer_start(lua_State *L) {
@@ -202,17 +590,16 @@ static int lcore_timer_start(lua_State *L) {
 
     lua_Integer ms = luaL_checkinteger(L, 2);
     luaL_argcheck(L, ms >= 0, 2, "ms out of range");
+    lua_Integer period = luaL_optinteger(L, 3, 0);
+    luaL_argcheck(L, period >= 0, 3, "period out of range");
+    lua_Integer slack = luaL_optinteger(L, 4, 0);
+    luaL_argcheck(L, slack >= 0, 4, "slack out of range");
 
-    if (ctx->timer) {
-        HAPPlatformTimerDeregister(ctx->timer);
-    }
-
-    if (HAPPlatformTimerRegister(&ctx->timer,
-        ms ? (HAPTime)ms + HAPPlatformClockGetCurrent() : 0,
-        lcore_timer_cb, ctx) != kHAPError_None) {
-        luaL_error(L, "failed to start the timer");
-    }
-    lua_pop(L, 1);
+    ctx->expire = HAPPlatformClockGetCurrent() + ms;
+    ctx->period = period;
+    ctx->slack = slack;
+    timerwheel_start_at(&ctx->node, ctx->expire, slack, lcore_timer_cb);
+    lua_settop(L, 1);
     lua_rawsetp(L, LUA_REGISTRYINDEX, ctx);
     return 0;
 }
@@ -220,26 +607,40 @@ static int lcore_timer_start(lua_State *L) {
 static int lcore_timer_stop(lua_State *L) {
     lcore_timer_ctx *ctx = luaL_checkudata(L, 1, LUA_TIMER_NAME);
 
-    if (ctx->timer) {
-        HAPPlatformTimerDeregister(ctx->timer);
-        ctx->timer = 0;
+    if (timerwheel_is_active(&ctx->node)) {
+        timerwheel_stop(&ctx->node);
         lua_pushnil(L);
         lua_rawsetp(L, LUA_REGISTRYINDEX, ctx);
     }
+    lc_waiter_wakeall(&ctx->selectors);
     return 0;
 }
 
 static int lcore_timer_tostring(lua_State *L) {
     lcore_timer_ctx *ctx = luaL_checkudata(L, 1, LUA_TIMER_NAME);
 
-    if (ctx->timer) {
-        lua_pushfstring(L, "timer (%u)", ctx->timer);
+    if (timerwheel_is_active(&ctx->node)) {
+        lua_pushfstring(L, "timer (%p)", ctx);
     } else {
         lua_pushliteral(L, "timer (expired)");
     }
     return 1;
 }
 
+static bool lcore_timer_wait(lua_State *L, int idx, lc_waiter *waiter) {
+    lcore_timer_ctx *ctx = lua_touserdata(L, idx);
+    if (!timerwheel_is_active(&ctx->node)) {
+        return true;
+    }
+    lc_waiter_link(&ctx->selectors, waiter, ctx);
+    return false;
+}
+
+static const lc_waitable_method lcore_timer_waitable = {
+    .wait = lcore_timer_wait,
+    .cancel = lc_waiter_unlink,
+};
+
 /*
  * metamethods for timer object
  */
@@ -265,98 +666,211 @@ static void lcore_timer_createmeta(lua_State *L) {
     luaL_newlibtable(L, lcore_timer_meth);  /* create method table */
     luaL_setfuncs(L, lcore_timer_meth, 0);  /* add timer object methods to method table */
     lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+    lua_pushlightuserdata(L, (void *)&lcore_timer_waitable);
+    lua_setfield(L, -2, LC_WAITABLE);  /* metatable.__waitable = waitable methods */
+    lua_pop(L, 1);  /* pop metatable */
+}
+
+static void lcore_sleep_createmeta(lua_State *L) {
+    luaL_newmetatable(L, LUA_SLEEP_NAME);  /* metatable for sleep context */
+    lua_pushcfunction(L, lcore_sleep_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);  /* pop metatable */
+
+    luaL_newmetatable(L, LUA_SELECT_NAME);  /* metatable for select context */
+    lua_pushcfunction(L, lcore_select_gc);
+    lua_setfield(L, -2, "__gc");
     lua_pop(L, 1);  /* pop metatable */
 }
 
-static size_t lcore_mq_size(lcore_mq *obj) {
-    return obj->first > obj->last ? obj->size - obj->first + obj->last : obj->last - obj->first;
+// Push the waiting list at the uservalue n of the queue, it is created on the first use.
+static void lcore_mq_getlist(lua_State *L, int n) {
+    if (lua_getiuservalue(L, 1, n) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_createtable(L, 4, 0);
+        lua_pushvalue(L, -1);
+        lua_setiuservalue(L, 1, n);
+    }
 }
 
-static int lcore_mq_send(lua_State *L) {
-    lcore_mq *obj = luaL_checkudata(L, 1, LUA_MQ_OBJ_NAME);
+static void lcore_mq_cancel(lc_pending *pending) {
+    // the canceled coroutines are skipped when the queue wakes them up
+}
+
+static lc_pending lcore_mq_pending = {
+    .cancel = lcore_mq_cancel,
+};
+
+static void lcore_mq_resume(lua_State *L, lua_State *co, int narg) {
+    int nres;
+    int status = lc_resume(co, L, narg, &nres);
+    if (status == LUA_OK) {
+        lua_pop(L, nres);
+    } else if (luai_unlikely(status != LUA_YIELD)) {
+        HAPLogError(&lcore_log, "%s: %s", __func__, lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+}
+
+// Check the arguments of send, returns the number of values in the message.
+static int lcore_mq_checkmsg(lua_State *L, lcore_mq *obj) {
     int narg = lua_gettop(L) - 1;
-    int status, nres;
+    if (luai_unlikely(narg > obj->width)) {
+        luaL_error(L, "too many values in the message");
+    }
+    return narg;
+}
 
-    lua_getuservalue(L, 1);
+// Resume all waiting receivers with the message at index 2 ~ narg + 1,
+// returns false if all receivers are canceled.
+static bool lcore_mq_wake_receivers(lua_State *L, lcore_mq *obj, int narg) {
+    int n = obj->nreceivers;
+    obj->nreceivers = 0;
+    if (luai_unlikely(!lua_checkstack(L, n + narg + 2))) {
+        luaL_error(L, "stack overflow");
+    }
 
-    if (lua_getfield(L, -1, "wait") == LUA_TTABLE) {
+    // move the receivers to the stack, they may wait again when resumed
+    lua_getiuservalue(L, 1, LCORE_MQ_RECEIVERS);
+    int list = lua_gettop(L);
+    for (int i = 1; i <= n; i++) {
+        lua_rawgeti(L, list, i);
         lua_pushnil(L);
-        lua_setfield(L, -3, "wait");  // que.wait = nil
-        int waiting = luaL_len(L, -1);
-        for (int i = 1; i <= waiting; i++) {
-            HAPAssert(lua_geti(L, -1, i) == LUA_TTHREAD);
-            lua_State *co = lua_tothread(L, -1);
-            lua_pop(L, 1);
-            int max = 1 + narg;
-            if (luai_unlikely(!lua_checkstack(L, narg))) {
-                luaL_error(L, "stack overflow");
-            }
-            for (int i = 2; i <= max; i++) {
-                lua_pushvalue(L, i);
-            }
-            lua_xmove(L, co, narg);
-            status = lc_resume(co, L, narg, &nres);
-            if (luai_unlikely(status != LUA_OK && status != LUA_YIELD)) {
-                HAPLogError(&lcore_log, "%s: %s", __func__, lua_tostring(L, -1));
-            }
-            lua_pop(L, nres);
+        lua_rawseti(L, list, i);
+    }
+    bool delivered = false;
+    for (int i = 1; i <= n; i++) {
+        lua_State *co = lua_tothread(L, list + i);
+        if (lua_status(co) != LUA_YIELD) {
+            continue;  // canceled
         }
-    } else {
-        if (lcore_mq_size(obj) == obj->size) {
-            luaL_error(L, "the message queue is full");
+        for (int j = 2; j <= narg + 1; j++) {
+            lua_pushvalue(L, j);
         }
-        lua_pop(L, 1);
-        lua_insert(L, 2);
-        lua_createtable(L, narg, 0);
-        lua_insert(L, 3);
-        for (int i = narg; i >= 1; i--) {
-            lua_seti(L, 3, i);
+        lua_xmove(L, co, narg);
+        lcore_mq_resume(L, co, narg);
+        delivered = true;
+    }
+    lua_settop(L, list - 1);
+    return delivered;
+}
+
+// Resume the first coroutine waiting for a free slot.
+static void lcore_mq_wake_sender(lua_State *L, lcore_mq *obj) {
+    if (obj->senders_first == obj->senders_last) {
+        return;
+    }
+    lua_getiuservalue(L, 1, LCORE_MQ_SENDERS);
+    while (obj->senders_first != obj->senders_last) {
+        lua_rawgeti(L, -1, obj->senders_first);
+        lua_pushnil(L);
+        lua_rawseti(L, -3, obj->senders_first);
+        obj->senders_first++;
+        if (obj->senders_first == obj->senders_last) {
+            obj->senders_first = 1;
+            obj->senders_last = 1;
         }
-        lua_seti(L, 2, obj->last);
-        obj->last++;
-        if (obj->last > obj->size + 1) {
-            obj->last = 1;
+        lua_State *co = lua_tothread(L, -1);
+        if (lua_status(co) == LUA_YIELD) {
+            lcore_mq_resume(L, co, 0);
+            lua_pop(L, 1);
+            break;
         }
+        lua_pop(L, 1);  // canceled
+    }
+    lua_pop(L, 1);
+}
+
+// Deliver the message at index 2 ~ narg + 1, returns false if the queue is full.
+static bool lcore_mq_post(lua_State *L, lcore_mq *obj, int narg) {
+    // the queue is empty if there are receivers, pass the message to them directly
+    if (obj->nreceivers && lcore_mq_wake_receivers(L, obj, narg)) {
+        return true;
+    }
+    if (obj->count == obj->size) {
+        return false;
+    }
+    if (luai_unlikely(!lua_checkstack(L, narg))) {
+        luaL_error(L, "stack overflow");
+    }
+    size_t slot = (obj->first + obj->count) % obj->size;
+    int base = LCORE_MQ_SLOTS + slot * obj->width;
+    for (int i = 2; i <= narg + 1; i++) {
+        lua_pushvalue(L, i);
+    }
+    for (int i = narg - 1; i >= 0; i--) {
+        lua_setiuservalue(L, 1, base + i);
+    }
+    obj->nvalues[slot] = narg;
+    obj->count++;
+    lc_waiter_wakeall(&obj->selectors);
+    return true;
+}
+
+static int lcore_mq_send(lua_State *L) {
+    lcore_mq *obj = luaL_checkudata(L, 1, LUA_MQ_OBJ_NAME);
+    int narg = lcore_mq_checkmsg(L, obj);
+
+    if (!lcore_mq_post(L, obj, narg)) {
+        luaL_error(L, "the message queue is full");
     }
     return 0;
 }
 
+static int lcore_mq_finish_send_wait(lua_State *L, int status, lua_KContext extra) {
+    lcore_mq *obj = lua_touserdata(L, 1);
+    if (lcore_mq_post(L, obj, lua_gettop(L) - 1)) {
+        return 0;
+    }
+    lcore_mq_getlist(L, LCORE_MQ_SENDERS);
+    lua_pushthread(L);
+    lua_rawseti(L, -2, obj->senders_last++);
+    lua_pop(L, 1);
+    lc_setpending(L, &lcore_mq_pending);
+    return lua_yieldk(L, 0, 0, lcore_mq_finish_send_wait);
+}
+
+static int lcore_mq_send_wait(lua_State *L) {
+    lcore_mq *obj = luaL_checkudata(L, 1, LUA_MQ_OBJ_NAME);
+    lcore_mq_checkmsg(L, obj);
+    if (luai_unlikely(!lua_isyieldable(L))) {
+        luaL_error(L, "attempt to wait outside a coroutine");
+    }
+    return lcore_mq_finish_send_wait(L, LUA_OK, 0);
+}
+
 static int lcore_mq_recv(lua_State *L) {
     lcore_mq *obj = luaL_checkudata(L, 1, LUA_MQ_OBJ_NAME);
     if (lua_gettop(L) != 1) {
         luaL_error(L, "invalid arguements");
     }
-    lua_getuservalue(L, 1);
-    if (obj->last == obj->first) {
-        int type = lua_getfield(L, 2, "wait");
-        if (type == LUA_TNIL) {
-            lua_pop(L, 1);
-            lua_createtable(L, 1, 0);
-            lua_pushthread(L);
-            lua_seti(L, 3, 1);
-            lua_setfield(L, 2, "wait");
-        } else {
-            HAPAssert(type == LUA_TTABLE);
-            lua_pushthread(L);
-            lua_seti(L, 3, luaL_len(L, 3) + 1);
-            lua_pop(L, 1);
+    if (obj->count == 0) {
+        if (luai_unlikely(!lua_isyieldable(L))) {
+            luaL_error(L, "attempt to wait outside a coroutine");
         }
+        lcore_mq_getlist(L, LCORE_MQ_RECEIVERS);
+        lua_pushthread(L);
+        lua_rawseti(L, -2, ++obj->nreceivers);
         lua_pop(L, 1);
+        lc_setpending(L, &lcore_mq_pending);
         return lua_yield(L, 0);
-    } else {
-        lua_geti(L, 2, obj->first);
+    }
+
+    size_t slot = obj->first;
+    int n = obj->nvalues[slot];
+    int base = LCORE_MQ_SLOTS + slot * obj->width;
+    if (luai_unlikely(!lua_checkstack(L, n + 3))) {
+        luaL_error(L, "stack overflow");
+    }
+    for (int i = 0; i < n; i++) {
+        lua_getiuservalue(L, 1, base + i);
         lua_pushnil(L);
-        lua_seti(L, 2, obj->first);
-        obj->first++;
-        if (obj->first > obj->size + 1) {
-            obj->first = 1;
-        }
-        int nargs = luaL_len(L, 3);
-        for (int i = 1; i <= nargs; i++) {
-            lua_geti(L, 3, i);
-        }
-        return nargs;
+        lua_setiuservalue(L, 1, base + i);
     }
+    obj->first = (slot + 1) % obj->size;
+    obj->count--;
+    lcore_mq_wake_sender(L, obj);
+    return n;
 }
 
 static int lcore_mq_tostring(lua_State *L) {
@@ -365,6 +879,20 @@ static int lcore_mq_tostring(lua_State *L) {
     return 1;
 }
 
+static bool lcore_mq_wait(lua_State *L, int idx, lc_waiter *waiter) {
+    lcore_mq *obj = lua_touserdata(L, idx);
+    if (obj->count) {
+        return true;
+    }
+    lc_waiter_link(&obj->selectors, waiter, obj);
+    return false;
+}
+
+static const lc_waitable_method lcore_mq_waitable = {
+    .wait = lcore_mq_wait,
+    .cancel = lc_waiter_unlink,
+};
+
 /*
  * metamethods for message queue object
  */
@@ -379,6 +907,7 @@ static const luaL_Reg lcore_mq_metameth[] = {
  */
 static const luaL_Reg lcore_mq_meth[] = {
     {"send", lcore_mq_send},
+    {"sendWait", lcore_mq_send_wait},
     {"recv", lcore_mq_recv},
     {NULL, NULL},
 };
@@ -389,6 +918,355 @@ static void lcore_mq_createmeta(lua_State *L) {
     luaL_newlibtable(L, lcore_mq_meth);  /* create method table */
     luaL_setfuncs(L, lcore_mq_meth, 0);  /* add MQ object methods to method table */
     lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+    lua_pushlightuserdata(L, (void *)&lcore_mq_waitable);
+    lua_setfield(L, -2, LC_WAITABLE);  /* metatable.__waitable = waitable methods */
+    lua_pop(L, 1);  /* pop metatable */
+}
+
+static int lcore_task_finish(lua_State *L, int status, lua_KContext extra) {
+    lcore_task *task = (lcore_task *)extra;
+
+    // stack <task, traceback, results...> or <task, traceback, errmsg>
+    int nres = lua_gettop(L) - 2;
+    lua_createtable(L, nres, 1);
+    lua_insert(L, 3);
+    for (int i = nres; i >= 1; i--) {
+        lua_rawseti(L, 3, i);
+    }
+    lua_pushinteger(L, nres);
+    lua_setfield(L, 3, "n");
+    lua_setiuservalue(L, 1, 1);
+
+    task->state = status == LUA_OK || status == LUA_YIELD ? LCORE_TASK_DONE : LCORE_TASK_FAILED;
+    task->co = NULL;
+    lc_waiter_wakeall(&task->selectors);
+    return 0;
+}
+
+// The body of the task coroutine, stack <task, func, args...>.
+static int lcore_task_main(lua_State *L) {
+    lcore_task *task = lua_touserdata(L, 1);
+    lc_pushtraceback(L);
+    lua_insert(L, 2);
+    int status = lua_pcallk(L, lua_gettop(L) - 3, LUA_MULTRET, 2, (lua_KContext)task, lcore_task_finish);
+    return lcore_task_finish(L, status, (lua_KContext)task);
+}
+
+static int lcore_task_start(lua_State *L) {
+    lcore_task *task = lua_touserdata(L, 1);
+    lua_pop(L, 1);
+
+    task->state = LCORE_TASK_RUNNING;
+    int status, nres;
+    status = lc_resume(task->co, L, lua_gettop(task->co) - 1, &nres);
+    if (luai_unlikely(status != LUA_OK && status != LUA_YIELD)) {
+        HAPLogError(&lcore_log, "%s: %s", __func__, lua_tostring(L, -1));
+    }
+    return 0;
+}
+
+static void lcore_task_start_cb(timerwheel_node *node) {
+    lcore_task *task = (lcore_task *)node;
+    lua_State *L = lc_getmainthread(task->co);
+
+    HAPAssert(lua_gettop(L) == 0);
+
+    lua_pushcfunction(L, lcore_task_start);
+    lua_pushlightuserdata(L, task);
+    int status = lua_pcall(L, 1, 0, 0);
+    if (luai_unlikely(status != LUA_OK)) {
+        HAPLogError(&lcore_log, "%s: %s", __func__, lua_tostring(L, -1));
+    }
+
+    lua_settop(L, 0);
+    if (!timerwheel_has_expired()) {
+        lc_collectgarbage(L);
+    }
+}
+
+static int lcore_spawn(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+
+    int n = lua_gettop(L);
+    lcore_task *task = lua_newuserdatauv(L, sizeof(*task), 1);
+    luaL_setmetatable(L, LUA_TASK_NAME);
+    task->node.pprev = NULL;
+    task->state = LCORE_TASK_PENDING;
+    task->selectors = NULL;
+
+    // the coroutine keeps the task alive until it finishes
+    lua_State *co = lc_newthread(L);
+    lua_settop(L, n + 1);
+    if (luai_unlikely(!lua_checkstack(co, n + 2) || !lua_checkstack(L, n))) {
+        luaL_error(L, "stack overflow");
+    }
+    lua_pushcfunction(co, lcore_task_main);
+    lua_pushvalue(L, n + 1);
+    for (int i = 1; i <= n; i++) {
+        lua_pushvalue(L, i);
+    }
+    lua_xmove(L, co, n + 1);  // stack <lcore_task_main, task, func, args...>
+    task->co = co;
+    timerwheel_start(&task->node, 0, lcore_task_start_cb);
+    return 1;
+}
+
+static int lcore_task_pushresults(lua_State *L, lcore_task *task) {
+    if (task->state == LCORE_TASK_CANCELED) {
+        lua_pushboolean(L, false);
+        lua_pushliteral(L, "canceled");
+        return 2;
+    }
+    lua_pushboolean(L, task->state == LCORE_TASK_DONE);
+    lua_getiuservalue(L, 1, 1);
+    lua_getfield(L, -1, "n");
+    int n = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if (luai_unlikely(!lua_checkstack(L, n))) {
+        luaL_error(L, "too many results");
+    }
+    int t = lua_gettop(L);
+    for (int i = 1; i <= n; i++) {
+        lua_rawgeti(L, t, i);
+    }
+    lua_remove(L, t);
+    return n + 1;
+}
+
+static void lcore_join_ready(lc_waiter *waiter) {
+    lcore_join_ctx *ctx = lc_container_of(waiter, lcore_join_ctx, waiter);
+    timerwheel_start(&ctx->sleep.node, 0, lcore_sleep_cb);
+}
+
+static void lcore_join_cancel(lc_pending *pending) {
+    lcore_join_ctx *ctx = (lcore_join_ctx *)lc_container_of(pending, lcore_sleep_ctx, pending);
+    lc_waiter_unlink(&ctx->waiter);
+    timerwheel_stop(&ctx->sleep.node);
+}
+
+static int lcore_join_gc(lua_State *L) {
+    lcore_join_ctx *ctx = lua_touserdata(L, 1);
+    lcore_join_cancel(&ctx->sleep.pending);
+    return 0;
+}
+
+static int lcore_task_finish_join(lua_State *L, int status, lua_KContext extra) {
+    lua_settop(L, 1);
+    return lcore_task_pushresults(L, lua_touserdata(L, 1));
+}
+
+static int lcore_task_join(lua_State *L) {
+    lcore_task *task = luaL_checkudata(L, 1, LUA_TASK_NAME);
+    lua_settop(L, 1);
+
+    if (task->state >= LCORE_TASK_DONE) {
+        return lcore_task_pushresults(L, task);
+    }
+    if (luai_unlikely(task->co == L)) {
+        luaL_error(L, "attempt to join the current task");
+    }
+    if (luai_unlikely(!lua_isyieldable(L))) {
+        luaL_error(L, "attempt to wait outside a coroutine");
+    }
+
+    lcore_join_ctx *ctx = lua_newuserdatauv(L, sizeof(*ctx), 0);
+    luaL_setmetatable(L, LUA_JOIN_NAME);
+    ctx->sleep.node.pprev = NULL;
+    ctx->sleep.co = L;
+    ctx->sleep.pending.cancel = lcore_join_cancel;
+    ctx->waiter.ready = lcore_join_ready;
+    lc_waiter_link(&task->selectors, &ctx->waiter, task);
+    lc_setpending(L, &ctx->sleep.pending);
+    return lua_yieldk(L, 0, 0, lcore_task_finish_join);
+}
+
+static void lcore_join_all_cancel(lcore_join_all_ctx *ctx) {
+    for (int i = 0; i < ctx->nitems; i++) {
+        lc_waiter_unlink(&ctx->items[i].waiter);
+    }
+    ctx->nitems = 0;
+}
+
+static void lcore_join_all_ready(lc_waiter *waiter) {
+    lcore_join_all_ctx *ctx = ((lcore_join_all_item *)waiter)->ctx;
+    ctx->remaining--;
+    if (ctx->remaining == 0) {
+        // restarting the timer stops the timeout
+        timerwheel_start(&ctx->sleep.node, 0, lcore_sleep_cb);
+    }
+}
+
+static void lcore_join_all_cancel_pending(lc_pending *pending) {
+    lcore_join_all_ctx *ctx = (lcore_join_all_ctx *)lc_container_of(pending, lcore_sleep_ctx, pending);
+    lcore_join_all_cancel(ctx);
+    timerwheel_stop(&ctx->sleep.node);
+}
+
+static void lcore_join_all_timeout_cb(timerwheel_node *node) {
+    lcore_join_all_cancel((lcore_join_all_ctx *)node);
+    lcore_sleep_cb(node);
+}
+
+static int lcore_join_all_gc(lua_State *L) {
+    lcore_join_all_ctx *ctx = lua_touserdata(L, 1);
+    lcore_join_all_cancel(ctx);
+    timerwheel_stop(&ctx->sleep.node);
+    return 0;
+}
+
+static int lcore_finish_join_all(lua_State *L, int status, lua_KContext extra) {
+    lcore_join_all_ctx *ctx = (lcore_join_all_ctx *)extra;
+    lcore_join_all_cancel(ctx);
+    lua_pushboolean(L, ctx->remaining == 0);
+    return 1;
+}
+
+static int lcore_join_all(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    bool forever = lua_isnoneornil(L, 2);
+    lua_Integer ms = forever ? 0 : luaL_checkinteger(L, 2);
+    luaL_argcheck(L, ms >= 0, 2, "ms out of range");
+    lua_Integer n = luaL_len(L, 1);
+    luaL_argcheck(L, n <= UINT16_MAX, 1, "too many tasks");
+    lua_settop(L, 2);
+
+    lcore_join_all_ctx *ctx = lua_newuserdatauv(L, sizeof(*ctx) + n * sizeof(lcore_join_all_item), 0);
+    luaL_setmetatable(L, LUA_JOIN_ALL_NAME);
+    ctx->sleep.node.pprev = NULL;
+    ctx->sleep.co = L;
+    ctx->nitems = 0;
+    ctx->remaining = 0;
+
+    // wait only the tasks not done, each one wakes up the coroutine once
+    for (int i = 1; i <= n; i++) {
+        lua_geti(L, 1, i);
+        lcore_task *task = luaL_testudata(L, -1, LUA_TASK_NAME);
+        if (luai_unlikely(!task || task->co == L)) {
+            lcore_join_all_cancel(ctx);
+            luaL_error(L, task ? "attempt to join the current task" : "object #%d is not a task", i);
+        }
+        lua_pop(L, 1);
+        if (task->state >= LCORE_TASK_DONE) {
+            continue;
+        }
+        lcore_join_all_item *item = ctx->items + ctx->nitems;
+        item->ctx = ctx;
+        item->waiter.ready = lcore_join_all_ready;
+        lc_waiter_link(&task->selectors, &item->waiter, task);
+        ctx->nitems++;
+        ctx->remaining++;
+    }
+
+    if (ctx->remaining == 0 || (!forever && ms == 0)) {
+        lcore_join_all_cancel(ctx);
+        lua_pushboolean(L, ctx->remaining == 0);
+        return 1;
+    }
+    if (luai_unlikely(!lua_isyieldable(L))) {
+        lcore_join_all_cancel(ctx);
+        luaL_error(L, "attempt to wait outside a coroutine");
+    }
+    if (!forever) {
+        timerwheel_start(&ctx->sleep.node, ms, lcore_join_all_timeout_cb);
+    }
+    ctx->sleep.pending.cancel = lcore_join_all_cancel_pending;
+    lc_setpending(L, &ctx->sleep.pending);
+    return lua_yieldk(L, 0, (lua_KContext)ctx, lcore_finish_join_all);
+}
+
+static int lcore_task_cancel(lua_State *L) {
+    lcore_task *task = luaL_checkudata(L, 1, LUA_TASK_NAME);
+
+    switch (task->state) {
+    case LCORE_TASK_PENDING:
+        timerwheel_stop(&task->node);
+        break;
+    case LCORE_TASK_RUNNING:
+        if (luai_unlikely(lua_status(task->co) != LUA_YIELD)) {
+            luaL_error(L, "attempt to cancel a running task");
+        }
+        break;
+    default:
+        return 0;
+    }
+
+    lc_cancel(task->co, L);
+    task->co = NULL;
+    task->state = LCORE_TASK_CANCELED;
+    lc_waiter_wakeall(&task->selectors);
+    return 0;
+}
+
+static int lcore_task_done(lua_State *L) {
+    lcore_task *task = luaL_checkudata(L, 1, LUA_TASK_NAME);
+    lua_pushboolean(L, task->state >= LCORE_TASK_DONE);
+    return 1;
+}
+
+static int lcore_task_tostring(lua_State *L) {
+    static const char *states[] = {
+        [LCORE_TASK_PENDING] = "pending",
+        [LCORE_TASK_RUNNING] = "running",
+        [LCORE_TASK_DONE] = "done",
+        [LCORE_TASK_FAILED] = "failed",
+        [LCORE_TASK_CANCELED] = "canceled",
+    };
+    lcore_task *task = luaL_checkudata(L, 1, LUA_TASK_NAME);
+    lua_pushfstring(L, "task (%p, %s)", task, states[task->state]);
+    return 1;
+}
+
+static bool lcore_task_wait(lua_State *L, int idx, lc_waiter *waiter) {
+    lcore_task *task = lua_touserdata(L, idx);
+    if (task->state >= LCORE_TASK_DONE) {
+        return true;
+    }
+    lc_waiter_link(&task->selectors, waiter, task);
+    return false;
+}
+
+static const lc_waitable_method lcore_task_waitable = {
+    .wait = lcore_task_wait,
+    .cancel = lc_waiter_unlink,
+};
+
+/*
+ * metamethods for task object
+ */
+static const luaL_Reg lcore_task_metameth[] = {
+    {"__index", NULL},  /* place holder */
+    {"__tostring", lcore_task_tostring},
+    {NULL, NULL}
+};
+
+/*
+ * methods for task object
+ */
+static const luaL_Reg lcore_task_meth[] = {
+    {"join", lcore_task_join},
+    {"cancel", lcore_task_cancel},
+    {"done", lcore_task_done},
+    {NULL, NULL},
+};
+
+static void lcore_task_createmeta(lua_State *L) {
+    luaL_newmetatable(L, LUA_TASK_NAME);  /* metatable for task object */
+    luaL_setfuncs(L, lcore_task_metameth, 0);  /* add metamethods to new metatable */
+    luaL_newlibtable(L, lcore_task_meth);  /* create method table */
+    luaL_setfuncs(L, lcore_task_meth, 0);  /* add task object methods to method table */
+    lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+    lua_pushlightuserdata(L, (void *)&lcore_task_waitable);
+    lua_setfield(L, -2, LC_WAITABLE);  /* metatable.__waitable = waitable methods */
+    lua_pop(L, 1);  /* pop metatable */
+
+    luaL_newmetatable(L, LUA_JOIN_NAME);  /* metatable for join context */
+    lua_pushcfunction(L, lcore_join_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);  /* pop metatable */
+
+    luaL_newmetatable(L, LUA_JOIN_ALL_NAME);  /* metatable for join-all context */
+    lua_pushcfunction(L, lcore_join_all_gc);
+    lua_setfield(L, -2, "__gc");
     lua_pop(L, 1);  /* pop metatable */
 }
 
@@ -397,14 +1275,25 @@ static const luaL_Reg lcore_funcs[] = {
     {"exit", lcore_exit},
     {"atexit", lcore_atexit},
     {"sleep", lcore_sleep},
+    {"select", lcore_select},
     {"createTimer", lcore_create_timer},
     {"createMQ", lcore_create_mq},
+    {"spawn", lcore_spawn},
+    {"joinAll", lcore_join_all},
+    {"gcStats", lcore_gc_stats},
+    {"threadStats", lcore_thread_stats},
+    {"memStats", lcore_mem_stats},
+    {"memOwner", lcore_mem_owner},
+    {"setMemLimit", lcore_set_mem_limit},
+    {"embedfsStats", lcore_embedfs_stats},
     {NULL, NULL},
 };
 
 LUAMOD_API int luaopen_core(lua_State *L) {
     luaL_newlib(L, lcore_funcs);
     lcore_timer_createmeta(L);
+    lcore_sleep_createmeta(L);
     lcore_mq_createmeta(L);
+    lcore_task_createmeta(L);
     return 1;
 }
@@ -26,6 +26,7 @@ typedef struct ldns_resolve_context {
     lua_State *co;
     pal_dns_req_ctx *req;
     HAPPlatformTimerRef timer;
+    lc_pending pending;
 } ldns_resolve_context;
 
 static int ldns_response(lua_State *L) {
@@ -87,6 +88,15 @@ static void ldns_timeout_timer_cb(HAPPlatformTimerRef timer, void *context) {
     ldns_response_cb(PAL_ERR_TIMEOUT, NULL, PAL_NET_ADDR_FAMILY_UNSPEC, ctx);
 }
 
+static void ldns_resolve_cancel(lc_pending *pending) {
+    ldns_resolve_context *ctx = lc_container_of(pending, ldns_resolve_context, pending);
+    if (ctx->timer) {
+        HAPPlatformTimerDeregister(ctx->timer);
+        ctx->timer = 0;
+    }
+    pal_dns_cancel_request(ctx->req);
+}
+
 static int finishresolve(lua_State *L, int status, lua_KContext extra) {
     if (lua_isstring(L, -1)) {
         lua_error(L);
@@ -113,6 +123,8 @@ static int ldns_resolve(lua_State *L) {
         luaL_error(L, "failed to start DNS resolution request");
     }
     ctx->co = L;
+    ctx->pending.cancel = ldns_resolve_cancel;
+    lc_setpending(L, &ctx->pending);
     return lua_yieldk(L, 0, 0, finishresolve);
 }
 
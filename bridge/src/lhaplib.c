@@ -4,19 +4,33 @@
 // you may not use this file except in compliance with the License.
 // See [CONTRIBUTORS.md] for the list of homekit-bridge project authors.
 
+#include <string.h>
 #include <lualib.h>
 #include <lauxlib.h>
+#include <pal/clock.h>
 #include <pal/hap.h>
 #include <pal/mem.h>
 #include <pal/nvs.h>
 #include <HAP.h>
 #include <HAPCharacteristic.h>
 #include <HAPAccessorySetup.h>
+#include <HAPIPServiceDiscovery.h>
 
 #include "app_int.h"
 #include "lc.h"
+#include "mempool.h"
 
 #define LHAP_READ_REQUESTS_MAX 32
+#define LHAP_READ_REQUESTS_POOL_MAX LHAP_READ_REQUESTS_MAX
+#define LHAP_REQUESTS_POOL_MAX 16
+
+/**
+ * Allocate the memory of an IP session when the session is accepted,
+ * instead of allocating the memory of all sessions when the server starts.
+ */
+#ifndef LHAP_LAZY_SESSIONS
+#define LHAP_LAZY_SESSIONS 0
+#endif
 
 #define lhap_optfunction(L, n) luaL_opt(L, lhap_checkfunction, n, false)
 #define lhap_optarray(L, n) luaL_opt(L, lhap_checkarray, n, 0)
@@ -24,6 +38,7 @@
 #define LHAP_ACCESSORY_NAME "HAPAccessory*"
 #define LHAP_SERVICE_NAME "HAPService*"
 #define LHAP_CHARACTERISTIC_NAME "HAPCharacteristic*"
+#define LHAP_REQUEST_NAME "HAPRequest*"
 #define LHAP_NVS_NAMESPACE "bridge::lhaplib"
 
 /**
@@ -39,6 +54,23 @@
  */
 #define LHAP_BRIDGED_ACCS_MAX_CNT_DFT ((size_t) 10)
 
+/**
+ * Maximum number of bridged accessories, a bridge must not expose
+ * more than 150 accessories including itself.
+ */
+#define LHAP_BRIDGED_ACCS_MAX ((size_t) 149)
+
+/**
+ * Delay in milliseconds to apply the bridged accessories again
+ * while the accessory database is being sent.
+ */
+#define LHAP_UPDATE_ACCS_RETRY_MS 10
+
+/**
+ * Maximum depth of the nested TLV8 items.
+ */
+#define LHAP_TLV8_MAX_DEPTH 8
+
 /**
  * IID constants.
  */
@@ -498,6 +530,131 @@ static const size_t lhap_characteristic_struct_size[] = {
     sizeof(HAPTLV8Characteristic),
 };
 
+#define LHAP_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+/**
+ * Private data placed after the accessory structure.
+ */
+typedef struct lhap_accessory_priv {
+    int owner;  /* Memory owner of the callbacks. */
+    bool queued;    /* Whether the accessory is in the list of the accessories with queued reads. */
+    struct lhap_accessory_priv *next;   /* Next accessory with queued reads. */
+    struct lhap_read_request *reads_head;   /* Queued reads. */
+    struct lhap_read_request **reads_ptail;
+    size_t num_requests;    /* Requests passed to the callbacks and not done. */
+    bool retired;   /* Removed from the bridge, kept until the requests are done. */
+} lhap_accessory_priv;
+
+/**
+ * Cache of the characteristic value, the value is kept in the registry.
+ */
+typedef struct lhap_char_cache {
+    HAPTime ttl;        /* Time the value is fresh in milliseconds, 0 if the cache is disabled. */
+    HAPTime stale;      /* Time the stale value is answered while refreshing it. */
+    HAPTime time;       /* Time the value was stored. */
+    uint32_t gen;       /* Increased when the value is invalidated. */
+    bool valid;
+    bool refreshing;
+} lhap_char_cache;
+
+/**
+ * Cache statistics.
+ */
+typedef struct lhap_cache_stats {
+    size_t hits;        /* reads answered by fresh values */
+    size_t misses;      /* reads calling the read callback */
+    size_t stale;       /* reads answered by stale values */
+    size_t chars;       /* characteristics with a cache */
+} lhap_cache_stats;
+
+static lhap_cache_stats gv_lhap_cache_stats;
+
+#define LHAP_LATENCY_BUCKETS 24
+
+/**
+ * Latency histogram in microseconds.
+ *
+ * Bucket 0 counts the latencies of 0 us, bucket i counts the latencies
+ * in [2^(i-1), 2^i) us, the last bucket also counts the longer ones,
+ * from about 4 seconds.
+ */
+typedef struct lhap_latency_hist {
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t buckets[LHAP_LATENCY_BUCKETS];
+} lhap_latency_hist;
+
+/**
+ * Latency histograms of the requests of a characteristic.
+ */
+typedef struct lhap_char_latency {
+    lhap_latency_hist queue;    /* Time the reads wait in the queue. */
+    lhap_latency_hist handler;  /* Time from calling the callback to its result. */
+    lhap_latency_hist total;    /* Time from receiving the request to responding it. */
+} lhap_char_latency;
+
+static bool gv_lhap_latency_enabled;
+
+// Get the monotonic time in microseconds if the latencies are recorded, otherwise 0.
+static inline uint64_t lhap_latency_now(void) {
+    if (!gv_lhap_latency_enabled) {
+        return 0;
+    }
+    uint64_t now = pal_clock_get_us();
+    return now ? now : 1;
+}
+
+static inline void lhap_latency_hist_add(lhap_latency_hist *hist, uint64_t us) {
+    size_t i = us ? 64 - __builtin_clzll(us) : 0;
+    hist->buckets[i < LHAP_LATENCY_BUCKETS ? i : LHAP_LATENCY_BUCKETS - 1]++;
+    hist->count++;
+    hist->sum += us;
+    if (us > hist->max) {
+        hist->max = us > UINT32_MAX ? UINT32_MAX : us;
+    }
+}
+
+/**
+ * Private data placed after the characteristic structure.
+ */
+typedef struct lhap_char_priv {
+    int owner;  /* Memory owner of the callbacks. */
+    lhap_char_cache cache;
+    bool coalesce_reads;    /* Share the result of the read in flight with the later reads. */
+    bool fast;  /* The last read finished without waiting. */
+    struct lhap_call_context *read_ctx;  /* Read in flight, NULL if none. */
+    lhap_char_latency *latency; /* Allocated when the first latency is recorded. */
+} lhap_char_priv;
+
+static inline lhap_accessory_priv *lhap_accessory_get_priv(const HAPAccessory *accessory) {
+    return (lhap_accessory_priv *)((char *)accessory + LHAP_ALIGN(sizeof(HAPAccessory)));
+}
+
+static inline lhap_char_priv *lhap_char_get_priv(const HAPCharacteristic *characteristic) {
+    const HAPBaseCharacteristic *base = characteristic;
+    return (lhap_char_priv *)((char *)characteristic +
+        LHAP_ALIGN(lhap_characteristic_struct_size[base->format]));
+}
+
+/**
+ * Get the latency histograms of the characteristic, NULL if the
+ * latencies are not recorded.
+ */
+static lhap_char_latency *lhap_char_get_latency(const HAPCharacteristic *characteristic) {
+    if (!gv_lhap_latency_enabled) {
+        return NULL;
+    }
+    lhap_char_priv *priv = lhap_char_get_priv(characteristic);
+    if (luai_unlikely(!priv->latency)) {
+        priv->latency = pal_mem_alloc(sizeof(*priv->latency));
+        if (priv->latency) {
+            HAPRawBufferZero(priv->latency, sizeof(*priv->latency));
+        }
+    }
+    return priv->latency;
+}
+
 // Lua light userdata.
 typedef struct lhap_lightuserdata {
     const char *name;
@@ -520,47 +677,48 @@ typedef struct lhap_service_type {
 #define LHAP_SERVICE_TYPE_FORMAT(type) \
     { #type, &kHAPServiceType_##type, kHAPServiceDebugDescription_##type }
 
+// Sorted by name, lhap_get_service_type() does a binary search.
 static const lhap_service_type lhap_service_type_tab[] = {
     LHAP_SERVICE_TYPE_FORMAT(AccessoryInformation),
-    LHAP_SERVICE_TYPE_FORMAT(GarageDoorOpener),
-    LHAP_SERVICE_TYPE_FORMAT(LightBulb),
-    LHAP_SERVICE_TYPE_FORMAT(LockManagement),
-    LHAP_SERVICE_TYPE_FORMAT(LockMechanism),
-    LHAP_SERVICE_TYPE_FORMAT(Outlet),
-    LHAP_SERVICE_TYPE_FORMAT(Switch),
-    LHAP_SERVICE_TYPE_FORMAT(Thermostat),
-    LHAP_SERVICE_TYPE_FORMAT(Pairing),
-    LHAP_SERVICE_TYPE_FORMAT(SecuritySystem),
+    LHAP_SERVICE_TYPE_FORMAT(AirPurifier),
+    LHAP_SERVICE_TYPE_FORMAT(AirQualitySensor),
+    LHAP_SERVICE_TYPE_FORMAT(BatteryService),
+    LHAP_SERVICE_TYPE_FORMAT(CameraRTPStreamManagement),
+    LHAP_SERVICE_TYPE_FORMAT(CarbonDioxideSensor),
     LHAP_SERVICE_TYPE_FORMAT(CarbonMonoxideSensor),
     LHAP_SERVICE_TYPE_FORMAT(ContactSensor),
     LHAP_SERVICE_TYPE_FORMAT(Door),
+    LHAP_SERVICE_TYPE_FORMAT(Fan),
+    LHAP_SERVICE_TYPE_FORMAT(Faucet),
+    LHAP_SERVICE_TYPE_FORMAT(FilterMaintenance),
+    LHAP_SERVICE_TYPE_FORMAT(GarageDoorOpener),
+    LHAP_SERVICE_TYPE_FORMAT(HAPProtocolInformation),
+    LHAP_SERVICE_TYPE_FORMAT(HeaterCooler),
+    LHAP_SERVICE_TYPE_FORMAT(HumidifierDehumidifier),
     LHAP_SERVICE_TYPE_FORMAT(HumiditySensor),
+    LHAP_SERVICE_TYPE_FORMAT(IrrigationSystem),
     LHAP_SERVICE_TYPE_FORMAT(LeakSensor),
+    LHAP_SERVICE_TYPE_FORMAT(LightBulb),
     LHAP_SERVICE_TYPE_FORMAT(LightSensor),
+    LHAP_SERVICE_TYPE_FORMAT(LockManagement),
+    LHAP_SERVICE_TYPE_FORMAT(LockMechanism),
+    LHAP_SERVICE_TYPE_FORMAT(Microphone),
     LHAP_SERVICE_TYPE_FORMAT(MotionSensor),
     LHAP_SERVICE_TYPE_FORMAT(OccupancySensor),
+    LHAP_SERVICE_TYPE_FORMAT(Outlet),
+    LHAP_SERVICE_TYPE_FORMAT(Pairing),
+    LHAP_SERVICE_TYPE_FORMAT(SecuritySystem),
+    LHAP_SERVICE_TYPE_FORMAT(ServiceLabel),
+    LHAP_SERVICE_TYPE_FORMAT(Slat),
     LHAP_SERVICE_TYPE_FORMAT(SmokeSensor),
+    LHAP_SERVICE_TYPE_FORMAT(Speaker),
     LHAP_SERVICE_TYPE_FORMAT(StatelessProgrammableSwitch),
+    LHAP_SERVICE_TYPE_FORMAT(Switch),
     LHAP_SERVICE_TYPE_FORMAT(TemperatureSensor),
+    LHAP_SERVICE_TYPE_FORMAT(Thermostat),
+    LHAP_SERVICE_TYPE_FORMAT(Valve),
     LHAP_SERVICE_TYPE_FORMAT(Window),
     LHAP_SERVICE_TYPE_FORMAT(WindowCovering),
-    LHAP_SERVICE_TYPE_FORMAT(AirQualitySensor),
-    LHAP_SERVICE_TYPE_FORMAT(BatteryService),
-    LHAP_SERVICE_TYPE_FORMAT(CarbonDioxideSensor),
-    LHAP_SERVICE_TYPE_FORMAT(HAPProtocolInformation),
-    LHAP_SERVICE_TYPE_FORMAT(Fan),
-    LHAP_SERVICE_TYPE_FORMAT(Slat),
-    LHAP_SERVICE_TYPE_FORMAT(FilterMaintenance),
-    LHAP_SERVICE_TYPE_FORMAT(AirPurifier),
-    LHAP_SERVICE_TYPE_FORMAT(HeaterCooler),
-    LHAP_SERVICE_TYPE_FORMAT(HumidifierDehumidifier),
-    LHAP_SERVICE_TYPE_FORMAT(ServiceLabel),
-    LHAP_SERVICE_TYPE_FORMAT(IrrigationSystem),
-    LHAP_SERVICE_TYPE_FORMAT(Valve),
-    LHAP_SERVICE_TYPE_FORMAT(Faucet),
-    LHAP_SERVICE_TYPE_FORMAT(CameraRTPStreamManagement),
-    LHAP_SERVICE_TYPE_FORMAT(Microphone),
-    LHAP_SERVICE_TYPE_FORMAT(Speaker),
 };
 
 typedef struct lhap_characteristic_type {
@@ -576,120 +734,121 @@ typedef struct lhap_characteristic_type {
     kHAPCharacteristicDebugDescription_##type, \
 }
 
+// Sorted by name, lhap_get_char_type() does a binary search.
 static const lhap_characteristic_type lhap_characteristic_type_tab[] = {
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(ADKVersion),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(AccessoryFlags),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(Active),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(ActiveIdentifier),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(AdministratorOnlyAccess),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(AirParticulateDensity),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(AirParticulateSize),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(AirQuality),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(AudioFeedback),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(BatteryLevel),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(Brightness),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CarbonDioxideDetected),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CarbonDioxideLevel),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CarbonDioxidePeakLevel),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CarbonMonoxideDetected),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CarbonMonoxideLevel),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CarbonMonoxidePeakLevel),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(ChargingState),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(ColorTemperature),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(ContactSensorState),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(CoolingThresholdTemperature),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentAirPurifierState),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentAmbientLightLevel),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentDoorState),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentFanState),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentHeaterCoolerState),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentHeatingCoolingState),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentHorizontalTiltAngle),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentHumidifierDehumidifierState),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentPosition),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentRelativeHumidity),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentSlatState),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentTemperature),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentTiltAngle),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentVerticalTiltAngle),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(FilterChangeIndication),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(FilterLifeLevel),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(FirmwareRevision),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(HardwareRevision),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(HeatingThresholdTemperature),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(HoldPosition),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(Hue),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(Identify),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(InUse),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(IsConfigured),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(LeakDetected),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(LockControlPoint),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(LockManagementAutoSecurityTimeout),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(LockLastKnownAction),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(LockCurrentState),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(LockLastKnownAction),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(LockManagementAutoSecurityTimeout),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(LockPhysicalControls),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(LockTargetState),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(Logs),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(Manufacturer),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(Model),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(MotionDetected),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(Name),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(NitrogenDioxideDensity),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(ObstructionDetected),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(OccupancyDetected),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(On),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(OutletInUse),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(RotationDirection),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(RotationSpeed),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(Saturation),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(SerialNumber),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetDoorState),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetHeatingCoolingState),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetRelativeHumidity),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetTemperature),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(TemperatureDisplayUnits),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(Version),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(OzoneDensity),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(PM10Density),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(PM2_5Density),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(PairSetup),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(PairVerify),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(PairingFeatures),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(PairingPairings),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(FirmwareRevision),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(HardwareRevision),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(AirParticulateDensity),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(AirParticulateSize),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(SecuritySystemCurrentState),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(SecuritySystemTargetState),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(BatteryLevel),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CarbonMonoxideDetected),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(ContactSensorState),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentAmbientLightLevel),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentHorizontalTiltAngle),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentPosition),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentVerticalTiltAngle),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(HoldPosition),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(LeakDetected),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(OccupancyDetected),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(PositionState),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(ProgramMode),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(ProgrammableSwitchEvent),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(StatusActive),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(RelativeHumidityDehumidifierThreshold),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(RelativeHumidityHumidifierThreshold),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(RemainingDuration),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(ResetFilterIndication),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(RotationDirection),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(RotationSpeed),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(Saturation),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(SecuritySystemAlarmType),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(SecuritySystemCurrentState),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(SecuritySystemTargetState),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(SerialNumber),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(ServiceLabelIndex),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(ServiceLabelNamespace),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(ServiceSignature),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(SetDuration),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(SlatType),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(SmokeDetected),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(StatusActive),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(StatusFault),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(StatusJammed),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(StatusLowBattery),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(StatusTampered),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetHorizontalTiltAngle),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetPosition),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetVerticalTiltAngle),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(SecuritySystemAlarmType),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(ChargingState),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CarbonMonoxideLevel),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CarbonMonoxidePeakLevel),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CarbonDioxideDetected),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CarbonDioxideLevel),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CarbonDioxidePeakLevel),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(AirQuality),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(ServiceSignature),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(AccessoryFlags),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(LockPhysicalControls),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(SulphurDioxideDensity),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(SwingMode),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetAirPurifierState),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentAirPurifierState),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentSlatState),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(FilterLifeLevel),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(FilterChangeIndication),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(ResetFilterIndication),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentFanState),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(Active),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentHeaterCoolerState),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetDoorState),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetFanState),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetHeaterCoolerState),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentHumidifierDehumidifierState),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetHeatingCoolingState),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetHorizontalTiltAngle),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetHumidifierDehumidifierState),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(WaterLevel),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(SwingMode),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetFanState),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(SlatType),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(CurrentTiltAngle),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetPosition),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetRelativeHumidity),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetTemperature),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetTiltAngle),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(OzoneDensity),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(NitrogenDioxideDensity),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(SulphurDioxideDensity),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(PM2_5Density),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(PM10Density),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(TargetVerticalTiltAngle),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(TemperatureDisplayUnits),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(VOCDensity),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(RelativeHumidityDehumidifierThreshold),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(RelativeHumidityHumidifierThreshold),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(ServiceLabelIndex),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(ServiceLabelNamespace),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(ColorTemperature),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(ProgramMode),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(InUse),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(SetDuration),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(RemainingDuration),
     LHAP_CHARACTERISTIC_TYPE_FORMAT(ValveType),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(IsConfigured),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(ActiveIdentifier),
-    LHAP_CHARACTERISTIC_TYPE_FORMAT(ADKVersion),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(Version),
+    LHAP_CHARACTERISTIC_TYPE_FORMAT(WaterLevel),
 };
 
 #if LUA_MAXINTEGER < UINT32_MAX
@@ -719,6 +878,7 @@ typedef struct lhap_read_request {
     const HAPService *service;
     const HAPBaseCharacteristic *characteristic;
     const void *pfunc;
+    uint64_t arrival;   /* Time in microseconds the request was received, 0 if the latency is not recorded. */
     struct lhap_read_request *next;
 } lhap_read_request;
 
@@ -726,8 +886,11 @@ typedef struct lhap_desc {
     bool started;
 
     HAPAccessory *primary_acc;
-    HAPAccessory **bridged_accs;
+    HAPAccessory **bridged_accs;    /* NULL-terminated, updated in place as the server keeps the pointer. */
     size_t num_bridged_accs;
+    size_t num_retired_accs;        /* Removed accessories with requests not done. */
+    bool has_pending_accs;          /* Whether there are bridged accessories to apply. */
+    HAPPlatformTimerRef update_accs_timer;
 
     lua_State *mL;
     lua_State *co;
@@ -735,16 +898,28 @@ typedef struct lhap_desc {
     HAPAccessoryServerRef server;
     HAPAccessoryServerOptions server_options;
     HAPAccessoryServerCallbacks server_cbs;
+    bool has_session_accept_cb;
+    bool has_session_invalid_cb;
 
     HAPPlatformTimerRef read_requests_timer;
-    lhap_read_request *read_requests_head;
-    lhap_read_request **read_requests_ptail;
+    lhap_accessory_priv *read_accs_head;    /* Accessories with queued reads, served round-robin. */
+    lhap_accessory_priv **read_accs_ptail;
+    lhap_read_request *free_read_requests;  /* Pool of the read request nodes. */
+    size_t num_free_read_requests;
+    struct lhap_request *free_requests;     /* Pool of the request objects. */
+    size_t num_free_requests;
     size_t num_read_requests;
     size_t max_read_requests;
 } lhap_desc;
 
 static lhap_desc gv_lhap_desc;
 
+// Key of the registry table of the bridged accessories to apply.
+static const char lhap_pending_accs_key;
+
+// Key of the registry table mapping the removed accessories with requests not done to themselves.
+static const char lhap_retired_accs_key;
+
 static bool lhap_checkfunction(lua_State *L, int arg) {
     luaL_checktype(L, arg, LUA_TFUNCTION);
     return true;
@@ -755,61 +930,272 @@ static size_t lhap_checkarray(lua_State *L, int arg) {
     return lua_rawlen(L, arg);
 }
 
-static void
-lhap_init_ip(HAPAccessoryServerOptions *options, size_t num_contexts, size_t num_notify) {
+typedef struct lhap_session_stats {
+    size_t sessions;        /* sessions in use */
+    size_t peak_sessions;   /* max sessions in use at the same time */
+    size_t bytes;           /* memory of the session storage */
+    size_t peak_bytes;      /* max memory of the session storage */
+} lhap_session_stats;
+
+static lhap_session_stats gv_lhap_session_stats;
+
+typedef struct lhap_ip_session_slot {
+    char *mem;              /* Memory owned by the session, NULL if it is shared. */
+    size_t size;            /* Bytes of the memory owned by the session. */
+    bool active;
+} lhap_ip_session_slot;
+
+/**
+ * Storage of the IP sessions.
+ *
+ * In the lazy mode, only the sessions in use and the first free session own
+ * their memory, the other free sessions share the memory of the first free
+ * session. The server takes the first free session for a new TCP stream,
+ * so the memory is only allocated for the sessions in use plus one.
+ */
+typedef struct lhap_ip_storage {
+    HAPIPAccessoryServerStorage server_storage;
+    lhap_ip_session_slot *slots;
+    size_t session_size;
+    size_t num_contexts;
+    size_t num_notify;
+    HAPPlatformTimerRef release_timer;
+} lhap_ip_storage;
+
+static lhap_ip_storage gv_lhap_ip_storage;
+
+static void lhap_ip_session_bind(lhap_ip_storage *storage, size_t i, char *mem) {
+    HAPIPSession *session = &storage->server_storage.sessions[i];
+    session->contexts = (HAPIPCharacteristicContextRef *)mem;
+    session->numContexts = storage->num_contexts;
+    mem += sizeof(HAPIPCharacteristicContextRef) * storage->num_contexts;
+    session->eventNotifications = (HAPIPEventNotificationRef *)mem;
+    session->numEventNotifications = storage->num_notify;
+    mem += sizeof(HAPIPEventNotificationRef) * storage->num_notify;
+    session->inboundBuffer.bytes = mem;
+    session->inboundBuffer.numBytes = PAL_HAP_IP_SESSION_STORAGE_INBOUND_BUFSIZE;
+    mem += PAL_HAP_IP_SESSION_STORAGE_INBOUND_BUFSIZE;
+    session->outboundBuffer.bytes = mem;
+    session->outboundBuffer.numBytes = PAL_HAP_IP_SESSION_STORAGE_OUTBOUND_BUFSIZE;
+    mem += PAL_HAP_IP_SESSION_STORAGE_OUTBOUND_BUFSIZE;
+    session->scratchBuffer.bytes = mem;
+    session->scratchBuffer.numBytes = PAL_HAP_IP_SESSION_STORAGE_SCRATCH_BUFSIZE;
+}
+
+static void lhap_ip_session_stats_update(lhap_ip_storage *storage) {
+    lhap_session_stats *stats = &gv_lhap_session_stats;
+    stats->sessions = 0;
+    stats->bytes = 0;
+    for (size_t i = 0; i < storage->server_storage.numSessions; i++) {
+        stats->bytes += storage->slots[i].mem ? storage->slots[i].size : 0;
+        stats->sessions += storage->slots[i].active ? 1 : 0;
+    }
+    stats->peak_sessions = HAPMax(stats->peak_sessions, stats->sessions);
+    stats->peak_bytes = HAPMax(stats->peak_bytes, stats->bytes);
+}
+
+#if LHAP_LAZY_SESSIONS
+// Leave the session without memory, the server fails the streams accepted on it.
+static void lhap_ip_session_unbind(lhap_ip_storage *storage, size_t i) {
+    HAPIPSession *session = &storage->server_storage.sessions[i];
+    session->contexts = NULL;
+    session->numContexts = 0;
+    session->eventNotifications = NULL;
+    session->numEventNotifications = 0;
+    session->inboundBuffer.bytes = NULL;
+    session->inboundBuffer.numBytes = 0;
+    session->outboundBuffer.bytes = NULL;
+    session->outboundBuffer.numBytes = 0;
+    session->scratchBuffer.bytes = NULL;
+    session->scratchBuffer.numBytes = 0;
+}
+
+static size_t lhap_ip_storage_first_free(lhap_ip_storage *storage) {
+    size_t i = 0;
+    while (i < storage->server_storage.numSessions && storage->slots[i].active) {
+        i++;
+    }
+    return i;
+}
+
+/**
+ * Make sure the first free session owns its memory.
+ * If release is true, the other free sessions release their memory and
+ * share the memory of the first free session.
+ *
+ * If the memory can't be allocated, the free sessions without their own
+ * memory are left unbound, and the next balance tries again.
+ *
+ * @returns false if the memory of the first free session can't be allocated.
+ */
+static bool lhap_ip_storage_balance(lhap_ip_storage *storage, bool release) {
+    size_t num_sessions = storage->server_storage.numSessions;
+    size_t first = lhap_ip_storage_first_free(storage);
+    if (first == num_sessions) {
+        lhap_ip_session_stats_update(storage);
+        return true;
+    }
+    lhap_ip_session_slot *spare = &storage->slots[first];
+    if (!spare->mem || spare->size != storage->session_size) {
+        // not allocated yet or allocated before the storage grew
+        char *mem = pal_mem_alloc(storage->session_size);
+        if (luai_unlikely(!mem)) {
+            HAPLogError(&lhap_log, "%s: Failed to alloc session memory.", __func__);
+            // the sessions sharing memory may share the memory of a session in use,
+            // the sessions owning memory of the old size are still bound to it
+            for (size_t i = first; i < num_sessions; i++) {
+                if (!storage->slots[i].active && !storage->slots[i].mem) {
+                    lhap_ip_session_unbind(storage, i);
+                }
+            }
+            lhap_ip_session_stats_update(storage);
+            return false;
+        }
+        if (spare->mem) {
+            pal_mem_free(spare->mem);
+        }
+        spare->mem = mem;
+        spare->size = storage->session_size;
+        lhap_ip_session_bind(storage, first, spare->mem);
+    }
+    for (size_t i = first + 1; i < num_sessions; i++) {
+        lhap_ip_session_slot *slot = &storage->slots[i];
+        if (slot->active || (slot->mem && !release)) {
+            continue;
+        }
+        if (slot->mem) {
+            pal_mem_free(slot->mem);
+            slot->mem = NULL;
+        }
+        lhap_ip_session_bind(storage, i, spare->mem);
+    }
+    lhap_ip_session_stats_update(storage);
+    return true;
+}
+
+static void lhap_ip_storage_release_cb(HAPPlatformTimerRef timer, void* context) {
+    lhap_ip_storage *storage = context;
+    storage->release_timer = 0;
+    lhap_ip_storage_balance(storage, true);
+}
+
+/**
+ * Grow the memory of the sessions accepted later.
+ * The sessions in use keep their memory until they are closed.
+ * Must be called from the run loop, not from the server callbacks.
+ */
+static void lhap_ip_storage_grow(lhap_ip_storage *storage, size_t num_contexts, size_t num_notify) {
+    if (num_contexts <= storage->num_contexts && num_notify <= storage->num_notify) {
+        return;
+    }
+    storage->num_contexts = HAPMax(storage->num_contexts, num_contexts);
+    storage->num_notify = HAPMax(storage->num_notify, num_notify);
+    storage->session_size = sizeof(HAPIPCharacteristicContextRef) * storage->num_contexts +
+        sizeof(HAPIPEventNotificationRef) * storage->num_notify +
+        PAL_HAP_IP_SESSION_STORAGE_INBOUND_BUFSIZE +
+        PAL_HAP_IP_SESSION_STORAGE_OUTBOUND_BUFSIZE +
+        PAL_HAP_IP_SESSION_STORAGE_SCRATCH_BUFSIZE;
+    lhap_ip_storage_balance(storage, true);
+}
+#endif
+
+static void lhap_ip_storage_set_active(HAPSessionRef *session, bool active) {
+    lhap_ip_storage *storage = &gv_lhap_ip_storage;
+    HAPIPSession *sessions = storage->server_storage.sessions;
+    size_t num_sessions = storage->server_storage.numSessions;
+    if (!sessions || (uintptr_t)session < (uintptr_t)sessions ||
+        (uintptr_t)session >= (uintptr_t)(sessions + num_sessions)) {
+        // not an IP session
+        return;
+    }
+    size_t i = ((uintptr_t)session - (uintptr_t)sessions) / sizeof(HAPIPSession);
+    storage->slots[i].active = active;
+
+#if LHAP_LAZY_SESSIONS
+    if (active) {
+        if (luai_unlikely(!storage->slots[i].mem)) {
+            HAPLogError(&lhap_log, "%s: Session %zu accepted without memory.", __func__, i);
+        }
+        lhap_ip_storage_balance(storage, false);
+    } else if (!storage->release_timer) {
+        // the server still uses the memory while closing the session,
+        // release it from the run loop
+        if (HAPPlatformTimerRegister(&storage->release_timer, HAPPlatformClockGetCurrent(),
+            lhap_ip_storage_release_cb, storage)) {
+            HAPLogError(&lhap_log, "%s: Failed to register session release timer.", __func__);
+        }
+        lhap_ip_session_stats_update(storage);
+    }
+#else
+    lhap_ip_session_stats_update(storage);
+#endif
+}
+
+static void
+lhap_init_ip(HAPAccessoryServerOptions *options, size_t num_contexts, size_t num_notify) {
     HAPPrecondition(options);
     HAPPrecondition(num_contexts);
     HAPPrecondition(num_notify);
 
-    static HAPIPAccessoryServerStorage serverStorage;
-
+    lhap_ip_storage *storage = &gv_lhap_ip_storage;
     size_t num_sessions = PAL_HAP_IP_SESSION_STORAGE_NUM_ELEMENTS;
     HAPIPSession *sessions = pal_mem_alloc(sizeof(HAPIPSession) * num_sessions);
     HAPAssert(sessions);
-    char *inbounds = pal_mem_alloc(PAL_HAP_IP_SESSION_STORAGE_INBOUND_BUFSIZE * num_sessions);
-    HAPAssert(inbounds);
-    char *outbounds = pal_mem_alloc(PAL_HAP_IP_SESSION_STORAGE_OUTBOUND_BUFSIZE * num_sessions);
-    HAPAssert(outbounds);
-    char *scratches = pal_mem_alloc(PAL_HAP_IP_SESSION_STORAGE_SCRATCH_BUFSIZE * num_sessions);
-    HAPAssert(scratches);
-    HAPIPCharacteristicContextRef *contexts =
-        pal_mem_alloc(sizeof(HAPIPCharacteristicContextRef) * num_contexts * num_sessions);
-    HAPAssert(contexts);
-    HAPIPEventNotificationRef *eventNotifications =
-        pal_mem_alloc(sizeof(HAPIPEventNotificationRef) * num_notify * num_sessions);
-    HAPAssert(eventNotifications);
+    HAPRawBufferZero(sessions, sizeof(HAPIPSession) * num_sessions);
+    storage->slots = pal_mem_alloc(sizeof(lhap_ip_session_slot) * num_sessions);
+    HAPAssert(storage->slots);
+    HAPRawBufferZero(storage->slots, sizeof(lhap_ip_session_slot) * num_sessions);
+    storage->server_storage.sessions = sessions;
+    storage->server_storage.numSessions = num_sessions;
+    storage->num_contexts = num_contexts;
+    storage->num_notify = num_notify;
+    storage->session_size = sizeof(HAPIPCharacteristicContextRef) * num_contexts +
+        sizeof(HAPIPEventNotificationRef) * num_notify +
+        PAL_HAP_IP_SESSION_STORAGE_INBOUND_BUFSIZE +
+        PAL_HAP_IP_SESSION_STORAGE_OUTBOUND_BUFSIZE +
+        PAL_HAP_IP_SESSION_STORAGE_SCRATCH_BUFSIZE;
+    storage->release_timer = 0;
+    gv_lhap_session_stats.sessions = 0;
+
+#if LHAP_LAZY_SESSIONS
+    bool allocated = lhap_ip_storage_balance(storage, true);
+    HAPAssert(allocated);
+#else
     for (size_t i = 0; i < num_sessions; i++) {
-        sessions[i].inboundBuffer.bytes = inbounds + PAL_HAP_IP_SESSION_STORAGE_INBOUND_BUFSIZE * i;
-        sessions[i].inboundBuffer.numBytes = PAL_HAP_IP_SESSION_STORAGE_INBOUND_BUFSIZE;
-        sessions[i].outboundBuffer.bytes = outbounds + PAL_HAP_IP_SESSION_STORAGE_OUTBOUND_BUFSIZE * i;
-        sessions[i].outboundBuffer.numBytes = PAL_HAP_IP_SESSION_STORAGE_OUTBOUND_BUFSIZE;
-        sessions[i].scratchBuffer.bytes = scratches + PAL_HAP_IP_SESSION_STORAGE_SCRATCH_BUFSIZE * i;
-        sessions[i].scratchBuffer.numBytes = PAL_HAP_IP_SESSION_STORAGE_SCRATCH_BUFSIZE;
-        sessions[i].contexts = contexts + num_contexts * i;
-        sessions[i].numContexts = num_contexts;
-        sessions[i].eventNotifications = eventNotifications + num_notify * i;
-        sessions[i].numEventNotifications = num_notify;
-    }
-    serverStorage.sessions = sessions;
-    serverStorage.numSessions = num_sessions;
+        storage->slots[i].mem = pal_mem_alloc(storage->session_size);
+        HAPAssert(storage->slots[i].mem);
+        storage->slots[i].size = storage->session_size;
+        lhap_ip_session_bind(storage, i, storage->slots[i].mem);
+    }
+    lhap_ip_session_stats_update(storage);
+#endif
 
     options->ip.transport = &kHAPAccessoryServerTransport_IP;
-    options->ip.accessoryServerStorage = &serverStorage;
+    options->ip.accessoryServerStorage = &storage->server_storage;
 }
 
 static void
 lhap_deinit_ip(HAPAccessoryServerOptions *options) {
     HAPPrecondition(options);
 
-    HAPIPAccessoryServerStorage *storage = options->ip.accessoryServerStorage;
-    pal_mem_free(storage->sessions[0].inboundBuffer.bytes);
-    pal_mem_free(storage->sessions[0].outboundBuffer.bytes);
-    pal_mem_free(storage->sessions[0].scratchBuffer.bytes);
-    pal_mem_free(storage->sessions[0].contexts);
-    pal_mem_free(storage->sessions[0].eventNotifications);
-    pal_mem_free(storage->sessions);
-    storage->sessions = NULL;
-    storage->numSessions = 0;
+    lhap_ip_storage *storage = &gv_lhap_ip_storage;
+    HAPAssert(options->ip.accessoryServerStorage == &storage->server_storage);
+    if (storage->release_timer) {
+        HAPPlatformTimerDeregister(storage->release_timer);
+        storage->release_timer = 0;
+    }
+    for (size_t i = 0; i < storage->server_storage.numSessions; i++) {
+        if (storage->slots[i].mem) {
+            pal_mem_free(storage->slots[i].mem);
+        }
+    }
+    pal_mem_free(storage->slots);
+    storage->slots = NULL;
+    pal_mem_free(storage->server_storage.sessions);
+    storage->server_storage.sessions = NULL;
+    storage->server_storage.numSessions = 0;
+    gv_lhap_session_stats.sessions = 0;
+    gv_lhap_session_stats.bytes = 0;
     HAPRawBufferZero(options, sizeof(*options));
 }
 
@@ -922,6 +1308,11 @@ static bool lhap_char_props_ble_write_without_sec_cb(lua_State *L, void *arg) {
 }
 
 static const lc_table_kv lhap_char_props_ble_kvs[] = {
+    {
+        "readableWithoutSecurity",
+        LC_TBOOLEAN,
+        lhap_char_props_ble_read_without_sec_cb
+    },
     {
         "supportsBroadcastNotification",
         LC_TBOOLEAN,
@@ -932,11 +1323,6 @@ static const lc_table_kv lhap_char_props_ble_kvs[] = {
         LC_TBOOLEAN,
         lhap_char_props_ble_support_disconn_notify_cb
     },
-    {
-        "readableWithoutSecurity",
-        LC_TBOOLEAN,
-        lhap_char_props_ble_read_without_sec_cb
-    },
     {
         "writableWithoutSecurity",
         LC_TBOOLEAN,
@@ -950,47 +1336,71 @@ static bool lhap_char_props_ble_cb(lua_State *L, void *arg) {
 }
 
 static const lc_table_kv lhap_char_props_kvs[] = {
-    {"readable", LC_TBOOLEAN, lhap_char_props_readable_cb},
-    {"writable", LC_TBOOLEAN, lhap_char_props_writable_cb},
-    {"supportsEventNotification", LC_TBOOLEAN, lhap_char_props_support_evt_notify_cb},
+    {"ble", LC_TTABLE, lhap_char_props_ble_cb},
     {"hidden", LC_TBOOLEAN, lhap_char_props_hidden_cb},
+    {"ip", LC_TTABLE, lhap_char_props_ip_cb},
     {"readRequiresAdminPermissions", LC_TBOOLEAN, lhap_char_props_read_req_admin_pms_cb},
-    {"writeRequiresAdminPermissions", LC_TBOOLEAN, lhap_char_props_write_req_admin_pms_cb},
+    {"readable", LC_TBOOLEAN, lhap_char_props_readable_cb},
     {"requiresTimedWrite", LC_TBOOLEAN, lhap_char_props_req_timed_write_cb},
     {"supportsAuthorizationData", LC_TBOOLEAN, lhap_char_props_support_auth_data_cb},
-    {"ip", LC_TTABLE, lhap_char_props_ip_cb},
-    {"ble", LC_TTABLE, lhap_char_props_ble_cb},
+    {"supportsEventNotification", LC_TBOOLEAN, lhap_char_props_support_evt_notify_cb},
+    {"writable", LC_TBOOLEAN, lhap_char_props_writable_cb},
+    {"writeRequiresAdminPermissions", LC_TBOOLEAN, lhap_char_props_write_req_admin_pms_cb},
     {NULL, LC_TNONE, NULL},
 };
 
-static void
-lhap_create_request_table(
-        lua_State *L,
-        HAPTransportType transportType,
-        HAPSessionRef *session,
-        const bool *const remote,
-        const HAPAccessory *accessory,
-        const HAPService *service,
-        const HAPBaseCharacteristic *characteristic) {
-    lua_createtable(L, 0, 2 + (remote ? 1 : 0) + (service ? 1 : 0) + (characteristic ? 1 : 0));
-    lua_pushstring(L, lhap_transport_type_strs[transportType]);
-    lua_setfield(L, -2, "transportType");
-    if (remote) {
-        lua_pushboolean(L, *remote);
-        lua_setfield(L, -2, "remote");
+static bool lhap_char_cache_ttl_cb(lua_State *L, void *arg) {
+    lua_Integer ttl = lua_tointeger(L, -1);
+    if (ttl <= 0) {
+        return false;
     }
-    lua_pushlightuserdata(L, session);
-    lua_setfield(L, -2, "session");
-    lua_pushinteger(L, accessory->aid);
-    lua_setfield(L, -2, "aid");
-    if (service) {
-        lua_pushinteger(L, service->iid);
-        lua_setfield(L, -2, "sid");
+    ((lhap_char_cache *)arg)->ttl = ttl;
+    return true;
+}
+
+static bool lhap_char_cache_stale_cb(lua_State *L, void *arg) {
+    lua_Integer stale = lua_tointeger(L, -1);
+    if (stale < 0) {
+        return false;
+    }
+    ((lhap_char_cache *)arg)->stale = stale;
+    return true;
+}
+
+static const lc_table_kv lhap_char_cache_kvs[] = {
+    {"stale", LC_TNUMBER, lhap_char_cache_stale_cb},
+    {"ttl", LC_TNUMBER, lhap_char_cache_ttl_cb},
+    {NULL, LC_TNONE, NULL},
+};
+
+// Check the cached value, the value is valid if it is fresh or stale.
+static bool lhap_char_cache_check(lhap_char_cache *cache, bool *fresh) {
+    if (!cache->valid) {
+        return false;
     }
-    if (characteristic) {
-        lua_pushinteger(L, characteristic->iid);
-        lua_setfield(L, -2, "cid");
+    HAPTime age = HAPPlatformClockGetCurrent() - cache->time;
+    if (age >= cache->ttl + cache->stale) {
+        cache->valid = false;
+        return false;
     }
+    *fresh = age < cache->ttl;
+    return true;
+}
+
+// Store the value at index idx, unless the cache is invalidated after the read started.
+static void lhap_char_cache_set(lua_State *L, int idx, lhap_char_cache *cache, uint32_t gen) {
+    if (!cache->ttl || cache->gen != gen) {
+        return;
+    }
+    lua_pushvalue(L, idx);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, cache);
+    cache->time = HAPPlatformClockGetCurrent();
+    cache->valid = true;
+}
+
+static void lhap_char_cache_invalidate(lhap_char_cache *cache) {
+    cache->gen++;
+    cache->valid = false;
 }
 
 typedef struct lhap_call_context {
@@ -1001,8 +1411,146 @@ typedef struct lhap_call_context {
     const HAPAccessory *accessory;
     const HAPService *service;
     const HAPCharacteristic *characteristic;
+    lhap_read_request *readers;     /* Reads waiting for the result of this read. */
+    bool refresh;       /* Refresh the cache, there is no request to answer. */
+    uint32_t cache_gen; /* Generation of the cache when the read started. */
+    uint64_t arrival;   /* Time in microseconds the request was received, 0 if the latency is not recorded. */
+    uint64_t start;     /* Time in microseconds the callback was called. */
 } lhap_call_context;
 
+/**
+ * Request object passed to the callbacks.
+ *
+ * The objects are pooled by the server and reused, the fields are read
+ * by __index, so no table is built for each request.
+ */
+typedef struct lhap_request {
+    lhap_call_context ctx;
+    bool has_remote;
+    bool remote;
+    struct lhap_request *next;  /* Next free request in the pool. */
+} lhap_request;
+
+static const char *lhap_request_field_strs[] = {
+    "transportType",
+    "remote",
+    "session",
+    "aid",
+    "sid",
+    "cid",
+    NULL,
+};
+
+enum {
+    LHAP_REQUEST_FIELD_TRANSPORT_TYPE,
+    LHAP_REQUEST_FIELD_REMOTE,
+    LHAP_REQUEST_FIELD_SESSION,
+    LHAP_REQUEST_FIELD_AID,
+    LHAP_REQUEST_FIELD_SID,
+    LHAP_REQUEST_FIELD_CID,
+};
+
+static int lhap_request_index(lua_State *L) {
+    lhap_request *request = luaL_checkudata(L, 1, LHAP_REQUEST_NAME);
+    const char *key = lua_tostring(L, 2);
+    lhap_call_context *ctx = &request->ctx;
+    // the request is expired once it is back to the pool
+    if (!key || !ctx->accessory) {
+        return 0;
+    }
+    int field = 0;
+    for (; lhap_request_field_strs[field]; field++) {
+        if (!strcmp(key, lhap_request_field_strs[field])) {
+            break;
+        }
+    }
+    switch (field) {
+    case LHAP_REQUEST_FIELD_TRANSPORT_TYPE:
+        lua_pushstring(L, lhap_transport_type_strs[ctx->transportType]);
+        return 1;
+    case LHAP_REQUEST_FIELD_REMOTE:
+        if (!request->has_remote) {
+            return 0;
+        }
+        lua_pushboolean(L, request->remote);
+        return 1;
+    case LHAP_REQUEST_FIELD_SESSION:
+        lua_pushlightuserdata(L, ctx->session);
+        return 1;
+    case LHAP_REQUEST_FIELD_AID:
+        lua_pushinteger(L, ctx->accessory->aid);
+        return 1;
+    case LHAP_REQUEST_FIELD_SID:
+        if (!ctx->service) {
+            return 0;
+        }
+        lua_pushinteger(L, ctx->service->iid);
+        return 1;
+    case LHAP_REQUEST_FIELD_CID:
+        if (!ctx->characteristic) {
+            return 0;
+        }
+        lua_pushinteger(L, ((const HAPBaseCharacteristic *)ctx->characteristic)->iid);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Get a request from the pool, or create a new one if the pool is empty,
+ * and push it onto the stack.
+ *
+ * The requests in use and in the pool are anchored in the registry.
+ */
+static lhap_request *lhap_request_push(lua_State *L, const lhap_call_context *ctx) {
+    lhap_desc *desc = ctx->desc;
+    lhap_request *request = desc->free_requests;
+    if (request) {
+        desc->free_requests = request->next;
+        desc->num_free_requests--;
+        HAPAssert(lua_rawgetp(L, LUA_REGISTRYINDEX, request) == LUA_TUSERDATA);
+    } else {
+        request = lua_newuserdatauv(L, sizeof(*request), 0);
+        luaL_setmetatable(L, LHAP_REQUEST_NAME);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, request);
+    }
+    request->ctx = *ctx;
+    request->has_remote = false;
+    request->remote = false;
+    request->next = NULL;
+    lhap_accessory_get_priv(ctx->accessory)->num_requests++;
+    return request;
+}
+
+/**
+ * Put the request back to the pool, it must not be used by the callback anymore.
+ */
+static void lhap_request_release(lua_State *L, lhap_desc *desc, lhap_request *request) {
+    lhap_accessory_priv *acc = lhap_accessory_get_priv(request->ctx.accessory);
+    acc->num_requests--;
+    if (acc->retired && acc->num_requests == 0) {
+        // the last request of the removed accessory is done
+        acc->retired = false;
+        desc->num_retired_accs--;
+        if (lua_rawgetp(L, LUA_REGISTRYINDEX, &lhap_retired_accs_key) == LUA_TTABLE) {
+            lua_pushnil(L);
+            lua_rawsetp(L, -2, request->ctx.accessory);
+        }
+        lua_pop(L, 1);
+    }
+    request->ctx.accessory = NULL;
+    if (desc->num_free_requests == LHAP_REQUESTS_POOL_MAX) {
+        lua_pushnil(L);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, request);
+        return;
+    }
+    request->next = desc->free_requests;
+    desc->free_requests = request;
+    desc->num_free_requests++;
+}
+
 union lhap_char_value {
     bool boolean;
     lua_Integer integer;
@@ -1029,9 +1577,11 @@ static bool lhap_char_value_is_valid(lua_State *L, int idx, HAPCharacteristicFor
         break;
     case kHAPCharacteristicFormat_Data:
     case kHAPCharacteristicFormat_String:
-    case kHAPCharacteristicFormat_TLV8:
         is_valid = lua_isstring(L, idx);
         break;
+    case kHAPCharacteristicFormat_TLV8:
+        is_valid = lua_istable(L, idx);
+        break;
     }
     return is_valid;
 }
@@ -1061,6 +1611,109 @@ lhap_char_value_get(lua_State *L, int idx, HAPCharacteristicFormat format, union
     return valid;
 }
 
+/**
+ * Requests dispatched by hap.benchDispatch(), kept in a userdata on the stack
+ * of the waiting coroutine.
+ *
+ * The requests are made with LHAP_DISPATCH_SESSION, their responses are
+ * counted instead of being sent to a controller.
+ */
+typedef struct lhap_dispatch {
+    lc_pending pending;
+    struct lhap_dispatch *next;     /* Next dispatch in progress. */
+    HAPPlatformTimerRef timer;
+    lua_State *co;
+    const HAPAccessory *accessory;
+    const HAPService *service;
+    const HAPBaseCharacteristic *characteristic;
+    bool write;
+    lua_Integer n;
+    lua_Integer answered;
+    uint64_t start;     /* Time in microseconds, the elapsed time once all requests are answered. */
+    uint64_t allocs;    /* Blocks allocated before, the blocks allocated once all requests are answered. */
+    uint64_t allocated; /* Bytes allocated before, the bytes allocated once all requests are answered. */
+} lhap_dispatch;
+
+static lhap_dispatch *gv_lhap_dispatches;
+
+static const char lhap_dispatch_session;
+
+#define LHAP_DISPATCH_SESSION ((HAPSessionRef *)&lhap_dispatch_session)
+
+static void lhap_dispatch_unlink(lhap_dispatch *dispatch) {
+    for (lhap_dispatch **pnext = &gv_lhap_dispatches; *pnext; pnext = &(*pnext)->next) {
+        if (*pnext == dispatch) {
+            *pnext = dispatch->next;
+            break;
+        }
+    }
+}
+
+static int lhap_dispatch_resume(lua_State *L) {
+    lhap_dispatch *dispatch = lua_touserdata(L, 1);
+    lua_pop(L, 1);
+    lua_State *co = dispatch->co;
+    lua_pushinteger(co, dispatch->start);
+    lua_pushinteger(co, dispatch->allocs);
+    lua_pushinteger(co, dispatch->allocated);
+    int status, nres;
+    status = lc_resume(co, L, 3, &nres);
+    if (luai_unlikely(status != LUA_OK && status != LUA_YIELD)) {
+        HAPLogError(&lhap_log, "%s: %s", __func__, lua_tostring(L, -1));
+    }
+    return 0;
+}
+
+static void lhap_dispatch_resume_cb(HAPPlatformTimerRef timer, void *context) {
+    lhap_dispatch *dispatch = context;
+    dispatch->timer = 0;
+    lua_State *L = gv_lhap_desc.mL;
+    HAPAssert(lua_gettop(L) == 0);
+    lua_pushcfunction(L, lhap_dispatch_resume);
+    lua_pushlightuserdata(L, dispatch);
+    if (luai_unlikely(lua_pcall(L, 1, 0, 0) != LUA_OK)) {
+        HAPLogError(&lhap_log, "%s: %s", __func__, lua_tostring(L, -1));
+    }
+    lua_settop(L, 0);
+    lc_collectgarbage(L);
+}
+
+// Count an answered request, the waiting coroutine is resumed from the run loop after the last one.
+static void lhap_dispatch_answered(lhap_dispatch *dispatch) {
+    dispatch->answered++;
+    if (dispatch->answered < dispatch->n) {
+        return;
+    }
+    const mempool_stats *stats = mempool_getstats();
+    dispatch->start = pal_clock_get_us() - dispatch->start;
+    dispatch->allocs = stats->allocs - dispatch->allocs;
+    dispatch->allocated = stats->allocated - dispatch->allocated;
+    lhap_dispatch_unlink(dispatch);
+    if (HAPPlatformTimerRegister(&dispatch->timer, 0, lhap_dispatch_resume_cb, dispatch)) {
+        HAPLogError(&lhap_log, "%s: Failed to register dispatch resume timer.", __func__);
+        HAPFatalError();
+    }
+}
+
+/**
+ * Count the response of a dispatched request instead of sending it.
+ *
+ * @returns false if the request is not dispatched by hap.benchDispatch().
+ */
+static bool lhap_dispatch_respond(HAPSessionRef *session, const HAPCharacteristic *characteristic) {
+    if (luai_likely(session != LHAP_DISPATCH_SESSION)) {
+        return false;
+    }
+    // the dispatch is gone if the coroutine is canceled
+    for (lhap_dispatch *dispatch = gv_lhap_dispatches; dispatch; dispatch = dispatch->next) {
+        if (dispatch->characteristic == characteristic) {
+            lhap_dispatch_answered(dispatch);
+            break;
+        }
+    }
+    return true;
+}
+
 static HAPError lhap_char_response_read_request(
         HAPAccessoryServerRef *server,
         HAPTransportType transportType,
@@ -1072,6 +1725,10 @@ static HAPError lhap_char_response_read_request(
         union lhap_char_value *val) {
     HAPPrecondition(err != kHAPError_None || val);
 
+    if (luai_unlikely(lhap_dispatch_respond(session, characteristic))) {
+        return kHAPError_None;
+    }
+
     switch (((HAPBaseCharacteristic *)characteristic)->format) {
     case kHAPCharacteristicFormat_Bool:
         err = HAPBoolCharacteristicResponseReadRequest(server, transportType,
@@ -1119,14 +1776,205 @@ static HAPError lhap_char_response_read_request(
             err == kHAPError_None ? val->str.data : NULL);
         break;
     case kHAPCharacteristicFormat_TLV8:
-        // TODO(Zebin Wu): Implement TLV8 in lua.
-        HAPFatalError();
+        // TLV8 values are only written to the response writer of the request.
+        err = kHAPError_InvalidState;
+        break;
     }
     return err;
 }
 
+/**
+ * Encode the TLV8 items at index idx to the writer.
+ *
+ * The items are an array of {type = integer, value = nil|boolean|integer|string|items},
+ * the integers are encoded in the minimal number of bytes in little-endian,
+ * and the nested items are encoded in the scratch bytes of the writer.
+ * Raises an error if the items are nested deeper than LHAP_TLV8_MAX_DEPTH.
+ *
+ * @returns kHAPError_OutOfResources if the writer is full.
+ */
+static HAPError lhap_tlv8_encode(lua_State *L, int idx, HAPTLVWriterRef *writer, int depth) {
+    if (luai_unlikely(depth >= LHAP_TLV8_MAX_DEPTH)) {
+        luaL_error(L, "TLV8 items nested deeper than %d", LHAP_TLV8_MAX_DEPTH);
+    }
+    idx = lua_absindex(L, idx);
+    luaL_checkstack(L, 3, "too many nested TLV8 items");
+    lua_Integer n = luaL_len(L, idx);
+    for (lua_Integer i = 1; i <= n; i++) {
+        if (lua_rawgeti(L, idx, i) != LUA_TTABLE) {
+            luaL_error(L, "TLV8 item #%d is not a table", (int)i);
+        }
+        lua_getfield(L, -1, "type");
+        int isnum;
+        lua_Integer type = lua_tointegerx(L, -1, &isnum);
+        if (!isnum || type < 0 || type > UINT8_MAX) {
+            luaL_error(L, "TLV8 item #%d has an invalid type", (int)i);
+        }
+        lua_getfield(L, -2, "value");
+
+        HAPError err = kHAPError_None;
+        HAPTLV tlv = { .type = type };
+        uint8_t num[sizeof(uint64_t)];
+        switch (lua_type(L, -1)) {
+        case LUA_TNIL:
+            break;
+        case LUA_TBOOLEAN:
+            num[0] = lua_toboolean(L, -1);
+            tlv.value.bytes = num;
+            tlv.value.numBytes = 1;
+            break;
+        case LUA_TNUMBER: {
+            if (!lua_isinteger(L, -1)) {
+                luaL_error(L, "TLV8 item #%d has a float value", (int)i);
+            }
+            uint64_t v = lua_tointeger(L, -1);
+            size_t len = v <= UINT8_MAX ? 1 : v <= UINT16_MAX ? 2 : v <= UINT32_MAX ? 4 : 8;
+            for (size_t j = 0; j < len; j++) {
+                num[j] = (uint8_t)(v >> (j * 8));
+            }
+            tlv.value.bytes = num;
+            tlv.value.numBytes = len;
+        } break;
+        case LUA_TSTRING:
+            tlv.value.bytes = lua_tolstring(L, -1, &tlv.value.numBytes);
+            break;
+        case LUA_TTABLE: {
+            void *bytes;
+            size_t max_bytes;
+            HAPTLVWriterGetScratchBytes(writer, &bytes, &max_bytes);
+            HAPTLVWriterRef sub_writer;
+            HAPTLVWriterCreate(&sub_writer, bytes, max_bytes);
+            err = lhap_tlv8_encode(L, -1, &sub_writer, depth + 1);
+            if (err == kHAPError_None) {
+                void *sub_bytes;
+                HAPTLVWriterGetBuffer(&sub_writer, &sub_bytes, &tlv.value.numBytes);
+                tlv.value.bytes = sub_bytes;
+            }
+        } break;
+        default:
+            luaL_error(L, "TLV8 item #%d has an invalid value", (int)i);
+        }
+        if (err == kHAPError_None) {
+            err = HAPTLVWriterAppend(writer, &tlv);
+        }
+        lua_pop(L, 3);
+        if (err != kHAPError_None) {
+            return kHAPError_OutOfResources;
+        }
+    }
+    return kHAPError_None;
+}
+
+/**
+ * Decode the TLV8 items from the reader, and push the array of
+ * {type = integer, value = string} onto the stack.
+ */
+static void lhap_tlv8_decode(lua_State *L, HAPTLVReaderRef *reader) {
+    lua_newtable(L);
+    for (lua_Integer i = 1;; i++) {
+        bool found;
+        HAPTLV tlv;
+        if (HAPTLVReaderGetNext(reader, &found, &tlv) != kHAPError_None) {
+            luaL_error(L, "invalid TLV8 data");
+        }
+        if (!found) {
+            break;
+        }
+        lua_createtable(L, 0, 2);
+        lua_pushinteger(L, tlv.type);
+        lua_setfield(L, -2, "type");
+        lua_pushlstring(L, tlv.value.bytes, tlv.value.numBytes);
+        lua_setfield(L, -2, "value");
+        lua_rawseti(L, -2, i);
+    }
+}
+
+static int lhap_tlv8_encode_pcall(lua_State *L) {
+    HAPTLVWriterRef *writer = lua_touserdata(L, 2);
+    lua_pushinteger(L, lhap_tlv8_encode(L, 1, writer, 0));
+    return 1;
+}
+
+static int lhap_tlv8_decode_pcall(lua_State *L) {
+    lhap_tlv8_decode(L, lua_touserdata(L, 1));
+    return 1;
+}
+
+static lhap_read_request *lhap_read_request_alloc(lhap_desc *desc) {
+    lhap_read_request *request = desc->free_read_requests;
+    if (request) {
+        desc->free_read_requests = request->next;
+        desc->num_free_read_requests--;
+        return request;
+    }
+    return pal_mem_alloc(sizeof(*request));
+}
+
+static void lhap_read_request_free(lhap_desc *desc, lhap_read_request *request) {
+    if (desc->num_free_read_requests == LHAP_READ_REQUESTS_POOL_MAX) {
+        pal_mem_free(request);
+        return;
+    }
+    request->next = desc->free_read_requests;
+    desc->free_read_requests = request;
+    desc->num_free_read_requests++;
+}
+
+// Queue the read request to the accessory.
+static void lhap_enqueue_read_request(lhap_desc *desc, lhap_read_request *request) {
+    lhap_accessory_priv *acc = lhap_accessory_get_priv(request->accessory);
+    request->next = NULL;
+    *acc->reads_ptail = request;
+    acc->reads_ptail = &request->next;
+    if (!acc->queued) {
+        acc->queued = true;
+        acc->next = NULL;
+        *desc->read_accs_ptail = acc;
+        desc->read_accs_ptail = &acc->next;
+    }
+}
+
+// Get the first read request of the next accessory, the accessories take turns.
+static lhap_read_request *lhap_dequeue_read_request(lhap_desc *desc) {
+    lhap_accessory_priv *acc = desc->read_accs_head;
+    if (!acc) {
+        return NULL;
+    }
+    desc->read_accs_head = acc->next;
+    if (!desc->read_accs_head) {
+        desc->read_accs_ptail = &desc->read_accs_head;
+    }
+
+    lhap_read_request *request = acc->reads_head;
+    acc->reads_head = request->next;
+    if (acc->reads_head) {
+        acc->next = NULL;
+        *desc->read_accs_ptail = acc;
+        desc->read_accs_ptail = &acc->next;
+    } else {
+        acc->reads_ptail = &acc->reads_head;
+        acc->queued = false;
+    }
+    return request;
+}
+
 static void lhap_schedule_read_requests_cb(HAPPlatformTimerRef timer, void* context);
 
+// Handle the queued read requests from the run loop.
+static void lhap_schedule_read_requests(lhap_desc *desc) {
+    if (desc->read_requests_timer || !desc->read_accs_head) {
+        return;
+    }
+    if (HAPPlatformTimerRegister(
+            &desc->read_requests_timer,
+            HAPPlatformClockGetCurrent(),
+            lhap_schedule_read_requests_cb,
+            desc)) {
+        HAPLogError(&lhap_log, "%s: Failed to register schedule read requests timer.", __func__);
+        HAPFatalError();
+    }
+}
+
 int lhap_char_handle_read_finish(lua_State *L, int status, lua_KContext _ctx) {
     lhap_call_context *ctx = (lhap_call_context *)_ctx;
     lhap_desc *desc = ctx->desc;
@@ -1138,7 +1986,24 @@ int lhap_char_handle_read_finish(lua_State *L, int status, lua_KContext _ctx) {
     } else if (!lhap_char_value_is_valid(L, -1, format)) {
         err = kHAPError_InvalidData;
     }
+    lhap_char_priv *priv = lhap_char_get_priv(ctx->characteristic);
+    if (err == kHAPError_None) {
+        lhap_char_cache_set(L, -1, &priv->cache, ctx->cache_gen);
+    }
+    uint64_t now = 0;
+    lhap_char_latency *latency = ctx->start ? lhap_char_get_latency(ctx->characteristic) : NULL;
+    if (latency) {
+        now = pal_clock_get_us();
+        lhap_latency_hist_add(&latency->handler, now - ctx->start);
+        if (ctx->arrival) {
+            lhap_latency_hist_add(&latency->total, now - ctx->arrival);
+        }
+    }
+    if (ctx->refresh) {
+        priv->cache.refreshing = false;
+    }
     if (ctx->in_progress == false) {
+        lhap_request_release(L, desc, lc_container_of(ctx, lhap_request, ctx));
         lua_pushinteger(L, err);
         return 2;
     }
@@ -1149,29 +2014,47 @@ int lhap_char_handle_read_finish(lua_State *L, int status, lua_KContext _ctx) {
             err = kHAPError_InvalidData;
         }
     }
-    err = lhap_char_response_read_request(&desc->server, ctx->transportType, ctx->session,
-        ctx->accessory, ctx->service, ctx->characteristic, err, &val);
-    if (err != kHAPError_None) {
-        HAPLogError(&lhap_log, "%s: Failed to response read request, error code: %d.", __func__, err);
+    if (priv->read_ctx == ctx) {
+        priv->read_ctx = NULL;
     }
-    desc->num_read_requests--;
-    if (desc->num_read_requests == 0) {
-        if (HAPPlatformTimerRegister(
-                &ctx->desc->read_requests_timer,
-                HAPPlatformClockGetCurrent(),
-                lhap_schedule_read_requests_cb,
-                desc)) {
-            HAPLogError(&lhap_log, "%s: Failed to register schedule read requests timer.", __func__);
-            HAPFatalError();
+    HAPError read_err = err;
+    if (!ctx->refresh && format != kHAPCharacteristicFormat_TLV8) {
+        err = lhap_char_response_read_request(&desc->server, ctx->transportType, ctx->session,
+            ctx->accessory, ctx->service, ctx->characteristic, read_err, &val);
+        if (err != kHAPError_None) {
+            HAPLogError(&lhap_log, "%s: Failed to response read request, error code: %d.", __func__, err);
+        }
+    }
+
+    // answer the coalesced reads with the same result
+    while (ctx->readers) {
+        lhap_read_request *request = ctx->readers;
+        ctx->readers = request->next;
+        HAPError rerr = lhap_char_response_read_request(&desc->server, request->transportType,
+            request->session, request->accessory, request->service, request->characteristic,
+            read_err, &val);
+        if (latency && request->arrival) {
+            lhap_latency_hist_add(&latency->total, now - request->arrival);
+        }
+        if (rerr != kHAPError_None) {
+            HAPLogError(&lhap_log, "%s: Failed to response read request, error code: %d.", __func__, rerr);
         }
+        lhap_read_request_free(desc, request);
     }
+
+    lhap_request_release(L, desc, lc_container_of(ctx, lhap_request, ctx));
+
+    // the slot is free, handle the next queued read
+    desc->num_read_requests--;
+    lhap_schedule_read_requests(desc);
     lua_pushinteger(L, err);
     return 1;
 }
 
 static int lhap_char_handle_read(lua_State *L) {
-    // stack: <call_ctx, traceback, func, request>
-    lua_KContext call_ctx = (lua_KContext)lua_touserdata(L, 1);
+    // stack: <request, traceback, func, request>
+    lhap_request *request = lua_touserdata(L, 1);
+    lua_KContext call_ctx = (lua_KContext)&request->ctx;
     int status = lua_pcallk(L, 1, 1, 2, call_ctx, lhap_char_handle_read_finish);
     return lhap_char_handle_read_finish(L, status, call_ctx);
 }
@@ -1181,29 +2064,39 @@ static int lhap_char_handle_read_pcall(lua_State *L) {
     const void *pfunc = lua_touserdata(L, 2);
     lua_pop(L, 2);
 
+    lhap_char_priv *priv = lhap_char_get_priv(_call_ctx->characteristic);
     lua_State *co = lc_newthread(L);
+    lc_setowner(co, priv->owner);
     lua_pushcfunction(co, lhap_char_handle_read);
-    lhap_call_context *call_ctx = lua_newuserdata(co, sizeof(*call_ctx));
-    *call_ctx = *_call_ctx;
+    lhap_request *request = lhap_request_push(co, _call_ctx);
+    lhap_call_context *call_ctx = &request->ctx;
 
     lc_pushtraceback(co);
 
     // push the function
     HAPAssert(lua_rawgetp(co, LUA_REGISTRYINDEX, pfunc) == LUA_TFUNCTION);
 
-    // push the table request
-    lhap_create_request_table(co, call_ctx->transportType, call_ctx->session, NULL,
-        call_ctx->accessory, call_ctx->service, call_ctx->characteristic);
+    // push the request
+    lua_pushvalue(co, 2);
 
     int status, nres;
     status = lc_resume(co, L, 4, &nres);
     switch (status) {
     case LUA_OK:
+        priv->fast = true;
         return nres;
-    case LUA_YIELD:
+    case LUA_YIELD: {
+        priv->fast = false;
         call_ctx->in_progress = true;
+        if (priv->coalesce_reads) {
+            priv->read_ctx = call_ctx;
+        }
+        if (call_ctx->refresh) {
+            priv->cache.refreshing = true;
+        }
         lua_pushinteger(L, kHAPError_InProgress);
         return 1;
+    }
     default:
         return lua_error(L);
     }
@@ -1212,6 +2105,8 @@ static int lhap_char_handle_read_pcall(lua_State *L) {
 static HAP_RESULT_USE_CHECK
 HAPError lhap_char_raw_handleRead(
         bool in_progress,
+        bool refresh,
+        uint64_t arrival,
         lhap_desc *desc,
         HAPTransportType transportType,
         HAPSessionRef *session,
@@ -1232,6 +2127,11 @@ HAPError lhap_char_raw_handleRead(
         .accessory = accessory,
         .service = service,
         .characteristic = characteristic,
+        .readers = NULL,
+        .refresh = refresh,
+        .cache_gen = lhap_char_get_priv(characteristic)->cache.gen,
+        .arrival = arrival,
+        .start = lhap_latency_now(),
     };
 
     lua_pushcfunction(L, lhap_char_handle_read_pcall);
@@ -1254,15 +2154,46 @@ HAPError lhap_char_raw_handleRead(
 
 static void lhap_schedule_read_requests_cb(HAPPlatformTimerRef timer, void* context) {
     lhap_desc *desc = context;
+    desc->read_requests_timer = 0;
 
-    while (desc->read_requests_ptail != &desc->read_requests_head) {
-        lhap_read_request *request = desc->read_requests_head;
-        desc->read_requests_head = request->next;
-        if (desc->read_requests_head == NULL) {
-            desc->read_requests_ptail = &desc->read_requests_head;
+    while (desc->num_read_requests < desc->max_read_requests) {
+        lhap_read_request *request = lhap_dequeue_read_request(desc);
+        if (!request) {
+            break;
+        }
+        if (request->arrival) {
+            lhap_char_latency *latency = lhap_char_get_latency(request->characteristic);
+            if (latency) {
+                lhap_latency_hist_add(&latency->queue, pal_clock_get_us() - request->arrival);
+            }
         }
-        HAPError err = lhap_char_raw_handleRead(true, desc, request->transportType, request->session,
-            request->accessory, request->service, request->characteristic, request->pfunc);
+        lhap_char_priv *priv = lhap_char_get_priv(request->characteristic);
+        // the value may be cached by a read finished while the request was queued
+        bool fresh;
+        if (priv->cache.ttl && lhap_char_cache_check(&priv->cache, &fresh) && fresh) {
+            gv_lhap_cache_stats.hits++;
+            lua_State *L = desc->mL;
+            lua_rawgetp(L, LUA_REGISTRYINDEX, &priv->cache);
+            union lhap_char_value val;
+            HAPError err = lhap_char_value_get(L, -1, request->characteristic->format, &val) ?
+                kHAPError_None : kHAPError_InvalidData;
+            err = lhap_char_response_read_request(&desc->server, request->transportType, request->session,
+                request->accessory, request->service, request->characteristic, err, &val);
+            if (err != kHAPError_None) {
+                HAPLogError(&lhap_log, "%s: Failed to response read request, error code: %d.", __func__, err);
+            }
+            lhap_read_request_free(desc, request);
+            lua_settop(L, 0);
+            continue;
+        }
+        lhap_call_context *read_ctx = priv->read_ctx;
+        if (read_ctx) {
+            request->next = read_ctx->readers;
+            read_ctx->readers = request;
+            continue;
+        }
+        HAPError err = lhap_char_raw_handleRead(true, false, request->arrival, desc, request->transportType,
+            request->session, request->accessory, request->service, request->characteristic, request->pfunc);
         if (err != kHAPError_None && err != kHAPError_InProgress) {
             HAPLogError(&lhap_log, "%s: Failed to handle read request, error code: %d.", __func__, err);
             err = lhap_char_response_read_request(&desc->server, request->transportType, request->session,
@@ -1271,7 +2202,7 @@ static void lhap_schedule_read_requests_cb(HAPPlatformTimerRef timer, void* cont
                 HAPLogError(&lhap_log, "%s: Failed to response read request, error code: %d.", __func__, err);
             }
         }
-        pal_mem_free(request);
+        lhap_read_request_free(desc, request);
         lua_settop(desc->mL, 0);
         lc_collectgarbage(desc->mL);
     }
@@ -1290,8 +2221,42 @@ HAPError lhap_char_base_handleRead(
     lua_State *L = desc->mL;
     HAPAssert(lua_gettop(L) == 0);
 
-    if (desc->num_read_requests == desc->max_read_requests) {
-        lhap_read_request *request = pal_mem_alloc(sizeof(*request));
+    uint64_t arrival = lhap_latency_now();
+    lhap_char_priv *priv = lhap_char_get_priv(characteristic);
+    if (priv->cache.ttl) {
+        bool fresh;
+        if (lhap_char_cache_check(&priv->cache, &fresh)) {
+            if (fresh) {
+                gv_lhap_cache_stats.hits++;
+            } else {
+                // answer the stale value, and refresh it in the background
+                gv_lhap_cache_stats.stale++;
+                if (!priv->cache.refreshing && !priv->read_ctx &&
+                    desc->num_read_requests < desc->max_read_requests) {
+                    HAPError err = lhap_char_raw_handleRead(false, true, 0, desc, transportType,
+                        session, accessory, service, characteristic, pfunc);
+                    if (err != kHAPError_None && err != kHAPError_InProgress) {
+                        HAPLogError(&lhap_log, "%s: Failed to refresh the cache, error code: %d.", __func__, err);
+                    }
+                    lua_settop(L, 0);
+                }
+            }
+            lua_rawgetp(L, LUA_REGISTRYINDEX, &priv->cache);
+            lua_pushinteger(L, kHAPError_None);
+            return kHAPError_None;
+        }
+        gv_lhap_cache_stats.misses++;
+    }
+
+    // TLV8 values are written to the response writer of the request, the reads can not wait
+    bool can_wait = characteristic->format != kHAPCharacteristicFormat_TLV8;
+
+    // a read of the characteristic is in flight, wait for its result
+    lhap_call_context *read_ctx = can_wait ? priv->read_ctx : NULL;
+
+    // the characteristics answering without waiting bypass the queues
+    if (can_wait && (read_ctx || (desc->num_read_requests >= desc->max_read_requests && !priv->fast))) {
+        lhap_read_request *request = lhap_read_request_alloc(desc);
         if (!request) {
             return kHAPError_OutOfResources;
         }
@@ -1302,13 +2267,17 @@ HAPError lhap_char_base_handleRead(
         request->service = service,
         request->characteristic = characteristic;
         request->pfunc = pfunc;
-        request->next = NULL;
-        *(desc->read_requests_ptail) = request;
-        desc->read_requests_ptail = &request->next;
+        request->arrival = arrival;
+        if (read_ctx) {
+            request->next = read_ctx->readers;
+            read_ctx->readers = request;
+        } else {
+            lhap_enqueue_read_request(desc, request);
+        }
         return kHAPError_InProgress;
     }
 
-    return lhap_char_raw_handleRead(false, desc, transportType,
+    return lhap_char_raw_handleRead(false, false, arrival, desc, transportType,
         session, accessory, service, characteristic, pfunc);
 }
 
@@ -1491,12 +2460,29 @@ HAPError lhap_char_TLV8_handleRead(
         (const HAPBaseCharacteristic *)request->characteristic,
         &request->characteristic->callbacks.handleRead);
 
+    if (err == kHAPError_InProgress) {
+        HAPLogError(&lhap_log, "%s: The read callback of a TLV8 characteristic can not wait, "
+            "enable the cache to answer the reads from it.", __func__);
+        err = kHAPError_Busy;
+        goto end;
+    }
     if (err != kHAPError_None) {
         goto end;
     }
 
-    // TODO(Zebin Wu): Implement TLV8 in lua.
-    HAPFatalError();
+    // encode the value straight to the response
+    lua_pushcfunction(L, lhap_tlv8_encode_pcall);
+    lua_pushvalue(L, -3);
+    lua_pushlightuserdata(L, responseWriter);
+    if (lua_pcall(L, 2, 1, 0) != LUA_OK) {
+        HAPLogError(&lhap_log, "%s: %s", __func__, lua_tostring(L, -1));
+        err = kHAPError_InvalidData;
+        goto end;
+    }
+    err = lua_tointeger(L, -1);
+    if (err != kHAPError_None) {
+        HAPLogError(&lhap_log, "%s: value too long", __func__);
+    }
 
 end:
     lua_settop(L, 0);
@@ -1511,21 +2497,34 @@ int lhap_char_handle_write_finish(lua_State *L, int status, lua_KContext _ctx) {
         HAPLogError(&lhap_log, "%s: %s", __func__, lua_tostring(L, -1));
         err = kHAPError_Unknown;
     }
+    lhap_char_latency *latency = ctx->start ? lhap_char_get_latency(ctx->characteristic) : NULL;
+    if (latency) {
+        uint64_t elapsed = pal_clock_get_us() - ctx->start;
+        lhap_latency_hist_add(&latency->handler, elapsed);
+        lhap_latency_hist_add(&latency->total, elapsed);
+    }
     if (ctx->in_progress == false) {
+        lhap_request_release(L, ctx->desc, lc_container_of(ctx, lhap_request, ctx));
         lua_pushinteger(L, err);
         return 1;
     }
-    err = HAPCharacteristicResponseWriteRequest(&ctx->desc->server, ctx->transportType,
-        ctx->session, ctx->accessory, ctx->service, ctx->characteristic, err);
+    if (luai_unlikely(lhap_dispatch_respond(ctx->session, ctx->characteristic))) {
+        err = kHAPError_None;
+    } else {
+        err = HAPCharacteristicResponseWriteRequest(&ctx->desc->server, ctx->transportType,
+            ctx->session, ctx->accessory, ctx->service, ctx->characteristic, err);
+    }
     if (err != kHAPError_None) {
         HAPLogError(&lhap_log, "%s: Failed to response write request, error code: %d.", __func__, err);
     }
+    lhap_request_release(L, ctx->desc, lc_container_of(ctx, lhap_request, ctx));
     return 0;
 }
 
 static int lhap_char_handle_write(lua_State *L) {
-    // stack: <call_ctx, traceback, func, request, value>
-    lua_KContext call_ctx = (lua_KContext)lua_touserdata(L, 1);
+    // stack: <request, traceback, func, request, value>
+    lhap_request *request = lua_touserdata(L, 1);
+    lua_KContext call_ctx = (lua_KContext)&request->ctx;
     int status = lua_pcallk(L, 2, 0, 2, call_ctx, lhap_char_handle_write_finish);
     return lhap_char_handle_write_finish(L, status, call_ctx);
 }
@@ -1537,14 +2536,16 @@ static int lhap_char_handle_write_pcall(lua_State *L) {
     lua_pop(L, 3);
 
     lua_State *co = lc_newthread(L);
+    lc_setowner(co, lhap_char_get_priv(_call_ctx->characteristic)->owner);
     lua_pushcfunction(co, lhap_char_handle_write);
-    lhap_call_context *call_ctx = lua_newuserdata(co, sizeof(*call_ctx));
-    *call_ctx = *_call_ctx;
+    lhap_request *request = lhap_request_push(co, _call_ctx);
+    lhap_call_context *call_ctx = &request->ctx;
+    request->has_remote = true;
+    request->remote = remote;
 
     lc_pushtraceback(co);
     HAPAssert(lua_rawgetp(co, LUA_REGISTRYINDEX, pfunc) == LUA_TFUNCTION);
-    lhap_create_request_table(co, call_ctx->transportType, call_ctx->session, &remote,
-        call_ctx->accessory, call_ctx->service, call_ctx->characteristic);
+    lua_pushvalue(co, 2);
 
     lua_pushvalue(L, 1);
     lua_xmove(L, co, 1);
@@ -1578,6 +2579,9 @@ HAPError lhap_char_base_handleWrite(
         const void *pfunc) {
     lua_State *L = desc->mL;
 
+    lhap_char_cache_invalidate(&lhap_char_get_priv(characteristic)->cache);
+
+    uint64_t now = lhap_latency_now();
     lhap_call_context call_ctx = {
         .in_progress = false,
         .transportType = transportType,
@@ -1586,6 +2590,8 @@ HAPError lhap_char_base_handleWrite(
         .accessory = accessory,
         .service = service,
         .characteristic = characteristic,
+        .arrival = now,
+        .start = now,
     };
 
     lua_pushcfunction(L, lhap_char_handle_write_pcall);
@@ -1732,9 +2738,14 @@ HAPError lhap_char_TLV8_handleWrite(
     lua_State *L = ((lhap_desc *)context)->mL;
     HAPAssert(lua_gettop(L) == 0);
 
-    // TODO(Zebin Wu): Implement TLV8 in lua.
-    HAPFatalError();
-
+    // decode the request to the items
+    lua_pushcfunction(L, lhap_tlv8_decode_pcall);
+    lua_pushlightuserdata(L, requestReader);
+    if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+        HAPLogError(&lhap_log, "%s: %s", __func__, lua_tostring(L, -1));
+        lua_settop(L, 0);
+        return kHAPError_InvalidData;
+    }
     return lhap_char_base_handleWrite(context, server, request->transportType,
         request->session, request->remote, request->accessory, request->service,
         (const HAPBaseCharacteristic *)request->characteristic,
@@ -1748,28 +2759,66 @@ LHAP_CASE_CHAR_FORMAT_CODE(format, ptr, \
     lua_rawsetp(L, LUA_REGISTRYINDEX, &p->callbacks.cb); \
     p->callbacks.cb = lhap_char_ ## format ## _ ## cb)
 
+static int lhap_accessory_handle_identify_finish(lua_State *L, int status, lua_KContext _ctx) {
+    lhap_call_context *ctx = (lhap_call_context *)_ctx;
+    HAPError err = kHAPError_None;
+    if (status != LUA_OK && status != LUA_YIELD) {
+        HAPLogError(&lhap_log, "%s: %s", __func__, lua_tostring(L, -1));
+        err = kHAPError_Unknown;
+    }
+    lhap_request_release(L, ctx->desc, lc_container_of(ctx, lhap_request, ctx));
+    lua_pushinteger(L, err);
+    return 1;
+}
+
+static int lhap_accessory_handle_identify(lua_State *L) {
+    // stack: <request, traceback, func, request>
+    lhap_request *request = lua_touserdata(L, 1);
+    lua_KContext ctx = (lua_KContext)&request->ctx;
+    int status = lua_pcallk(L, 1, 0, 2, ctx, lhap_accessory_handle_identify_finish);
+    return lhap_accessory_handle_identify_finish(L, status, ctx);
+}
+
 static int lhap_accessory_pcall_identify(lua_State *L) {
-    const HAPAccessoryIdentifyRequest *request = lua_touserdata(L, 1);
-    lua_pop(L, 1);
+    const HAPAccessoryIdentifyRequest *_request = lua_touserdata(L, 1);
+    lhap_desc *desc = lua_touserdata(L, 2);
+    lua_pop(L, 2);
 
     lua_State *co = lc_newthread(L);
-    const HAPAccessory *accessory = request->accessory;
+    const HAPAccessory *accessory = _request->accessory;
+    lc_setowner(co, lhap_accessory_get_priv(accessory)->owner);
+    lua_pushcfunction(co, lhap_accessory_handle_identify);
+    lhap_call_context ctx = {
+        .transportType = _request->transportType,
+        .desc = desc,
+        .session = _request->session,
+        .accessory = accessory,
+    };
+    lhap_request *request = lhap_request_push(co, &ctx);
+    request->has_remote = true;
+    request->remote = _request->remote;
+
+    lc_pushtraceback(co);
 
     // push the identify function
     HAPAssert(lua_rawgetp(co, LUA_REGISTRYINDEX,
         &(accessory->callbacks.identify)) == LUA_TFUNCTION);
 
-    // push the table request
-    lhap_create_request_table(co, request->transportType,
-        request->session, &request->remote, accessory, NULL, NULL);
+    // push the request
+    lua_pushvalue(co, 2);
 
     int status, nres;
-    status = lc_resume(co, L, 1, &nres);
-    if (luai_unlikely(status != LUA_OK && status != LUA_YIELD)) {
-        lua_error(L);
+    status = lc_resume(co, L, 4, &nres);
+    switch (status) {
+    case LUA_OK:
+        HAPAssert(nres == 1);
+        return 1;
+    case LUA_YIELD:
+        lua_pushinteger(L, kHAPError_None);
+        return 1;
+    default:
+        return lua_error(L);
     }
-
-    return 0;
 }
 
 static HAP_RESULT_USE_CHECK
@@ -1786,15 +2835,18 @@ HAPError lhap_accessory_on_identify(
 
     lua_pushcfunction(L, lhap_accessory_pcall_identify);
     lua_pushlightuserdata(L, (void *)request);
-    int status = lua_pcall(L, 1, 0, 0);
+    lua_pushlightuserdata(L, context);
+    int status = lua_pcall(L, 2, 1, 0);
     if (luai_unlikely(status != LUA_OK)) {
         HAPLogError(&lhap_log, "%s: %s", __func__, lua_tostring(L, -1));
         return kHAPError_Unknown;
     }
+    HAPAssert(lua_isinteger(L, -1));
+    HAPError err = lua_tointeger(L, -1);
 
     lua_settop(L, 0);
     lc_collectgarbage(L);
-    return kHAPError_None;
+    return err;
 }
 
 static int lhap_server_handle_session_pcall(lua_State *L) {
@@ -1826,6 +2878,11 @@ static void lhap_server_handle_session_accept(
 
     HAPAssert(lua_gettop(L) == 0);
 
+    lhap_ip_storage_set_active(session, true);
+    if (!desc->has_session_accept_cb) {
+        return;
+    }
+
     lua_pushcfunction(L, lhap_server_handle_session_pcall);
     lua_pushlightuserdata(L, session);
     lua_pushlightuserdata(L, &desc->server_cbs.handleSessionAccept);
@@ -1851,6 +2908,11 @@ static void lhap_server_handle_session_invalid(
 
     HAPAssert(lua_gettop(L) == 0);
 
+    lhap_ip_storage_set_active(session, false);
+    if (!desc->has_session_invalid_cb) {
+        return;
+    }
+
     lua_pushcfunction(L, lhap_server_handle_session_pcall);
     lua_pushlightuserdata(L, session);
     lua_pushlightuserdata(L, &desc->server_cbs.handleSessionInvalidate);
@@ -1896,6 +2958,34 @@ lhap_count_attr(const HAPAccessory *acc, size_t *attr, size_t *readable, size_t
     }
 }
 
+// Count the contexts and the event notifications needed by a session.
+static void lhap_count_server_attr(const HAPAccessory *primary, HAPAccessory * const *bridged,
+    size_t *num_contexts, size_t *num_notify) {
+    size_t num_attr = LHAP_ATTR_CNT_DFT;
+    size_t num_readable = LHAP_CHAR_READ_CNT_DFT;
+    size_t num_writable = LHAP_CHAR_WRITE_CNT_DFT;
+    *num_notify = LHAP_CHAR_NOTIFY_CNT_DFT;
+
+    lhap_count_attr(primary, &num_attr, &num_readable, &num_writable, num_notify);
+
+    if (bridged) {
+        for (HAPAccessory * const *pacc = bridged; *pacc; pacc++) {
+            lhap_count_attr(*pacc, &num_attr, &num_readable, &num_writable, num_notify);
+        }
+    }
+
+    if (num_readable == 0) {
+        num_readable = 1;
+    }
+    if (num_writable == 0) {
+        num_writable = 1;
+    }
+    if (*num_notify == 0) {
+        *num_notify = 1;
+    }
+    *num_contexts = HAPMax(num_readable, num_writable);
+}
+
 static void lhap_server_handle_update_state(HAPAccessoryServerRef *server, void *_Nullable context) {
     HAPPrecondition(context);
     HAPPrecondition(server);
@@ -1945,8 +3035,17 @@ static int lhap_new_accessory(lua_State *L) {
     luaL_argcheck(L, nservices, 9, "empty services");
     bool has_identify = lhap_optfunction(L, 10);
 
-    HAPAccessory *accessory = lua_newuserdatauv(L, sizeof(HAPAccessory), 7);
+    HAPAccessory *accessory = lua_newuserdatauv(L,
+        LHAP_ALIGN(sizeof(HAPAccessory)) + sizeof(lhap_accessory_priv), 7);
     luaL_setmetatable(L, LHAP_ACCESSORY_NAME);
+    lhap_accessory_priv *priv = lhap_accessory_get_priv(accessory);
+    priv->owner = mempool_getcurrent();
+    priv->queued = false;
+    priv->next = NULL;
+    priv->reads_head = NULL;
+    priv->reads_ptail = &priv->reads_head;
+    priv->num_requests = 0;
+    priv->retired = false;
     for (size_t i = 3, j = 1; i <= 8; i++, j++) {
         lua_pushvalue(L, i);
         lua_setiuservalue(L, -2, j);
@@ -1993,16 +3092,44 @@ static int lhap_accessory_gc(lua_State *L) {
     return 0;
 }
 
-static const lhap_service_type *lhap_get_service_type(const char *s) {
-    for (int i = 0; i < HAPArrayCount(lhap_service_type_tab);
-        i++) {
-        if (HAPStringAreEqual(s, lhap_service_type_tab[i].name)) {
-            return lhap_service_type_tab + i;
+/**
+ * Binary search in a table sorted by name, the name must be
+ * the first member of the element.
+ */
+static const void *lhap_search_name(const void *tab, size_t n, size_t size, const char *s) {
+    size_t lo = 0;
+    size_t hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const void *elem = (const char *)tab + mid * size;
+        int cmp = strcmp(s, *(const char * const *)elem);
+        if (cmp == 0) {
+            return elem;
+        } else if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
         }
     }
     return NULL;
 }
 
+static bool lhap_name_tab_is_sorted(const void *tab, size_t n, size_t size) {
+    for (size_t i = 1; i < n; i++) {
+        const char *prev = *(const char * const *)((const char *)tab + (i - 1) * size);
+        const char *cur = *(const char * const *)((const char *)tab + i * size);
+        if (strcmp(prev, cur) >= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const lhap_service_type *lhap_get_service_type(const char *s) {
+    return lhap_search_name(lhap_service_type_tab, HAPArrayCount(lhap_service_type_tab),
+        sizeof(lhap_service_type_tab[0]), s);
+}
+
 static int lhap_new_service(lua_State *L) {
     uint64_t iid = luaL_checkinteger(L, 1);
     const lhap_service_type *type = lhap_get_service_type(luaL_checkstring(L, 2));
@@ -2068,13 +3195,8 @@ static int lhap_service_link_services(lua_State *L) {
 }
 
 static const lhap_characteristic_type *lhap_get_char_type(const char *s) {
-    for (int i = 0; i < HAPArrayCount(lhap_characteristic_type_tab);
-        i++) {
-        if (HAPStringAreEqual(s, lhap_characteristic_type_tab[i].name)) {
-            return lhap_characteristic_type_tab + i;
-        }
-    }
-    return NULL;
+    return lhap_search_name(lhap_characteristic_type_tab, HAPArrayCount(lhap_characteristic_type_tab),
+        sizeof(lhap_characteristic_type_tab[0]), s);
 }
 
 static int lhap_new_char(lua_State *L) {
@@ -2085,13 +3207,26 @@ static int lhap_new_char(lua_State *L) {
     luaL_checktype(L, 4, LUA_TTABLE);
     bool has_read = lhap_optfunction(L, 5);
     bool has_write = lhap_optfunction(L, 6);
+    bool has_cache = !lua_isnoneornil(L, 9);
+    if (has_cache) {
+        luaL_checktype(L, 9, LUA_TTABLE);
+    }
+    lua_settop(L, 9);
 
     HAPBaseCharacteristic *characteristic = lua_newuserdatauv(L,
-        lhap_characteristic_struct_size[format], format == kHAPCharacteristicFormat_UInt8 ? 3 : 1);
+        LHAP_ALIGN(lhap_characteristic_struct_size[format]) + sizeof(lhap_char_priv),
+        format == kHAPCharacteristicFormat_UInt8 ? 3 : 1);
     luaL_setmetatable(L, LHAP_CHARACTERISTIC_NAME);
     HAPRawBufferZero(characteristic, lhap_characteristic_struct_size[format]);
     characteristic->iid = iid;
     characteristic->format = format;
+    lhap_char_priv *priv = lhap_char_get_priv(characteristic);
+    priv->owner = mempool_getcurrent();
+    priv->coalesce_reads = true;
+    priv->fast = false;
+    priv->read_ctx = NULL;
+    priv->latency = NULL;
+    HAPRawBufferZero(&priv->cache, sizeof(priv->cache));
     characteristic->characteristicType = type->type;
     characteristic->debugDescription = type->debugDescription;
     lc_traverse_table(L, 4, lhap_char_props_kvs, &characteristic->properties);
@@ -2136,6 +3271,15 @@ static int lhap_new_char(lua_State *L) {
 #undef LHAP_CASE_CHAR_REGISTER_READ_CB
     }
 
+    if (has_cache) {
+        if (luai_unlikely(!lc_traverse_table(L, 9, lhap_char_cache_kvs, &priv->cache) ||
+            !priv->cache.ttl)) {
+            priv->cache.ttl = 0;
+            luaL_argerror(L, 9, "invalid cache");
+        }
+        gv_lhap_cache_stats.chars++;
+    }
+
     // TODO(Zebin Wu): Register sub/unsub callbacks.
     return 1;
 }
@@ -2166,6 +3310,15 @@ static int lhap_char_gc(lua_State *L) {
 
 #undef LHAP_RESET_CHAR_CBS
 
+    lhap_char_priv *priv = lhap_char_get_priv(characteristic);
+    if (priv->cache.ttl) {
+        lhap_rawsetp_reset(L, LUA_REGISTRYINDEX, &priv->cache);
+        gv_lhap_cache_stats.chars--;
+    }
+    if (priv->latency) {
+        pal_mem_free(priv->latency);
+        priv->latency = NULL;
+    }
     return 0;
 }
 
@@ -2200,6 +3353,14 @@ static int lhap_char_set_units(lua_State *L) {
     return 1;
 }
 
+static int lhap_char_set_coalesce_reads(lua_State *L) {
+    HAPBaseCharacteristic *characteristic = luaL_checkudata(L, 1, LHAP_CHARACTERISTIC_NAME);
+    luaL_checktype(L, 2, LUA_TBOOLEAN);
+    lhap_char_get_priv(characteristic)->coalesce_reads = lua_toboolean(L, 2);
+    lua_pop(L, 1);
+    return 1;
+}
+
 static int lhap_char_set_contraints(lua_State *L) {
     HAPBaseCharacteristic *characteristic = luaL_checkudata(L, 1, LHAP_CHARACTERISTIC_NAME);
     HAPCharacteristicFormat format = characteristic->format;
@@ -2361,19 +3522,22 @@ static int lhap_start(lua_State *L) {
     bool has_session_accept = lhap_optfunction(L, 4);
     bool has_session_invalid = lhap_optfunction(L, 5);
 
+    luaL_argcheck(L, desc->num_bridged_accs <= LHAP_BRIDGED_ACCS_MAX, 2, "too many bridged accessories");
     desc->bridged_accs = NULL;
-    if (desc->num_bridged_accs) {
-        desc->bridged_accs = lua_newuserdata(L, sizeof(HAPAccessory *) * (desc->num_bridged_accs + 1));
-        lua_pushvalue(L, 2);
-        lua_setuservalue(L, -2);
+    if (lua_istable(L, 2)) {
+        // reserve the slots for the accessories added by hap.updateBridgedAccessories()
+        desc->bridged_accs = lua_newuserdata(L, sizeof(HAPAccessory *) * (LHAP_BRIDGED_ACCS_MAX + 1));
+        // copy the accessories, the table may be changed after returning
+        lua_createtable(L, desc->num_bridged_accs, 0);
         for (size_t i = 1; i <= desc->num_bridged_accs; i++) {
             lua_geti(L, 2, i);
             desc->bridged_accs[i - 1] = luaL_checkudata(L, -1, LHAP_ACCESSORY_NAME);
             if (!HAPBridgedAccessoryIsValid(desc->bridged_accs[i - 1])) {
                 luaL_error(L, "bridgedAccessories[%d]: invalid definition", i);
             }
-            lua_pop(L, 1);
+            lua_rawseti(L, -2, i);
         }
+        lua_setuservalue(L, -2);
         desc->bridged_accs[desc->num_bridged_accs] = NULL;
         lua_rawsetp(L, LUA_REGISTRYINDEX, &desc->bridged_accs);
     }
@@ -2390,33 +3554,16 @@ static int lhap_start(lua_State *L) {
         lua_rawsetp(L, LUA_REGISTRYINDEX, &desc->server_cbs.handleSessionInvalidate);
     }
 
-    desc->server_cbs.handleSessionAccept = has_session_accept ? lhap_server_handle_session_accept : NULL;
-    desc->server_cbs.handleSessionInvalidate = has_session_invalid ? lhap_server_handle_session_invalid : NULL;
+    // the session callbacks also keep track of the session storage
+    desc->has_session_accept_cb = has_session_accept;
+    desc->has_session_invalid_cb = has_session_invalid;
+    desc->server_cbs.handleSessionAccept = lhap_server_handle_session_accept;
+    desc->server_cbs.handleSessionInvalidate = lhap_server_handle_session_invalid;
     desc->server_cbs.handleUpdatedState = lhap_server_handle_update_state;
 
-    size_t num_attr = LHAP_ATTR_CNT_DFT;
-    size_t num_readable = LHAP_CHAR_READ_CNT_DFT;
-    size_t num_writable = LHAP_CHAR_WRITE_CNT_DFT;
-    size_t num_notify = LHAP_CHAR_NOTIFY_CNT_DFT;
-
-    lhap_count_attr(desc->primary_acc, &num_attr, &num_readable, &num_writable, &num_notify);
-
-    if (desc->bridged_accs) {
-        for (const HAPAccessory * const *pacc =
-            (const HAPAccessory * const *)desc->bridged_accs; *pacc; pacc++) {
-            lhap_count_attr(*pacc, &num_attr, &num_readable, &num_writable, &num_notify);
-        }
-    }
-
-    if (num_readable == 0) {
-        num_readable = 1;
-    }
-    if (num_writable == 0) {
-        num_writable = 1;
-    }
-    if (num_notify == 0) {
-        num_notify = 1;
-    }
+    size_t num_contexts;
+    size_t num_notify;
+    lhap_count_server_attr(desc->primary_acc, desc->bridged_accs, &num_contexts, &num_notify);
 
     pal_hap_init_platform(&desc->platform);
 
@@ -2425,7 +3572,7 @@ static int lhap_start(lua_State *L) {
     HAPPlatformAccessorySetupLoadSetupCode(desc->platform.accessorySetup, &setupCode);
     HAPLog(&lhap_log, "Setup code: %s", setupCode.stringValue);
 
-    lhap_init_ip(&desc->server_options, HAPMax(num_readable, num_writable), num_notify);
+    lhap_init_ip(&desc->server_options, num_contexts, num_notify);
     desc->server_options.maxPairings = kHAPPairingStorage_MinElements;
 
     // Initialize accessory server.
@@ -2446,8 +3593,9 @@ static int lhap_start(lua_State *L) {
 
     desc->num_read_requests = 0;
     desc->max_read_requests = LHAP_READ_REQUESTS_MAX;
-    desc->read_requests_head = NULL;
-    desc->read_requests_ptail = &desc->read_requests_head;
+    desc->read_requests_timer = 0;
+    desc->read_accs_head = NULL;
+    desc->read_accs_ptail = &desc->read_accs_head;
 
     desc->mL = lc_getmainthread(L);
     desc->co = L;
@@ -2462,8 +3610,23 @@ static int lhap_stop_finish(lua_State *L, int status, lua_KContext extra) {
 
     lhap_deinit_ip(&desc->server_options);
 
+    if (desc->update_accs_timer) {
+        HAPPlatformTimerDeregister(desc->update_accs_timer);
+        desc->update_accs_timer = 0;
+    }
+
     lhap_rawsetp_reset(L, LUA_REGISTRYINDEX, &desc->primary_acc);
     lhap_rawsetp_reset(L, LUA_REGISTRYINDEX, &desc->bridged_accs);
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &lhap_retired_accs_key) == LUA_TTABLE) {
+        lua_pushnil(L);
+        while (lua_next(L, -2)) {
+            lhap_accessory_get_priv(lua_touserdata(L, -1))->retired = false;
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, 1);
+    lhap_rawsetp_reset(L, LUA_REGISTRYINDEX, &lhap_pending_accs_key);
+    lhap_rawsetp_reset(L, LUA_REGISTRYINDEX, &lhap_retired_accs_key);
 
     lhap_reset_server_cb(L, &desc->server_cbs);
     HAPRawBufferZero(&desc->server_cbs, sizeof(desc->server_cbs));
@@ -2473,6 +3636,8 @@ static int lhap_stop_finish(lua_State *L, int status, lua_KContext extra) {
     desc->primary_acc = NULL;
     desc->bridged_accs = NULL;
     desc->num_bridged_accs = 0;
+    desc->num_retired_accs = 0;
+    desc->has_pending_accs = false;
     desc->co = NULL;
     desc->mL = NULL;
     desc->started = false;
@@ -2493,6 +3658,241 @@ static int lhap_stop(lua_State *L) {
     return lua_yieldk(L, 0, (lua_KContext)desc, lhap_stop_finish);
 }
 
+// Answer the read requests with an error.
+static void lhap_read_requests_abort(lhap_desc *desc, lhap_read_request *request) {
+    while (request) {
+        lhap_read_request *next = request->next;
+        HAPError err = lhap_char_response_read_request(&desc->server, request->transportType,
+            request->session, request->accessory, request->service, request->characteristic,
+            kHAPError_Unknown, NULL);
+        if (err != kHAPError_None) {
+            HAPLogError(&lhap_log, "%s: Failed to response read request, error code: %d.", __func__, err);
+        }
+        lhap_read_request_free(desc, request);
+        request = next;
+    }
+}
+
+// Answer the queued and coalesced reads of the removed accessory.
+static void lhap_accessory_drain_reads(lhap_desc *desc, const HAPAccessory *accessory) {
+    lhap_accessory_priv *priv = lhap_accessory_get_priv(accessory);
+    if (priv->queued) {
+        for (lhap_accessory_priv **pacc = &desc->read_accs_head; *pacc; pacc = &(*pacc)->next) {
+            if (*pacc == priv) {
+                *pacc = priv->next;
+                if (desc->read_accs_ptail == &priv->next) {
+                    desc->read_accs_ptail = pacc;
+                }
+                break;
+            }
+        }
+        priv->queued = false;
+    }
+    lhap_read_request *queued = priv->reads_head;
+    priv->reads_head = NULL;
+    priv->reads_ptail = &priv->reads_head;
+    lhap_read_requests_abort(desc, queued);
+
+    for (const HAPService * const *pserv = accessory->services; *pserv; pserv++) {
+        const HAPService *serv = *pserv;
+        if (serv == &accessoryInformationService || serv == &pairingService ||
+            serv == &hapProtocolInformationService) {
+            continue;
+        }
+        for (const HAPBaseCharacteristic * const *pchar =
+            (const HAPBaseCharacteristic * const *)serv->characteristics; *pchar; pchar++) {
+            lhap_call_context *read_ctx = lhap_char_get_priv(*pchar)->read_ctx;
+            if (read_ctx) {
+                lhap_read_requests_abort(desc, read_ctx->readers);
+                read_ctx->readers = NULL;
+            }
+        }
+    }
+}
+
+// Move the pending bridged accessories to the bridged accessory array.
+static int lhap_apply_pending_accs(lua_State *L) {
+    lhap_desc *desc = lua_touserdata(L, 1);
+    lua_settop(L, 0);
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &lhap_pending_accs_key);  // pending
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &desc->bridged_accs);  // pending array
+    lua_getuservalue(L, 2);  // pending array old
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &lhap_retired_accs_key) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &lhap_retired_accs_key);
+    }  // pending array old retired
+
+    size_t num_new = lua_rawlen(L, 1);
+    lua_createtable(L, 0, num_new);  // pending array old retired kept
+    for (size_t i = 1; i <= num_new; i++) {
+        lua_rawgeti(L, 1, i);
+        HAPAccessory *accessory = lua_touserdata(L, -1);
+        lua_pop(L, 1);
+        lua_pushboolean(L, true);
+        lua_rawsetp(L, 5, accessory);
+        lhap_accessory_priv *priv = lhap_accessory_get_priv(accessory);
+        if (priv->retired) {
+            // added back before its requests are done
+            priv->retired = false;
+            desc->num_retired_accs--;
+            lua_pushnil(L);
+            lua_rawsetp(L, 4, accessory);
+        }
+    }
+
+    // The removed accessories are released when the requests passed to
+    // the callbacks are done, the waiting reads are answered now.
+    for (size_t i = 1; i <= desc->num_bridged_accs; i++) {
+        lua_rawgeti(L, 3, i);
+        HAPAccessory *accessory = lua_touserdata(L, -1);
+        if (lua_rawgetp(L, 5, accessory) == LUA_TNIL) {
+            lhap_accessory_drain_reads(desc, accessory);
+            lhap_accessory_priv *priv = lhap_accessory_get_priv(accessory);
+            if (priv->num_requests) {
+                priv->retired = true;
+                desc->num_retired_accs++;
+                lua_pushvalue(L, -2);
+                lua_rawsetp(L, 4, accessory);
+            }
+        }
+        lua_pop(L, 2);
+    }
+
+    for (size_t i = 1; i <= num_new; i++) {
+        lua_rawgeti(L, 1, i);
+        desc->bridged_accs[i - 1] = lua_touserdata(L, -1);
+        lua_pop(L, 1);
+    }
+    desc->bridged_accs[num_new] = NULL;
+    desc->num_bridged_accs = num_new;
+    lua_pushvalue(L, 1);
+    lua_setuservalue(L, 2);
+    return 0;
+}
+
+// Whether a session is sending the accessory database.
+static bool lhap_accessories_serializing(void) {
+    lhap_ip_storage *storage = &gv_lhap_ip_storage;
+    for (size_t i = 0; i < storage->server_storage.numSessions; i++) {
+        HAPIPSessionDescriptor *session =
+            (HAPIPSessionDescriptor *)&storage->server_storage.sessions[i].descriptor;
+        if (storage->slots[i].active && session->accessorySerializationIsInProgress) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Apply the pending bridged accessories from the run loop when no accessory database is being sent.
+static void lhap_update_accs_cb(HAPPlatformTimerRef timer, void *context) {
+    lhap_desc *desc = context;
+    lua_State *L = desc->mL;
+    desc->update_accs_timer = 0;
+    if (!desc->has_pending_accs) {
+        return;
+    }
+    HAPTime start = HAPPlatformClockGetCurrent();
+
+    // a GET /accessories response is sent in several rounds of the run loop
+    if (lhap_accessories_serializing()) {
+        if (HAPPlatformTimerRegister(&desc->update_accs_timer, start + LHAP_UPDATE_ACCS_RETRY_MS,
+            lhap_update_accs_cb, desc)) {
+            HAPLogError(&lhap_log, "%s: Failed to register update timer.", __func__);
+            HAPFatalError();
+        }
+        return;
+    }
+    size_t num_old = desc->num_bridged_accs;
+
+    HAPAssert(lua_gettop(L) == 0);
+    lua_pushcfunction(L, lhap_apply_pending_accs);
+    lua_pushlightuserdata(L, desc);
+    int status = lua_pcall(L, 1, 0, 0);
+    lhap_rawsetp_reset(L, LUA_REGISTRYINDEX, &lhap_pending_accs_key);
+    desc->has_pending_accs = false;
+    if (status != LUA_OK) {
+        HAPLogError(&lhap_log, "%s: %s", __func__, lua_tostring(L, -1));
+        lua_settop(L, 0);
+        return;
+    }
+
+#if LHAP_LAZY_SESSIONS
+    size_t num_contexts;
+    size_t num_notify;
+    lhap_count_server_attr(desc->primary_acc, desc->bridged_accs, &num_contexts, &num_notify);
+    lhap_ip_storage_grow(&gv_lhap_ip_storage, num_contexts, num_notify);
+#endif
+
+    // The controllers fetch the accessories again when the configuration number changes,
+    // the sessions are kept.
+    HAPError err = HAPAccessoryServerIncrementCN(desc->platform.keyValueStore);
+    if (err) {
+        HAPLogError(&lhap_log, "%s: Failed to increment configuration number, error code: %d.", __func__, err);
+    }
+    HAPIPServiceDiscoverySetHAPService(&desc->server);
+
+    HAPLog(&lhap_log, "Bridged accessories updated: %zu -> %zu, %zu retired, took %llu ms.",
+        num_old, desc->num_bridged_accs, desc->num_retired_accs,
+        (unsigned long long)(HAPPlatformClockGetCurrent() - start));
+    lua_settop(L, 0);
+    lc_collectgarbage(L);
+}
+
+static int lhap_update_bridged_accessories(lua_State *L) {
+    lhap_desc *desc = &gv_lhap_desc;
+    if (!desc->started) {
+        luaL_error(L, "HAP is not started.");
+    }
+    if (!desc->bridged_accs) {
+        luaL_error(L, "HAP is not started as a bridge.");
+    }
+    size_t num = lhap_checkarray(L, 1);
+    luaL_argcheck(L, num <= LHAP_BRIDGED_ACCS_MAX, 1, "too many bridged accessories");
+
+    // copy the accessories, the table may be changed after returning
+    HAPAccessory *accs[LHAP_BRIDGED_ACCS_MAX + 1];
+    lua_createtable(L, num, 0);
+    for (size_t i = 1; i <= num; i++) {
+        lua_geti(L, 1, i);
+        accs[i - 1] = luaL_checkudata(L, -1, LHAP_ACCESSORY_NAME);
+        if (!HAPBridgedAccessoryIsValid(accs[i - 1])) {
+            luaL_error(L, "bridgedAccessories[%d]: invalid definition", i);
+        }
+        if (accs[i - 1]->aid == desc->primary_acc->aid) {
+            luaL_error(L, "bridgedAccessories[%d]: duplicate aid %d", i, (int)accs[i - 1]->aid);
+        }
+        for (size_t j = 0; j < i - 1; j++) {
+            if (accs[j]->aid == accs[i - 1]->aid) {
+                luaL_error(L, "bridgedAccessories[%d]: duplicate aid %d", i, (int)accs[i - 1]->aid);
+            }
+        }
+        lua_rawseti(L, -2, i);
+    }
+    accs[num] = NULL;
+
+#if !LHAP_LAZY_SESSIONS
+    size_t num_contexts;
+    size_t num_notify;
+    lhap_count_server_attr(desc->primary_acc, accs, &num_contexts, &num_notify);
+    if (num_contexts > gv_lhap_ip_storage.num_contexts || num_notify > gv_lhap_ip_storage.num_notify) {
+        luaL_error(L, "the session storage is too small, restart the server to apply the accessories");
+    }
+#endif
+
+    // the last update wins if it is called again before applying
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &lhap_pending_accs_key);
+    desc->has_pending_accs = true;
+    if (!desc->update_accs_timer && HAPPlatformTimerRegister(&desc->update_accs_timer,
+        HAPPlatformClockGetCurrent(), lhap_update_accs_cb, desc)) {
+        lhap_rawsetp_reset(L, LUA_REGISTRYINDEX, &lhap_pending_accs_key);
+        desc->has_pending_accs = false;
+        luaL_error(L, "failed to register the update timer");
+    }
+    return 0;
+}
+
 static int lhap_at_exit(lua_State *L) {
     lhap_desc *desc = &gv_lhap_desc;
 
@@ -2502,6 +3902,61 @@ static int lhap_at_exit(lua_State *L) {
     return lhap_stop(L);
 }
 
+static const HAPAccessory *lhap_find_accessory(lhap_desc *desc, uint64_t aid) {
+    if (desc->primary_acc->aid == aid) {
+        return desc->primary_acc;
+    }
+    for (size_t i = 0; i < desc->num_bridged_accs; i++) {
+        if (desc->bridged_accs[i]->aid == aid) {
+            return desc->bridged_accs[i];
+        }
+    }
+    return NULL;
+}
+
+static inline bool lhap_service_is_builtin(const HAPService *service) {
+    return service == &accessoryInformationService || service == &pairingService ||
+        service == &hapProtocolInformationService;
+}
+
+// Find the service created by Lua with the instance ID.
+static const HAPService *lhap_find_service(const HAPAccessory *accessory, uint64_t iid) {
+    for (const HAPService * const *pserv = accessory->services; *pserv; pserv++) {
+        if ((*pserv)->iid == iid && !lhap_service_is_builtin(*pserv)) {
+            return *pserv;
+        }
+    }
+    return NULL;
+}
+
+static const HAPBaseCharacteristic *lhap_service_find_char(const HAPService *service, uint64_t iid) {
+    for (const HAPBaseCharacteristic * const *pchar =
+        (const HAPBaseCharacteristic * const *)service->characteristics; *pchar; pchar++) {
+        if ((*pchar)->iid == iid) {
+            return *pchar;
+        }
+    }
+    return NULL;
+}
+
+// Find the characteristic created by Lua with the instance ID.
+static const HAPBaseCharacteristic *lhap_find_char(lhap_desc *desc, uint64_t aid, uint64_t iid) {
+    const HAPAccessory *accessory = lhap_find_accessory(desc, aid);
+    if (!accessory) {
+        return NULL;
+    }
+    for (const HAPService * const *pserv = accessory->services; *pserv; pserv++) {
+        if (lhap_service_is_builtin(*pserv)) {
+            continue;
+        }
+        const HAPBaseCharacteristic *characteristic = lhap_service_find_char(*pserv, iid);
+        if (characteristic) {
+            return characteristic;
+        }
+    }
+    return NULL;
+}
+
 static int lhap_raise_event(lua_State *L) {
     HAPSessionRef *session = NULL;
     lhap_desc *desc = &gv_lhap_desc;
@@ -2518,10 +3973,362 @@ static int lhap_raise_event(lua_State *L) {
         session = lua_touserdata(L, 4);
     }
 
+    // the value is changed, read it again
+    if (gv_lhap_cache_stats.chars) {
+        const HAPBaseCharacteristic *characteristic = lhap_find_char(desc, aid, cid);
+        if (characteristic) {
+            lhap_char_cache_invalidate(&lhap_char_get_priv(characteristic)->cache);
+        }
+    }
+
     HAPAccessoryServerRaiseEventByIID(&desc->server, cid, sid, aid, session);
     return 0;
 }
 
+static void lhap_raise_char_event(lhap_desc *desc, const HAPAccessory *accessory,
+    const HAPService *service, const HAPBaseCharacteristic *characteristic, HAPSessionRef *session) {
+    lhap_char_cache_invalidate(&lhap_char_get_priv(characteristic)->cache);
+    if (session) {
+        HAPAccessoryServerRaiseEventOnSession(&desc->server, characteristic, service, accessory, session);
+    } else {
+        HAPAccessoryServerRaiseEvent(&desc->server, characteristic, service, accessory);
+    }
+}
+
+// Raise events of the characteristics supporting event notification in the service.
+static int lhap_raise_service_events(lhap_desc *desc, const HAPAccessory *accessory,
+    const HAPService *service, HAPSessionRef *session) {
+    int n = 0;
+    for (const HAPBaseCharacteristic * const *pchar =
+        (const HAPBaseCharacteristic * const *)service->characteristics; *pchar; pchar++) {
+        if ((*pchar)->properties.supportsEventNotification) {
+            lhap_raise_char_event(desc, accessory, service, *pchar, session);
+            n++;
+        }
+    }
+    return n;
+}
+
+static int lhap_raise_events(lua_State *L) {
+    HAPSessionRef *session = NULL;
+    lhap_desc *desc = &gv_lhap_desc;
+
+    if (!desc->started) {
+        luaL_error(L, "HAP is not started.");
+    }
+
+    const HAPAccessory *accessory = lhap_find_accessory(desc, luaL_checkinteger(L, 1));
+    luaL_argcheck(L, accessory, 1, "accessory not found");
+    const HAPService *service = NULL;
+    if (!lua_isnoneornil(L, 2)) {
+        service = lhap_find_service(accessory, luaL_checkinteger(L, 2));
+        luaL_argcheck(L, service, 2, "service not found");
+    }
+    if (!lua_isnoneornil(L, 3)) {
+        luaL_argcheck(L, service, 2, "service is required by the characteristics");
+        luaL_checktype(L, 3, LUA_TTABLE);
+    }
+    if (!lua_isnoneornil(L, 4)) {
+        luaL_checktype(L, 4, LUA_TLIGHTUSERDATA);
+        session = lua_touserdata(L, 4);
+    }
+
+    int n = 0;
+    if (!service) {
+        for (const HAPService * const *pserv = accessory->services; *pserv; pserv++) {
+            if (!lhap_service_is_builtin(*pserv)) {
+                n += lhap_raise_service_events(desc, accessory, *pserv, session);
+            }
+        }
+    } else if (lua_isnoneornil(L, 3)) {
+        n = lhap_raise_service_events(desc, accessory, service, session);
+    } else {
+        // find all characteristics before raising any event
+        lua_Integer len = luaL_len(L, 3);
+        luaL_argcheck(L, len >= 0 && (size_t)len <= SIZE_MAX / sizeof(HAPBaseCharacteristic *),
+            3, "invalid length");
+        const HAPBaseCharacteristic *stack_chars[16];
+        const HAPBaseCharacteristic **chars = (size_t)len <= HAPArrayCount(stack_chars) ? stack_chars :
+            lua_newuserdatauv(L, sizeof(*chars) * len, 0);
+        for (lua_Integer i = 1; i <= len; i++) {
+            lua_geti(L, 3, i);
+            int isnum;
+            lua_Integer iid = lua_tointegerx(L, -1, &isnum);
+            lua_pop(L, 1);
+            chars[i - 1] = isnum ? lhap_service_find_char(service, iid) : NULL;
+            if (luai_unlikely(!chars[i - 1])) {
+                luaL_error(L, "cids[%d]: characteristic not found", (int)i);
+            }
+        }
+        for (lua_Integer i = 0; i < len; i++) {
+            lhap_raise_char_event(desc, accessory, service, chars[i], session);
+        }
+        n = len;
+    }
+    lua_pushinteger(L, n);
+    return 1;
+}
+
+// Get the registry key of the read or write callback of the characteristic.
+static const void *lhap_char_get_cb_key(const HAPBaseCharacteristic *characteristic, bool write) {
+#define LHAP_CHAR_CB_KEY(type, ptr) \
+    LHAP_CASE_CHAR_FORMAT_CODE(type, ptr, \
+        return write ? (const void *)&p->callbacks.handleWrite : (const void *)&p->callbacks.handleRead; \
+    )
+
+    switch (characteristic->format) {
+    LHAP_CHAR_CB_KEY(Data, characteristic)
+    LHAP_CHAR_CB_KEY(Bool, characteristic)
+    LHAP_CHAR_CB_KEY(UInt8, characteristic)
+    LHAP_CHAR_CB_KEY(UInt16, characteristic)
+    LHAP_CHAR_CB_KEY(UInt32, characteristic)
+    LHAP_CHAR_CB_KEY(UInt64, characteristic)
+    LHAP_CHAR_CB_KEY(Int, characteristic)
+    LHAP_CHAR_CB_KEY(Float, characteristic)
+    LHAP_CHAR_CB_KEY(String, characteristic)
+    LHAP_CHAR_CB_KEY(TLV8, characteristic)
+    }
+
+#undef LHAP_CHAR_CB_KEY
+
+    HAPFatalError();
+}
+
+static void lhap_dispatch_cb(HAPPlatformTimerRef timer, void *context) {
+    lhap_dispatch *dispatch = context;
+    dispatch->timer = 0;
+    lhap_desc *desc = &gv_lhap_desc;
+    lua_State *L = desc->mL;
+    const void *pfunc = lhap_char_get_cb_key(dispatch->characteristic, dispatch->write);
+
+    const mempool_stats *stats = mempool_getstats();
+    dispatch->allocs = stats->allocs;
+    dispatch->allocated = stats->allocated;
+    dispatch->start = pal_clock_get_us();
+    for (lua_Integer i = 0; i < dispatch->n; i++) {
+        HAPError err;
+        if (dispatch->write) {
+            // the value is kept on the stack of the waiting coroutine
+            lua_pushvalue(dispatch->co, 5);
+            lua_xmove(dispatch->co, L, 1);
+            err = lhap_char_base_handleWrite(desc, &desc->server, kHAPTransportType_IP,
+                LHAP_DISPATCH_SESSION, false, dispatch->accessory, dispatch->service,
+                dispatch->characteristic, pfunc);
+        } else {
+            err = lhap_char_base_handleRead(desc, &desc->server, kHAPTransportType_IP,
+                LHAP_DISPATCH_SESSION, dispatch->accessory, dispatch->service,
+                dispatch->characteristic, pfunc);
+            lua_settop(L, 0);
+            lc_collectgarbage(L);
+        }
+        // the requests in progress are counted when they are answered
+        if (err != kHAPError_InProgress) {
+            lhap_dispatch_answered(dispatch);
+        }
+    }
+}
+
+static void lhap_dispatch_cancel(lc_pending *pending) {
+    lhap_dispatch *dispatch = lc_container_of(pending, lhap_dispatch, pending);
+    if (dispatch->timer) {
+        HAPPlatformTimerDeregister(dispatch->timer);
+        dispatch->timer = 0;
+    }
+    lhap_dispatch_unlink(dispatch);
+}
+
+static int lhap_bench_dispatch(lua_State *L) {
+    lhap_desc *desc = &gv_lhap_desc;
+
+    if (!desc->started) {
+        luaL_error(L, "HAP is not started.");
+    }
+    const HAPAccessory *accessory = lhap_find_accessory(desc, luaL_checkinteger(L, 1));
+    luaL_argcheck(L, accessory, 1, "accessory not found");
+    const HAPService *service = lhap_find_service(accessory, luaL_checkinteger(L, 2));
+    luaL_argcheck(L, service, 2, "service not found");
+    const HAPBaseCharacteristic *characteristic = lhap_service_find_char(service, luaL_checkinteger(L, 3));
+    luaL_argcheck(L, characteristic, 3, "characteristic not found");
+    lua_Integer n = luaL_checkinteger(L, 4);
+    luaL_argcheck(L, n > 0, 4, "must be greater than 0");
+    bool write = !lua_isnoneornil(L, 5);
+    lua_settop(L, 5);
+
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, lhap_char_get_cb_key(characteristic, write)) != LUA_TFUNCTION) {
+        luaL_error(L, "characteristic has no %s callback", write ? "write" : "read");
+    }
+    lua_pop(L, 1);
+    for (lhap_dispatch *dispatch = gv_lhap_dispatches; dispatch; dispatch = dispatch->next) {
+        if (dispatch->characteristic == characteristic) {
+            luaL_error(L, "characteristic is being dispatched");
+        }
+    }
+
+    lhap_dispatch *dispatch = lua_newuserdatauv(L, sizeof(*dispatch), 0);
+    HAPRawBufferZero(dispatch, sizeof(*dispatch));
+    dispatch->pending.cancel = lhap_dispatch_cancel;
+    dispatch->co = L;
+    dispatch->accessory = accessory;
+    dispatch->service = service;
+    dispatch->characteristic = characteristic;
+    dispatch->write = write;
+    dispatch->n = n;
+
+    // the requests are dispatched from the run loop, like the server does
+    if (HAPPlatformTimerRegister(&dispatch->timer, 0, lhap_dispatch_cb, dispatch)) {
+        luaL_error(L, "failed to register dispatch timer");
+    }
+    dispatch->next = gv_lhap_dispatches;
+    gv_lhap_dispatches = dispatch;
+    lc_setpending(L, &dispatch->pending);
+    return lua_yield(L, 0);
+}
+
+static int lhap_get_cache_stats(lua_State *L) {
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, gv_lhap_cache_stats.hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushinteger(L, gv_lhap_cache_stats.misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushinteger(L, gv_lhap_cache_stats.stale);
+    lua_setfield(L, -2, "stale");
+    lua_pushinteger(L, gv_lhap_cache_stats.chars);
+    lua_setfield(L, -2, "chars");
+    return 1;
+}
+
+typedef void (*lhap_char_latency_cb)(lua_State *L, const HAPAccessory *accessory,
+    const HAPService *service, const HAPBaseCharacteristic *characteristic, lhap_char_latency *latency);
+
+// Call the callback for each characteristic with the latency histograms.
+static void lhap_foreach_char_latency(lua_State *L, lhap_desc *desc, lhap_char_latency_cb cb) {
+    if (!desc->started) {
+        return;
+    }
+    for (size_t i = 0; i <= desc->num_bridged_accs; i++) {
+        const HAPAccessory *accessory = i == 0 ? desc->primary_acc : desc->bridged_accs[i - 1];
+        for (const HAPService * const *pserv = accessory->services; *pserv; pserv++) {
+            if (lhap_service_is_builtin(*pserv)) {
+                continue;
+            }
+            for (const HAPBaseCharacteristic * const *pchar =
+                (const HAPBaseCharacteristic * const *)(*pserv)->characteristics; *pchar; pchar++) {
+                lhap_char_latency *latency = lhap_char_get_priv(*pchar)->latency;
+                if (latency) {
+                    cb(L, accessory, *pserv, *pchar, latency);
+                }
+            }
+        }
+    }
+}
+
+static void lhap_push_latency_hist(lua_State *L, const lhap_latency_hist *hist) {
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, hist->count);
+    lua_setfield(L, -2, "count");
+    lua_pushinteger(L, hist->max);
+    lua_setfield(L, -2, "max");
+    lua_pushinteger(L, hist->sum);
+    lua_setfield(L, -2, "sum");
+    lua_createtable(L, LHAP_LATENCY_BUCKETS, 0);
+    for (int i = 0; i < LHAP_LATENCY_BUCKETS; i++) {
+        lua_pushinteger(L, hist->buckets[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "buckets");
+}
+
+static void lhap_push_char_latency(lua_State *L, const HAPAccessory *accessory,
+    const HAPService *service, const HAPBaseCharacteristic *characteristic, lhap_char_latency *latency) {
+    lua_createtable(L, 0, 6);
+    lua_pushinteger(L, accessory->aid);
+    lua_setfield(L, -2, "aid");
+    lua_pushinteger(L, service->iid);
+    lua_setfield(L, -2, "sid");
+    lua_pushinteger(L, characteristic->iid);
+    lua_setfield(L, -2, "cid");
+    lhap_push_latency_hist(L, &latency->queue);
+    lua_setfield(L, -2, "queue");
+    lhap_push_latency_hist(L, &latency->handler);
+    lua_setfield(L, -2, "handler");
+    lhap_push_latency_hist(L, &latency->total);
+    lua_setfield(L, -2, "total");
+    lua_rawseti(L, -2, luaL_len(L, -2) + 1);
+}
+
+static void lhap_reset_char_latency(lua_State *L, const HAPAccessory *accessory,
+    const HAPService *service, const HAPBaseCharacteristic *characteristic, lhap_char_latency *latency) {
+    HAPRawBufferZero(latency, sizeof(*latency));
+}
+
+static int lhap_set_latency_enabled(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TBOOLEAN);
+    gv_lhap_latency_enabled = lua_toboolean(L, 1);
+    return 0;
+}
+
+static int lhap_get_latency_stats(lua_State *L) {
+    lua_newtable(L);
+    lhap_foreach_char_latency(L, &gv_lhap_desc, lhap_push_char_latency);
+    return 1;
+}
+
+static int lhap_reset_latency_stats(lua_State *L) {
+    lhap_foreach_char_latency(L, &gv_lhap_desc, lhap_reset_char_latency);
+    return 0;
+}
+
+static int lhap_get_session_stats(lua_State *L) {
+    lua_createtable(L, 0, 5);
+    lua_pushinteger(L, gv_lhap_session_stats.sessions);
+    lua_setfield(L, -2, "sessions");
+    lua_pushinteger(L, gv_lhap_session_stats.peak_sessions);
+    lua_setfield(L, -2, "peakSessions");
+    lua_pushinteger(L, gv_lhap_session_stats.bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushinteger(L, gv_lhap_session_stats.peak_bytes);
+    lua_setfield(L, -2, "peakBytes");
+    lua_pushinteger(L, PAL_HAP_IP_SESSION_STORAGE_NUM_ELEMENTS);
+    lua_setfield(L, -2, "capacity");
+    return 1;
+}
+
+static int lhap_encode_tlv8(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_Integer max_bytes = luaL_optinteger(L, 2, LUAL_BUFFERSIZE);
+    luaL_argcheck(L, max_bytes > 0, 2, "must be greater than 0");
+    lua_settop(L, 1);
+
+    luaL_Buffer b;
+    char *bytes = luaL_buffinitsize(L, &b, max_bytes);
+    HAPTLVWriterRef writer;
+    HAPTLVWriterCreate(&writer, bytes, max_bytes);
+    if (lhap_tlv8_encode(L, 1, &writer, 0) != kHAPError_None) {
+        return luaL_error(L, "TLV8 value too long");
+    }
+    void *buf;
+    size_t len;
+    HAPTLVWriterGetBuffer(&writer, &buf, &len);
+    luaL_pushresultsize(&b, len);
+    return 1;
+}
+
+static int lhap_decode_tlv8(lua_State *L) {
+    size_t len;
+    const char *data = luaL_checklstring(L, 1, &len);
+
+    // the reader merges the fragments in place, decode a copy of the data
+    char stack_bytes[LUAL_BUFFERSIZE];
+    void *bytes = len <= sizeof(stack_bytes) ? stack_bytes : lua_newuserdatauv(L, len, 0);
+    if (len) {
+        HAPRawBufferCopyBytes(bytes, data, len);
+    }
+    HAPTLVReaderRef reader;
+    HAPTLVReaderCreate(&reader, bytes, len);
+    lhap_tlv8_decode(L, &reader);
+    return 1;
+}
+
 static int lhap_get_new_iid(lua_State *L) {
     bool bridgedAcc = false;
     if (lua_gettop(L) == 1) {
@@ -2593,7 +4400,17 @@ static const luaL_Reg haplib[] = {
     {"accessoryIsValid", lhap_accessory_is_valid},
     {"start", lhap_start},
     {"stop", lhap_stop},
+    {"updateBridgedAccessories", lhap_update_bridged_accessories},
     {"raiseEvent", lhap_raise_event},
+    {"raiseEvents", lhap_raise_events},
+    {"benchDispatch", lhap_bench_dispatch},
+    {"cacheStats", lhap_get_cache_stats},
+    {"sessionStats", lhap_get_session_stats},
+    {"setLatencyEnabled", lhap_set_latency_enabled},
+    {"latencyStats", lhap_get_latency_stats},
+    {"resetLatencyStats", lhap_reset_latency_stats},
+    {"encodeTLV8", lhap_encode_tlv8},
+    {"decodeTLV8", lhap_decode_tlv8},
     {"getNewInstanceID", lhap_get_new_iid},
     {"getSetupCode", lhap_get_setup_code},
     {"restoreFactorySettings", lhap_restore_factory_settings},
@@ -2612,6 +4429,14 @@ static const luaL_Reg lhap_accessory_metameth[] = {
     {NULL, NULL}
 };
 
+/*
+ * metamethods for request
+ */
+static const luaL_Reg lhap_request_metameth[] = {
+    {"__index", lhap_request_index},
+    {NULL, NULL}
+};
+
 /*
  * metamethods for service
  */
@@ -2646,6 +4471,7 @@ static const luaL_Reg lhap_char_meth[] = {
     {"setContraints", lhap_char_set_contraints},
     {"setValidVals", lhap_char_set_valid_vals},
     {"setValidValsRanges", lhap_set_valid_vals_ranges},
+    {"setCoalesceReads", lhap_char_set_coalesce_reads},
     {NULL, NULL},
 };
 
@@ -2654,6 +4480,10 @@ static void lhap_createmeta(lua_State *L) {
     luaL_setfuncs(L, lhap_accessory_metameth, 0);  /* add metamethods to new metatable */
     lua_pop(L, 1);  /* pop metatable */
 
+    luaL_newmetatable(L, LHAP_REQUEST_NAME);  /* metatable for request */
+    luaL_setfuncs(L, lhap_request_metameth, 0);  /* add metamethods to new metatable */
+    lua_pop(L, 1);  /* pop metatable */
+
     luaL_newmetatable(L, LHAP_SERVICE_NAME);  /* metatable for service */
     luaL_setfuncs(L, lhap_service_metameth, 0);  /* add metamethods to new metatable */
     luaL_newlibtable(L, lhap_service_meth);  /* create method table */
@@ -2670,6 +4500,15 @@ static void lhap_createmeta(lua_State *L) {
 }
 
 LUAMOD_API int luaopen_hap(lua_State *L) {
+    HAPAssert(lhap_name_tab_is_sorted(lhap_service_type_tab,
+        HAPArrayCount(lhap_service_type_tab), sizeof(lhap_service_type_tab[0])));
+    HAPAssert(lhap_name_tab_is_sorted(lhap_characteristic_type_tab,
+        HAPArrayCount(lhap_characteristic_type_tab), sizeof(lhap_characteristic_type_tab[0])));
+    HAPAssert(lc_kvs_is_sorted(lhap_char_props_ip_kvs));
+    HAPAssert(lc_kvs_is_sorted(lhap_char_props_ble_kvs));
+    HAPAssert(lc_kvs_is_sorted(lhap_char_props_kvs));
+    HAPAssert(lc_kvs_is_sorted(lhap_char_cache_kvs));
+
     luaL_newlib(L, haplib);
     lhap_createmeta(L);
 
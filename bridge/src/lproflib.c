@@ -0,0 +1,268 @@
+// Copyright (c) 2021-2022 Zebin Wu and homekit-bridge contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of homekit-bridge project authors.
+
+#include <stdio.h>
+#include <lauxlib.h>
+#include <pal/mem.h>
+
+#include "app_int.h"
+#include "lc.h"
+
+/**
+ * Default number of VM instructions between two samples.
+ */
+#define LPROF_DEFAULT_COUNT 1000
+
+/**
+ * Max depth of the sampled stacks, the frames beyond it are dropped.
+ */
+#ifndef LPROF_MAX_DEPTH
+#define LPROF_MAX_DEPTH 24
+#endif
+
+/**
+ * Max number of distinct functions, must be a power of 2.
+ */
+#ifndef LPROF_MAX_FRAMES
+#define LPROF_MAX_FRAMES 256
+#endif
+
+/**
+ * Max number of distinct stacks, must be a power of 2.
+ */
+#ifndef LPROF_MAX_STACKS
+#define LPROF_MAX_STACKS 512
+#endif
+
+#define LPROF_FRAME_NAME_LEN 48
+
+HAP_STATIC_ASSERT((LPROF_MAX_FRAMES & (LPROF_MAX_FRAMES - 1)) == 0, LPROF_MAX_FRAMES);
+HAP_STATIC_ASSERT((LPROF_MAX_STACKS & (LPROF_MAX_STACKS - 1)) == 0, LPROF_MAX_STACKS);
+
+/**
+ * A Lua function is identified by its source and the line where it is defined,
+ * as the address of a collected function can be reused by another one.
+ */
+typedef struct {
+    bool used;
+    int line;               /* line defined, -1 for C functions */
+    lua_CFunction cfunc;    /* C function, NULL for Lua functions */
+    char src[LUA_IDSIZE];
+    char name[LPROF_FRAME_NAME_LEN];
+} lprof_frame;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t count;     /* 0 if the slot is free */
+    uint16_t depth;
+    uint16_t frames[LPROF_MAX_DEPTH];   /* leaf first */
+} lprof_stack;
+
+static struct {
+    bool running;
+    int count;
+    size_t nframes;
+    size_t nstacks;
+    size_t samples;
+    size_t dropped;
+    lprof_frame *frames;
+    lprof_stack *stacks;
+} gv_lprof;
+
+static void lprof_frame_name(lua_Debug *ar, char *buf, size_t len) {
+    const char *name = ar->name ? ar->name : "?";
+    if (*ar->what == 'C') {
+        snprintf(buf, len, "%s@[C]", name);
+    } else if (*ar->what == 'm') {
+        snprintf(buf, len, "main@%s", ar->short_src);
+    } else {
+        snprintf(buf, len, "%s@%s:%d", name, ar->short_src, ar->linedefined);
+    }
+    // ' ' and ';' are separators in the collapsed stacks
+    for (; *buf; buf++) {
+        if (*buf == ' ') {
+            *buf = '_';
+        } else if (*buf == ';') {
+            *buf = ':';
+        }
+    }
+}
+
+// Get the frame ID of the function on the top of the stack, returns -1 if the table is full.
+static int lprof_frame_id(lua_State *L, lua_Debug *ar) {
+    lua_CFunction cfunc = *ar->what == 'C' ? lua_tocfunction(L, -1) : NULL;
+    uint32_t hash;
+    if (cfunc) {
+        hash = (uintptr_t)cfunc >> 3;
+    } else {
+        hash = 2166136261u;
+        for (const char *p = ar->short_src; *p; p++) {
+            hash = (hash ^ (uint8_t)*p) * 16777619u;
+        }
+        hash = (hash ^ (uint32_t)ar->linedefined) * 16777619u;
+    }
+
+    size_t mask = LPROF_MAX_FRAMES - 1;
+    size_t i = hash & mask;
+    for (; gv_lprof.frames[i].used; i = (i + 1) & mask) {
+        const lprof_frame *frame = gv_lprof.frames + i;
+        if (cfunc ? frame->cfunc == cfunc : (!frame->cfunc && frame->line == ar->linedefined &&
+            HAPStringAreEqual(frame->src, ar->short_src))) {
+            return i;
+        }
+    }
+    if (gv_lprof.nframes >= LPROF_MAX_FRAMES * 3 / 4) {
+        return -1;
+    }
+    gv_lprof.nframes++;
+    lprof_frame *frame = gv_lprof.frames + i;
+    frame->used = true;
+    frame->line = ar->linedefined;
+    frame->cfunc = cfunc;
+    if (!cfunc) {
+        HAPRawBufferCopyBytes(frame->src, ar->short_src, HAPStringGetNumBytes(ar->short_src) + 1);
+    }
+    lprof_frame_name(ar, frame->name, sizeof(frame->name));
+    return i;
+}
+
+static void lprof_record(const uint16_t *frames, size_t depth) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < depth; i++) {
+        hash = (hash ^ frames[i]) * 16777619u;
+    }
+
+    size_t mask = LPROF_MAX_STACKS - 1;
+    size_t i = hash & mask;
+    for (; gv_lprof.stacks[i].count; i = (i + 1) & mask) {
+        lprof_stack *stack = gv_lprof.stacks + i;
+        if (stack->hash == hash && stack->depth == depth &&
+            HAPRawBufferAreEqual(stack->frames, frames, depth * sizeof(frames[0]))) {
+            stack->count++;
+            return;
+        }
+    }
+    if (gv_lprof.nstacks >= LPROF_MAX_STACKS * 3 / 4) {
+        gv_lprof.dropped++;
+        return;
+    }
+    gv_lprof.nstacks++;
+    lprof_stack *stack = gv_lprof.stacks + i;
+    stack->hash = hash;
+    stack->count = 1;
+    stack->depth = depth;
+    HAPRawBufferCopyBytes(stack->frames, frames, depth * sizeof(frames[0]));
+}
+
+static void lprof_hook(lua_State *L, lua_Debug *ar) {
+    if (!gv_lprof.running) {
+        // the coroutine was hooked before the profiler stopped
+        lua_sethook(L, NULL, 0, 0);
+        return;
+    }
+
+    uint16_t frames[LPROF_MAX_DEPTH];
+    size_t depth = 0;
+    lua_Debug d;
+    for (int level = 0; depth < LPROF_MAX_DEPTH && lua_getstack(L, level, &d); level++) {
+        lua_getinfo(L, "nSf", &d);
+        int id = lprof_frame_id(L, &d);
+        lua_pop(L, 1);
+        if (id < 0) {
+            gv_lprof.dropped++;
+            return;
+        }
+        frames[depth++] = id;
+    }
+    gv_lprof.samples++;
+    lprof_record(frames, depth);
+}
+
+static void lprof_free(void) {
+    pal_mem_free(gv_lprof.frames);
+    pal_mem_free(gv_lprof.stacks);
+    HAPRawBufferZero(&gv_lprof, sizeof(gv_lprof));
+}
+
+static int lprof_start(lua_State *L) {
+    lua_Integer count = luaL_optinteger(L, 1, LPROF_DEFAULT_COUNT);
+    luaL_argcheck(L, count > 0 && count <= INT32_MAX, 1, "count out of range");
+    if (!gv_lprof.frames) {
+        gv_lprof.frames = pal_mem_calloc(LPROF_MAX_FRAMES, sizeof(lprof_frame));
+        gv_lprof.stacks = pal_mem_calloc(LPROF_MAX_STACKS, sizeof(lprof_stack));
+        if (luai_unlikely(!gv_lprof.frames || !gv_lprof.stacks)) {
+            lprof_free();
+            luaL_error(L, "failed to alloc profiler tables");
+        }
+    }
+    gv_lprof.running = true;
+    gv_lprof.count = count;
+    lc_sethook(L, lprof_hook, LUA_MASKCOUNT, count);
+    return 0;
+}
+
+static int lprof_stop(lua_State *L) {
+    gv_lprof.running = false;
+    lc_sethook(L, NULL, 0, 0);
+    return 0;
+}
+
+static int lprof_reset(lua_State *L) {
+    lprof_stop(L);
+    lprof_free();
+    return 0;
+}
+
+static int lprof_dump(lua_State *L) {
+    luaL_Buffer B;
+    luaL_buffinit(L, &B);
+    for (size_t i = 0; gv_lprof.stacks && i < LPROF_MAX_STACKS; i++) {
+        const lprof_stack *stack = gv_lprof.stacks + i;
+        if (!stack->count) {
+            continue;
+        }
+        for (size_t j = stack->depth; j > 0; j--) {
+            luaL_addstring(&B, gv_lprof.frames[stack->frames[j - 1]].name);
+            if (j > 1) {
+                luaL_addchar(&B, ';');
+            }
+        }
+        char buf[16];
+        snprintf(buf, sizeof(buf), " %lu\n", (unsigned long)stack->count);
+        luaL_addstring(&B, buf);
+    }
+    luaL_pushresult(&B);
+    return 1;
+}
+
+static int lprof_stats(lua_State *L) {
+    lua_createtable(L, 0, 5);
+    lua_pushboolean(L, gv_lprof.running);
+    lua_setfield(L, -2, "running");
+    lua_pushinteger(L, gv_lprof.samples);
+    lua_setfield(L, -2, "samples");
+    lua_pushinteger(L, gv_lprof.dropped);
+    lua_setfield(L, -2, "dropped");
+    lua_pushinteger(L, gv_lprof.nstacks);
+    lua_setfield(L, -2, "stacks");
+    lua_pushinteger(L, gv_lprof.nframes);
+    lua_setfield(L, -2, "frames");
+    return 1;
+}
+
+static const luaL_Reg lprof_funcs[] = {
+    {"start", lprof_start},
+    {"stop", lprof_stop},
+    {"reset", lprof_reset},
+    {"dump", lprof_dump},
+    {"stats", lprof_stats},
+    {NULL, NULL},
+};
+
+LUAMOD_API int luaopen_prof(lua_State *L) {
+    luaL_newlib(L, lprof_funcs);
+    return 1;
+}
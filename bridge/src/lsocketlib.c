@@ -18,6 +18,7 @@ typedef struct {
     bool destroyed;
     pal_socket_obj socket;
     luaL_Buffer B;
+    lc_pending pending;
 } lsocket_obj;
 
 static const HAPLogObject lsocket_log = {
@@ -38,6 +39,23 @@ static const char *lsocket_af_strs[] = {
     NULL,
 };
 
+// Cancel the operation of the socket when the waiting coroutine is canceled.
+static void lsocket_obj_cancel(lc_pending *pending) {
+    lsocket_obj *obj = lc_container_of(pending, lsocket_obj, pending);
+    if (obj->destroyed || pal_socket_cancel(&obj->socket)) {
+        return;
+    }
+    // connecting, sending or handshaking can not be taken back
+    pal_socket_obj_deinit(&obj->socket);
+    obj->destroyed = true;
+}
+
+// Yield the coroutine waiting for the socket.
+static int lsocket_obj_yield(lua_State *L, lsocket_obj *obj, lua_KContext ctx, lua_KFunction k) {
+    lc_setpending(L, &obj->pending);
+    return lua_yieldk(L, 0, ctx, k);
+}
+
 static int lsocket_create(lua_State *L) {
     pal_socket_type type = luaL_checkoption(L, 1, NULL, lsocket_type_strs);
     pal_net_addr_family af = luaL_checkoption(L, 2, NULL, lsocket_af_strs);
@@ -49,6 +67,7 @@ static int lsocket_create(lua_State *L) {
         luaL_error(L, "failed to initalize socket object");
     }
     obj->destroyed = false;
+    obj->pending.cancel = lsocket_obj_cancel;
 
     return 1;
 }
@@ -135,6 +154,7 @@ static int finishaccept(lua_State *L, int status, lua_KContext extra) {
 
     switch (err) {
     case PAL_ERR_OK: {
+        ((lsocket_obj *)lua_touserdata(L, 2))->destroyed = false;
         const char *addr = lua_touserdata(L, -1);
         lua_pop(L, 1);
         lua_pushstring(L, addr);
@@ -155,20 +175,24 @@ static int lsocket_obj_accept(lua_State *L) {
     char addr[PAL_NET_ADDR_STR_LEN];
     uint16_t port;
 
+    lua_settop(L, 1);
     lsocket_obj *new_o = lua_newuserdata(L, sizeof(lsocket_obj));
     luaL_setmetatable(L, LUA_SOCKET_OBJECT_NAME);
-    new_o->destroyed = false;
+    // not initialized until a connection is accepted
+    new_o->destroyed = true;
+    new_o->pending.cancel = lsocket_obj_cancel;
 
     pal_err err = pal_socket_accept(&obj->socket, &new_o->socket, addr,
         sizeof(addr), &port, lsocket_accepted_cb, L);
     switch (err) {
     case PAL_ERR_OK: {
+        new_o->destroyed = false;
         lua_pushstring(L, addr);
         lua_pushinteger(L, port);
         return 3;
     }
     case PAL_ERR_IN_PROGRESS:
-        lua_yieldk(L, 0, (lua_KContext)obj, finishaccept);
+        lsocket_obj_yield(L, obj, (lua_KContext)obj, finishaccept);
         break;
     default:
         lua_pushstring(L, pal_err_string(err));
@@ -200,7 +224,7 @@ static int finishconnect(lua_State *L, int status, lua_KContext extra) {
     case PAL_ERR_OK:
         break;
     case PAL_ERR_IN_PROGRESS:
-        lua_yieldk(L, 0, extra, finishconnect);
+        lsocket_obj_yield(L, lua_touserdata(L, 1), extra, finishconnect);
         break;
     default:
         lua_pushstring(L, pal_err_string(err));
@@ -244,7 +268,7 @@ static int finishsend(lua_State *L, int status, lua_KContext extra) {
     case PAL_ERR_OK:
         return all ? 0 : 1;
     case PAL_ERR_IN_PROGRESS:
-        lua_yieldk(L, 0, extra, finishsend);
+        lsocket_obj_yield(L, lua_touserdata(L, 1), extra, finishsend);
         break;
     default:
         lua_pushstring(L, pal_err_string(err));
@@ -354,7 +378,7 @@ static int lsocket_obj_recv(lua_State *L) {
         luaL_pushresult(&obj->B);
         return 1;
     case PAL_ERR_IN_PROGRESS:
-        return lua_yieldk(L, 0, (lua_KContext)false, finishrecv);
+        return lsocket_obj_yield(L, obj, (lua_KContext)false, finishrecv);
     default:
         lua_pushstring(L, pal_err_string(err));
         return lua_error(L);
@@ -381,7 +405,7 @@ static int lsocket_obj_recvfrom(lua_State *L) {
         lua_pushinteger(L, port);
         return 3;
     case PAL_ERR_IN_PROGRESS:
-        return lua_yieldk(L, 0, (lua_KContext)true, finishrecv);
+        return lsocket_obj_yield(L, obj, (lua_KContext)true, finishrecv);
     default:
         lua_pushstring(L, pal_err_string(err));
         return lua_error(L);
@@ -420,6 +444,44 @@ static int lsocket_obj_tostring(lua_State *L) {
     return 1;
 }
 
+static void lsocket_obj_readable_cb(pal_socket_obj *o, void *arg) {
+    lc_waiter *waiter = arg;
+    waiter->obj = NULL;
+    waiter->ready(waiter);
+}
+
+static bool lsocket_obj_wait(lua_State *L, int idx, lc_waiter *waiter) {
+    lsocket_obj *obj = lua_touserdata(L, idx);
+    if (obj->destroyed) {
+        return true;
+    }
+    switch (pal_socket_wait_readable(&obj->socket, lsocket_obj_readable_cb, waiter)) {
+    case PAL_ERR_IN_PROGRESS:
+        waiter->obj = obj;
+        return false;
+    case PAL_ERR_BUSY:
+        return luaL_error(L, "the socket is receiving");
+    default:
+        // readable or failed, the error is reported by the next receiving
+        return true;
+    }
+}
+
+static void lsocket_obj_cancel_wait(lc_waiter *waiter) {
+    lsocket_obj *obj = waiter->obj;
+    if (obj) {
+        if (!obj->destroyed) {
+            pal_socket_cancel_wait(&obj->socket);
+        }
+        waiter->obj = NULL;
+    }
+}
+
+static const lc_waitable_method lsocket_obj_waitable = {
+    .wait = lsocket_obj_wait,
+    .cancel = lsocket_obj_cancel_wait,
+};
+
 static const luaL_Reg lsocket_funcs[] = {
     {"create", lsocket_create},
     {NULL, NULL},
@@ -462,6 +524,8 @@ static void lsocket_createmeta(lua_State *L) {
     luaL_newlibtable(L, lsocket_obj_meth);  /* create method table */
     luaL_setfuncs(L, lsocket_obj_meth, 0);  /* add Socket* methods to method table */
     lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+    lua_pushlightuserdata(L, (void *)&lsocket_obj_waitable);
+    lua_setfield(L, -2, LC_WAITABLE);  /* metatable.__waitable = waitable methods */
     lua_pop(L, 1);  /* pop metatable */
 }
 
@@ -55,6 +55,7 @@ typedef struct lstream_client {
     pal_ssl_ctx sslctx;
     pal_socket_obj sock;
     luaL_Buffer B;
+    lc_pending pending;
 } lstream_client;
 
 static const HAPLogObject lstream_log = {
@@ -84,6 +85,20 @@ static void lstream_client_cleanup(lstream_client *client) {
     }
 }
 
+// Clean up the client when the waiting coroutine is canceled.
+static void lstream_client_cancel(lc_pending *pending) {
+    lstream_client *client = lc_container_of(pending, lstream_client, pending);
+    client->co = NULL;
+    lstream_client_cleanup(client);
+}
+
+// Yield the coroutine waiting for the client.
+static int lstream_client_yield(lua_State *L, lstream_client *client, lua_KFunction k) {
+    client->co = L;
+    lc_setpending(L, &client->pending);
+    return lua_yieldk(L, 0, (lua_KContext)client, k);
+}
+
 static void lstream_client_create_finish(lstream_client *client, const char *errmsg) {
     HAPPrecondition(client);
     HAPPrecondition(client->co);
@@ -319,8 +334,7 @@ static int lstream_client_create(lua_State *L) {
         luaL_error(L, "failed to start DNS resolution request");
     }
     client->state = LSTREAM_CLIENT_DNS_RESOLVING;
-    client->co = L;
-    return lua_yieldk(L, 0, (lua_KContext)client, finishcreate);
+    return lstream_client_yield(L, client, finishcreate);
 }
 
 static lstream_client *lstream_client_get(lua_State *L, int idx) {
@@ -382,8 +396,7 @@ static int lstream_client_write(lua_State *L) {
     case PAL_ERR_OK:
         return 0;
     case PAL_ERR_IN_PROGRESS:
-        client->co = L;
-        return lua_yieldk(L, 0, (lua_KContext)client, finishwrite);
+        return lstream_client_yield(L, client, finishwrite);
     default:
         lua_pushstring(L, pal_err_string(err));
         return lua_error(L);
@@ -460,8 +473,7 @@ static int lstream_client_async_read(lua_State *L, lstream_client *client, size_
     char *buf = luaL_prepbuffsize(&client->B, len);
     pal_err err = pal_socket_recv(&client->sock, buf, &len, lstream_client_read_recved_cb, client);
     if (err == PAL_ERR_IN_PROGRESS) {
-        client->co = L;
-        return lua_yieldk(L, 0, (lua_KContext)client, k);
+        return lstream_client_yield(L, client, k);
     }
 
     int narg = 1;
@@ -681,6 +693,52 @@ static int lstream_client_tostring(lua_State *L) {
     return 0;
 }
 
+static void lstream_client_readable_cb(pal_socket_obj *o, void *arg) {
+    lc_waiter *waiter = arg;
+    waiter->obj = NULL;
+    waiter->ready(waiter);
+}
+
+static bool lstream_client_wait(lua_State *L, int idx, lc_waiter *waiter) {
+    lstream_client *client = lua_touserdata(L, idx);
+    if (client->state != LSTREAM_CLIENT_CONNECTED && client->state != LSTREAM_CLIENT_HANDSHAKED) {
+        return true;
+    }
+    size_t len = 0;
+    if (lua_getiuservalue(L, idx, 2) == LUA_TSTRING) {
+        lua_tolstring(L, -1, &len);
+    }
+    lua_pop(L, 1);
+    if (len) {
+        return true;
+    }
+    switch (pal_socket_wait_readable(&client->sock, lstream_client_readable_cb, waiter)) {
+    case PAL_ERR_IN_PROGRESS:
+        waiter->obj = client;
+        return false;
+    case PAL_ERR_BUSY:
+        return luaL_error(L, "the client is reading");
+    default:
+        // readable or failed, the error is reported by the next reading
+        return true;
+    }
+}
+
+static void lstream_client_cancel_wait(lc_waiter *waiter) {
+    lstream_client *client = waiter->obj;
+    if (client) {
+        if (client->sock_inited) {
+            pal_socket_cancel_wait(&client->sock);
+        }
+        waiter->obj = NULL;
+    }
+}
+
+static const lc_waitable_method lstream_client_waitable = {
+    .wait = lstream_client_wait,
+    .cancel = lstream_client_cancel_wait,
+};
+
 static const luaL_Reg lstream_funcs[] = {
     {"client", lstream_client_create},
     {NULL, NULL},
@@ -716,6 +774,8 @@ static void lstream_createmeta(lua_State *L) {
     luaL_newlibtable(L, lstream_client_meth);  /* create method table */
     luaL_setfuncs(L, lstream_client_meth, 0);  /* add stream client methods to method table */
     lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+    lua_pushlightuserdata(L, (void *)&lstream_client_waitable);
+    lua_setfield(L, -2, LC_WAITABLE);  /* metatable.__waitable = waitable methods */
     lua_pop(L, 1);  /* pop metatable */
 }
 
@@ -0,0 +1,369 @@
+// Copyright (c) 2021-2022 Zebin Wu and homekit-bridge contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of homekit-bridge project authors.
+
+#include <string.h>
+#include <stdint.h>
+#include <HAPBase.h>
+#include <pal/mem.h>
+
+#include "mempool.h"
+
+#ifndef MEMPOOL_ENABLE
+#define MEMPOOL_ENABLE 0
+#endif
+
+#ifndef MEMPOOL_OWNER_ENABLE
+#define MEMPOOL_OWNER_ENABLE 0
+#endif
+
+/**
+ * Max number of owners.
+ */
+#ifndef MEMPOOL_OWNER_MAX
+#define MEMPOOL_OWNER_MAX 16
+#endif
+
+/**
+ * Slab size in bytes, must be a power of 2.
+ * The slabs are aligned to their size, so the slab of a block is found by masking.
+ */
+#ifndef MEMPOOL_SLAB_SIZE
+#define MEMPOOL_SLAB_SIZE 4096
+#endif
+
+/**
+ * Max size of the small blocks.
+ */
+#define MEMPOOL_SMALL_MAX 256
+
+#define MEMPOOL_IS_SMALL(size) ((size) <= MEMPOOL_SMALL_MAX)
+
+/**
+ * Block alignment, the same as the max alignment of Lua.
+ */
+#define MEMPOOL_ALIGN 8
+
+static mempool_stats gv_mempool_stats;
+
+static struct {
+    int current;
+    size_t count;
+    mempool_owner owners[MEMPOOL_OWNER_MAX];
+} gv_mempool_owners = {
+    .count = 1,
+    .owners = {{.name = "bridge"}},
+};
+
+#if MEMPOOL_ENABLE
+
+typedef union mempool_block {
+    union mempool_block *next;
+    char data[MEMPOOL_ALIGN];
+} mempool_block;
+
+typedef struct mempool_slab {
+    struct mempool_slab *next;
+    uint16_t cls;       /* size class of the blocks */
+    uint16_t nfree;     /* free blocks, only counted by mempool_trim() */
+} mempool_slab;
+
+HAP_STATIC_ASSERT(sizeof(mempool_block) == MEMPOOL_ALIGN, mempool_block);
+HAP_STATIC_ASSERT(sizeof(mempool_slab) % MEMPOOL_ALIGN == 0, mempool_slab);
+HAP_STATIC_ASSERT(MEMPOOL_SLAB_SIZE / MEMPOOL_ALIGN <= UINT16_MAX, MEMPOOL_SLAB_SIZE);
+HAP_STATIC_ASSERT((MEMPOOL_SLAB_SIZE & (MEMPOOL_SLAB_SIZE - 1)) == 0, MEMPOOL_SLAB_SIZE_POW2);
+
+static const uint16_t mempool_class_size[] = {
+    8, 16, 24, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256,
+};
+
+/**
+ * Size class index, indexed by (size + 7) / 8.
+ */
+static const uint8_t mempool_size_class[MEMPOOL_SMALL_MAX / 8 + 1] = {
+    0, 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9,
+    10, 10, 10, 10, 11, 11, 11, 11, 12, 12, 12, 12, 13, 13, 13, 13,
+};
+
+#define MEMPOOL_CLASS(size) mempool_size_class[((size) + MEMPOOL_ALIGN - 1) / MEMPOOL_ALIGN]
+
+#define MEMPOOL_SLAB_BLOCKS(cls) ((MEMPOOL_SLAB_SIZE - sizeof(mempool_slab)) / mempool_class_size[cls])
+
+#define MEMPOOL_SLAB_OF(block) ((mempool_slab *)((uintptr_t)(block) & ~(uintptr_t)(MEMPOOL_SLAB_SIZE - 1)))
+
+static struct {
+    mempool_slab *slabs;
+    mempool_block *free_list[HAPArrayCount(mempool_class_size)];
+} gv_mempool;
+
+static bool mempool_grow(size_t cls) {
+    mempool_slab *slab = pal_mem_aligned_alloc(MEMPOOL_SLAB_SIZE, MEMPOOL_SLAB_SIZE);
+    if (!slab) {
+        return false;
+    }
+    slab->next = gv_mempool.slabs;
+    slab->cls = cls;
+    gv_mempool.slabs = slab;
+    gv_mempool_stats.slabs++;
+    gv_mempool_stats.reserved += MEMPOOL_SLAB_SIZE;
+
+    size_t size = mempool_class_size[cls];
+    char *end = (char *)slab + MEMPOOL_SLAB_SIZE;
+    for (char *p = (char *)(slab + 1); p + size <= end; p += size) {
+        mempool_block *block = (mempool_block *)p;
+        block->next = gv_mempool.free_list[cls];
+        gv_mempool.free_list[cls] = block;
+    }
+    return true;
+}
+
+static void *mempool_alloc_block(size_t size) {
+    if (!MEMPOOL_IS_SMALL(size)) {
+        void *ptr = pal_mem_alloc(size);
+        if (ptr) {
+            gv_mempool_stats.reserved += size;
+        }
+        return ptr;
+    }
+    size_t cls = MEMPOOL_CLASS(size);
+    if (!gv_mempool.free_list[cls] && !mempool_grow(cls)) {
+        return NULL;
+    }
+    mempool_block *block = gv_mempool.free_list[cls];
+    gv_mempool.free_list[cls] = block->next;
+    return block;
+}
+
+static void mempool_free_block(void *ptr, size_t size) {
+    if (!MEMPOOL_IS_SMALL(size)) {
+        pal_mem_free(ptr);
+        gv_mempool_stats.reserved -= size;
+        return;
+    }
+    size_t cls = MEMPOOL_CLASS(size);
+    mempool_block *block = ptr;
+    block->next = gv_mempool.free_list[cls];
+    gv_mempool.free_list[cls] = block;
+}
+
+static void *mempool_realloc_block(void *ptr, size_t osize, size_t nsize) {
+    if (!ptr) {
+        return mempool_alloc_block(nsize);
+    }
+    if (!MEMPOOL_IS_SMALL(osize) && !MEMPOOL_IS_SMALL(nsize)) {
+        void *nptr = pal_mem_realloc(ptr, nsize);
+        if (nptr) {
+            gv_mempool_stats.reserved += nsize;
+            gv_mempool_stats.reserved -= osize;
+        }
+        return nptr;
+    }
+    if (MEMPOOL_IS_SMALL(osize) && MEMPOOL_IS_SMALL(nsize) &&
+        MEMPOOL_CLASS(osize) == MEMPOOL_CLASS(nsize)) {
+        return ptr;
+    }
+    void *nptr = mempool_alloc_block(nsize);
+    if (nptr) {
+        memcpy(nptr, ptr, osize < nsize ? osize : nsize);
+        mempool_free_block(ptr, osize);
+    }
+    return nptr;
+}
+
+void mempool_trim(void) {
+    // a free slab is only possible if a slab worth of the reserved memory is not in use
+    if (gv_mempool_stats.reserved - gv_mempool_stats.live < MEMPOOL_SLAB_SIZE) {
+        return;
+    }
+    for (mempool_slab *slab = gv_mempool.slabs; slab; slab = slab->next) {
+        slab->nfree = 0;
+    }
+    for (size_t cls = 0; cls < HAPArrayCount(gv_mempool.free_list); cls++) {
+        for (mempool_block *block = gv_mempool.free_list[cls]; block; block = block->next) {
+            MEMPOOL_SLAB_OF(block)->nfree++;
+        }
+    }
+
+    // take the blocks of the free slabs out of the free lists
+    for (size_t cls = 0; cls < HAPArrayCount(gv_mempool.free_list); cls++) {
+        mempool_block **pblock = &gv_mempool.free_list[cls];
+        while (*pblock) {
+            if (MEMPOOL_SLAB_OF(*pblock)->nfree == MEMPOOL_SLAB_BLOCKS(cls)) {
+                *pblock = (*pblock)->next;
+            } else {
+                pblock = &(*pblock)->next;
+            }
+        }
+    }
+
+    mempool_slab **pslab = &gv_mempool.slabs;
+    while (*pslab) {
+        mempool_slab *slab = *pslab;
+        if (slab->nfree == MEMPOOL_SLAB_BLOCKS(slab->cls)) {
+            *pslab = slab->next;
+            pal_mem_free(slab);
+            gv_mempool_stats.slabs--;
+            gv_mempool_stats.reserved -= MEMPOOL_SLAB_SIZE;
+        } else {
+            pslab = &slab->next;
+        }
+    }
+}
+
+void mempool_deinit(void) {
+    while (gv_mempool.slabs) {
+        mempool_slab *slab = gv_mempool.slabs;
+        gv_mempool.slabs = slab->next;
+        pal_mem_free(slab);
+    }
+    HAPRawBufferZero(&gv_mempool, sizeof(gv_mempool));
+    gv_mempool_stats.reserved -= gv_mempool_stats.slabs * MEMPOOL_SLAB_SIZE;
+    gv_mempool_stats.slabs = 0;
+}
+
+#else
+
+static void mempool_free_block(void *ptr, size_t size) {
+    pal_mem_free(ptr);
+    gv_mempool_stats.reserved -= size;
+}
+
+static void *mempool_realloc_block(void *ptr, size_t osize, size_t nsize) {
+    void *nptr = pal_mem_realloc(ptr, nsize);
+    if (nptr) {
+        gv_mempool_stats.reserved += nsize;
+        gv_mempool_stats.reserved -= osize;
+    }
+    return nptr;
+}
+
+void mempool_trim(void) {
+}
+
+void mempool_deinit(void) {
+}
+
+#endif  // MEMPOOL_ENABLE
+
+static void *mempool_realloc_raw(void *ptr, size_t osize, size_t nsize) {
+    if (nsize == 0) {
+        if (ptr) {
+            mempool_free_block(ptr, osize);
+            gv_mempool_stats.live -= osize;
+        }
+        return NULL;
+    }
+
+    void *nptr = mempool_realloc_block(ptr, osize, nsize);
+    if (nptr) {
+        if (!ptr) {
+            gv_mempool_stats.allocs++;
+            gv_mempool_stats.allocated += nsize;
+        } else if (nsize > osize) {
+            gv_mempool_stats.allocated += nsize - osize;
+        }
+        gv_mempool_stats.live += nsize;
+        gv_mempool_stats.live -= osize;
+        if (gv_mempool_stats.live > gv_mempool_stats.peak) {
+            gv_mempool_stats.peak = gv_mempool_stats.live;
+        }
+    }
+    return nptr;
+}
+
+#if MEMPOOL_OWNER_ENABLE
+
+/**
+ * Block header, stores the owner of the block.
+ */
+typedef union mempool_header {
+    int owner;
+    char align[MEMPOOL_ALIGN];
+} mempool_header;
+
+HAP_STATIC_ASSERT(sizeof(mempool_header) == MEMPOOL_ALIGN, mempool_header);
+
+void *mempool_realloc(void *ptr, size_t osize, size_t nsize) {
+    mempool_header *header = ptr;
+    mempool_owner *owner;
+    if (header) {
+        header--;
+        owner = gv_mempool_owners.owners + header->owner;
+    } else {
+        owner = gv_mempool_owners.owners + gv_mempool_owners.current;
+    }
+
+    if (nsize == 0) {
+        if (header) {
+            mempool_realloc_raw(header, osize + sizeof(*header), 0);
+            owner->live -= osize;
+        }
+        return NULL;
+    }
+
+    if (owner->limit && nsize > osize && owner->live + (nsize - osize) > owner->limit) {
+        return NULL;
+    }
+
+    int id = owner - gv_mempool_owners.owners;
+    header = mempool_realloc_raw(header, header ? osize + sizeof(*header) : 0, nsize + sizeof(*header));
+    if (!header) {
+        return NULL;
+    }
+    header->owner = id;
+    owner->live += nsize;
+    owner->live -= osize;
+    if (owner->live > owner->peak) {
+        owner->peak = owner->live;
+    }
+    return header + 1;
+}
+
+#else
+
+void *mempool_realloc(void *ptr, size_t osize, size_t nsize) {
+    return mempool_realloc_raw(ptr, osize, nsize);
+}
+
+#endif  // MEMPOOL_OWNER_ENABLE
+
+int mempool_getowner(const char *name) {
+    for (size_t i = 0; i < gv_mempool_owners.count; i++) {
+        if (HAPStringAreEqual(gv_mempool_owners.owners[i].name, name)) {
+            return i;
+        }
+    }
+    if (gv_mempool_owners.count == MEMPOOL_OWNER_MAX ||
+        HAPStringGetNumBytes(name) >= sizeof(gv_mempool_owners.owners[0].name)) {
+        return -1;
+    }
+    mempool_owner *owner = gv_mempool_owners.owners + gv_mempool_owners.count;
+    HAPRawBufferCopyBytes(owner->name, name, HAPStringGetNumBytes(name) + 1);
+    return gv_mempool_owners.count++;
+}
+
+void mempool_setcurrent(int owner) {
+    HAPPrecondition(owner >= 0 && (size_t)owner < gv_mempool_owners.count);
+    gv_mempool_owners.current = owner;
+}
+
+int mempool_getcurrent(void) {
+    return gv_mempool_owners.current;
+}
+
+void mempool_setlimit(int owner, size_t limit) {
+    HAPPrecondition(owner >= 0 && (size_t)owner < gv_mempool_owners.count);
+    gv_mempool_owners.owners[owner].limit = limit;
+}
+
+const mempool_owner *mempool_getowners(size_t *count) {
+    HAPPrecondition(count);
+    *count = MEMPOOL_OWNER_ENABLE ? gv_mempool_owners.count : 0;
+    return gv_mempool_owners.owners;
+}
+
+const mempool_stats *mempool_getstats(void) {
+    return &gv_mempool_stats;
+}
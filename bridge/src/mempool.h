@@ -0,0 +1,117 @@
+// Copyright (c) 2021-2022 Zebin Wu and homekit-bridge contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of homekit-bridge project authors.
+
+#ifndef BRIDGE_SRC_MEMPOOL_H_
+#define BRIDGE_SRC_MEMPOOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Memory pool for Lua.
+ *
+ * Small blocks are allocated from slabs divided into size classes,
+ * large blocks are allocated by pal_mem_*().
+ * The pool is enabled by defining MEMPOOL_ENABLE to 1, otherwise all
+ * blocks are allocated by pal_mem_*() and only the statistics are kept.
+ *
+ * Each block is charged to the owner that is current when the block is
+ * allocated, such as a plugin. The accounting is enabled by defining
+ * MEMPOOL_OWNER_ENABLE to 1, it adds a header to every block.
+ */
+
+/**
+ * The default owner.
+ */
+#define MEMPOOL_OWNER_BRIDGE 0
+
+/**
+ * Memory pool statistics.
+ */
+typedef struct mempool_stats {
+    size_t live;        /* bytes in use */
+    size_t peak;        /* max bytes in use */
+    size_t reserved;    /* bytes obtained from the platform */
+    size_t slabs;       /* number of slabs */
+    uint64_t allocs;    /* number of blocks allocated */
+    uint64_t allocated; /* bytes allocated, including the growth of the blocks */
+} mempool_stats;
+
+/**
+ * Memory owner.
+ */
+typedef struct mempool_owner {
+    char name[32];      /* owner name */
+    size_t live;        /* bytes in use */
+    size_t peak;        /* max bytes in use */
+    size_t limit;       /* max bytes can be used, 0 means no limit */
+} mempool_owner;
+
+/**
+ * Change the size of the memory block pointed to by ptr from osize to nsize bytes.
+ *
+ * The semantic is the same as lua_Alloc.
+ * When ptr is NULL, osize must be 0.
+ */
+void *mempool_realloc(void *ptr, size_t osize, size_t nsize);
+
+/**
+ * Get memory pool statistics.
+ */
+const mempool_stats *mempool_getstats(void);
+
+/**
+ * Get the owner ID by name, the owner will be created if it does not exist.
+ *
+ * @returns the owner ID, or -1 if too many owners or the name is too long.
+ */
+int mempool_getowner(const char *name);
+
+/**
+ * Set the current owner, the blocks allocated after are charged to it.
+ */
+void mempool_setcurrent(int owner);
+
+/**
+ * Get the current owner.
+ */
+int mempool_getcurrent(void);
+
+/**
+ * Set the max bytes can be used by the owner, 0 means no limit.
+ *
+ * Allocations charged to the owner fail when the limit is exceeded.
+ */
+void mempool_setlimit(int owner, size_t limit);
+
+/**
+ * Get the owners. The count is 0 if the accounting is disabled.
+ */
+const mempool_owner *mempool_getowners(size_t *count);
+
+/**
+ * Release the slabs whose blocks are all free.
+ *
+ * The free blocks are counted per slab, call it when the memory
+ * in use has dropped, such as after a garbage-collection cycle.
+ * It returns at once if less than a slab of the reserved memory is free.
+ */
+void mempool_trim(void);
+
+/**
+ * Release all slabs. All blocks must have been freed.
+ */
+void mempool_deinit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // BRIDGE_SRC_MEMPOOL_H_
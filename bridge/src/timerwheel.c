@@ -0,0 +1,275 @@
+// Copyright (c) 2021-2022 Zebin Wu and homekit-bridge contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of homekit-bridge project authors.
+
+#include <HAPPlatformTimer.h>
+
+#include "timerwheel.h"
+
+/**
+ * Each level has 64 slots, the granularity of level N is 64^N milliseconds.
+ * Timers beyond the range of the wheels are rescheduled every revolution
+ * of the last level.
+ */
+#define TIMERWHEEL_LEVELS 4
+#define TIMERWHEEL_BITS 6
+#define TIMERWHEEL_SLOTS (1 << TIMERWHEEL_BITS)
+#define TIMERWHEEL_MASK (TIMERWHEEL_SLOTS - 1)
+
+/**
+ * Index of the list of the expired timers.
+ */
+#define TIMERWHEEL_EXPIRED (TIMERWHEEL_LEVELS * TIMERWHEEL_SLOTS)
+
+/**
+ * Index of the list of the timers being called.
+ */
+#define TIMERWHEEL_RUNNING (TIMERWHEEL_EXPIRED + 1)
+
+static struct {
+    HAPTime curr;               /* time of the last advance */
+    size_t count;               /* active timers */
+    HAPPlatformTimerRef timer;  /* platform timer, 0 if not registered */
+    HAPTime timer_deadline;
+    uint64_t pending[TIMERWHEEL_LEVELS];    /* non-empty slots */
+    timerwheel_node *lists[TIMERWHEEL_RUNNING + 1];
+    timerwheel_node **expired_tail; /* next of the last expired timer, NULL if the list is empty */
+} gv_timerwheel;
+
+static inline uint64_t timerwheel_rotl(uint64_t v, unsigned n) {
+    n &= 63;
+    return n ? (v << n) | (v >> (64 - n)) : v;
+}
+
+static inline uint64_t timerwheel_rotr(uint64_t v, unsigned n) {
+    n &= 63;
+    return n ? (v >> n) | (v << (64 - n)) : v;
+}
+
+static void timerwheel_link(timerwheel_node *node, timerwheel_node **pprev, uint16_t list) {
+    node->next = *pprev;
+    if (node->next) {
+        node->next->pprev = &node->next;
+    }
+    *pprev = node;
+    node->pprev = pprev;
+    node->list = list;
+}
+
+static void timerwheel_unlink(timerwheel_node *node) {
+    if (gv_timerwheel.expired_tail == &node->next) {
+        gv_timerwheel.expired_tail = node->pprev;
+    }
+    *node->pprev = node->next;
+    if (node->next) {
+        node->next->pprev = node->pprev;
+    }
+    node->next = NULL;
+    node->pprev = NULL;
+    if (node->list < TIMERWHEEL_EXPIRED && !gv_timerwheel.lists[node->list]) {
+        gv_timerwheel.pending[node->list / TIMERWHEEL_SLOTS] &= ~((uint64_t)1 << (node->list % TIMERWHEEL_SLOTS));
+    }
+}
+
+// Put the node to a slot or the expired list, returns the time the node will be handled.
+static HAPTime timerwheel_sched(timerwheel_node *node) {
+    HAPTime curr = gv_timerwheel.curr;
+    if (node->deadline <= curr) {
+        // the timers expired in the same advance are due together,
+        // so append them instead of sorting by the deadlines
+        timerwheel_node **tail = gv_timerwheel.expired_tail;
+        if (!tail) {
+            tail = &gv_timerwheel.lists[TIMERWHEEL_EXPIRED];
+        }
+        timerwheel_link(node, tail, TIMERWHEEL_EXPIRED);
+        gv_timerwheel.expired_tail = &node->next;
+        return curr;
+    }
+
+    // the level is the highest digit where the deadline differs from the current time,
+    // so the slot is reached before the digit wraps
+    int level = (63 - __builtin_clzll(node->deadline ^ curr)) / TIMERWHEEL_BITS;
+    HAPTime target;
+    if (level < TIMERWHEEL_LEVELS) {
+        target = node->deadline >> (level * TIMERWHEEL_BITS);
+    } else {
+        level = TIMERWHEEL_LEVELS - 1;
+        target = (curr >> (level * TIMERWHEEL_BITS)) + TIMERWHEEL_MASK;
+    }
+    unsigned slot = target & TIMERWHEEL_MASK;
+    uint16_t list = level * TIMERWHEEL_SLOTS + slot;
+    timerwheel_link(node, &gv_timerwheel.lists[list], list);
+    gv_timerwheel.pending[level] |= (uint64_t)1 << slot;
+    return target << (level * TIMERWHEEL_BITS);
+}
+
+// Move the timers in the slots passed since the last advance to lower levels or the expired list.
+static void timerwheel_advance(HAPTime now) {
+    HAPTime curr = gv_timerwheel.curr;
+    if (now <= curr) {
+        return;
+    }
+
+    // the lower levels are collected first, as their timers are nearer
+    timerwheel_node *todo = NULL;
+    timerwheel_node **todo_tail = &todo;
+    for (int level = 0; level < TIMERWHEEL_LEVELS; level++) {
+        HAPTime c = curr >> (level * TIMERWHEEL_BITS);
+        HAPTime n = now >> (level * TIMERWHEEL_BITS);
+        if (c == n) {
+            break;
+        }
+        uint64_t passed;
+        if (n - c >= TIMERWHEEL_SLOTS) {
+            passed = UINT64_MAX;
+        } else {
+            passed = timerwheel_rotl(((uint64_t)1 << (n - c)) - 1, (c + 1) & TIMERWHEEL_MASK);
+        }
+        uint64_t hit = gv_timerwheel.pending[level] & passed;
+        gv_timerwheel.pending[level] &= ~hit;
+        while (hit) {
+            unsigned slot = __builtin_ctzll(hit);
+            hit &= hit - 1;
+            timerwheel_node **head = &gv_timerwheel.lists[level * TIMERWHEEL_SLOTS + slot];
+            while (*head) {
+                timerwheel_node *node = *head;
+                *head = node->next;
+                node->next = NULL;
+                *todo_tail = node;
+                todo_tail = &node->next;
+            }
+        }
+    }
+
+    gv_timerwheel.curr = now;
+    while (todo) {
+        timerwheel_node *node = todo;
+        todo = node->next;
+        timerwheel_sched(node);
+    }
+}
+
+// Get the time when the next slot is reached or the expired timers should be called.
+static HAPTime timerwheel_next(void) {
+    if (gv_timerwheel.lists[TIMERWHEEL_EXPIRED]) {
+        return gv_timerwheel.curr;
+    }
+    HAPTime next = HAPTime_Max;
+    for (int level = 0; level < TIMERWHEEL_LEVELS; level++) {
+        if (!gv_timerwheel.pending[level]) {
+            continue;
+        }
+        HAPTime c = gv_timerwheel.curr >> (level * TIMERWHEEL_BITS);
+        uint64_t rotated = timerwheel_rotr(gv_timerwheel.pending[level], (c + 1) & TIMERWHEEL_MASK);
+        HAPTime t = (c + 1 + __builtin_ctzll(rotated)) << (level * TIMERWHEEL_BITS);
+        if (t < next) {
+            next = t;
+        }
+    }
+    return next;
+}
+
+static void timerwheel_timer_cb(HAPPlatformTimerRef timer, void *context);
+
+static void timerwheel_program(HAPTime deadline) {
+    if (gv_timerwheel.timer) {
+        if (gv_timerwheel.timer_deadline <= deadline) {
+            return;
+        }
+        HAPPlatformTimerDeregister(gv_timerwheel.timer);
+        gv_timerwheel.timer = 0;
+    }
+    HAPAssert(HAPPlatformTimerRegister(&gv_timerwheel.timer, deadline,
+        timerwheel_timer_cb, NULL) == kHAPError_None);
+    gv_timerwheel.timer_deadline = deadline;
+}
+
+static void timerwheel_timer_cb(HAPPlatformTimerRef timer, void *context) {
+    gv_timerwheel.timer = 0;
+    timerwheel_advance(HAPPlatformClockGetCurrent());
+
+    // the timers expired by the callbacks are called in the next round
+    timerwheel_node **running = &gv_timerwheel.lists[TIMERWHEEL_RUNNING];
+    *running = gv_timerwheel.lists[TIMERWHEEL_EXPIRED];
+    gv_timerwheel.lists[TIMERWHEEL_EXPIRED] = NULL;
+    gv_timerwheel.expired_tail = NULL;
+    for (timerwheel_node *node = *running; node; node = node->next) {
+        node->list = TIMERWHEEL_RUNNING;
+    }
+    if (*running) {
+        (*running)->pprev = running;
+    }
+
+    while (*running) {
+        timerwheel_node *node = *running;
+        timerwheel_unlink(node);
+        gv_timerwheel.count--;
+        node->cb(node);
+    }
+
+    if (gv_timerwheel.count) {
+        timerwheel_program(timerwheel_next());
+    }
+}
+
+// Advance the wheels to the current time, returns the current time.
+static HAPTime timerwheel_update(void) {
+    HAPTime now = HAPPlatformClockGetCurrent();
+    if (gv_timerwheel.count) {
+        timerwheel_advance(now);
+    } else {
+        gv_timerwheel.curr = now;
+    }
+    return now;
+}
+
+static void timerwheel_add(timerwheel_node *node, HAPTime deadline, timerwheel_cb cb) {
+    node->deadline = deadline;
+    node->cb = cb;
+    gv_timerwheel.count++;
+    timerwheel_program(timerwheel_sched(node));
+}
+
+void timerwheel_start(timerwheel_node *node, HAPTime ms, timerwheel_cb cb) {
+    HAPPrecondition(node);
+    HAPPrecondition(cb);
+
+    timerwheel_stop(node);
+    timerwheel_add(node, timerwheel_update() + ms, cb);
+}
+
+void timerwheel_start_at(timerwheel_node *node, HAPTime deadline, HAPTime slack, timerwheel_cb cb) {
+    HAPPrecondition(node);
+    HAPPrecondition(cb);
+
+    timerwheel_stop(node);
+    timerwheel_update();
+    if (slack > 1) {
+        deadline += (slack - deadline % slack) % slack;
+    }
+    timerwheel_add(node, deadline, cb);
+}
+
+void timerwheel_stop(timerwheel_node *node) {
+    HAPPrecondition(node);
+
+    if (!timerwheel_is_active(node)) {
+        return;
+    }
+    timerwheel_unlink(node);
+    gv_timerwheel.count--;
+    if (!gv_timerwheel.count && gv_timerwheel.timer) {
+        HAPPlatformTimerDeregister(gv_timerwheel.timer);
+        gv_timerwheel.timer = 0;
+    }
+}
+
+bool timerwheel_has_expired(void) {
+    return gv_timerwheel.lists[TIMERWHEEL_RUNNING] != NULL;
+}
+
+size_t timerwheel_count(void) {
+    return gv_timerwheel.count;
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2021-2022 Zebin Wu and homekit-bridge contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of homekit-bridge project authors.
+
+#ifndef BRIDGE_SRC_TIMERWHEEL_H_
+#define BRIDGE_SRC_TIMERWHEEL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <HAPBase.h>
+
+/**
+ * Hierarchical timer wheel.
+ *
+ * All timers are multiplexed onto a single platform timer.
+ * Starting and stopping a timer are O(1), the expired timers are called
+ * from the run loop in the order they expire, the timers expiring in the
+ * same advance of the wheels are due together and called in the same round.
+ */
+
+typedef struct timerwheel_node timerwheel_node;
+
+/**
+ * Callback of an expired timer.
+ */
+typedef void (*timerwheel_cb)(timerwheel_node *node);
+
+/**
+ * Timer node, embedded in the object owning the timer.
+ */
+struct timerwheel_node {
+    timerwheel_node *next;
+    timerwheel_node **pprev;    /* NULL if the timer is not active */
+    HAPTime deadline;
+    timerwheel_cb cb;
+    uint16_t list;
+};
+
+/**
+ * Start the timer, it will be restarted if it is active.
+ *
+ * @param node The timer node.
+ * @param ms Timeout in milliseconds.
+ * @param cb Callback called when the timer expired.
+ */
+void timerwheel_start(timerwheel_node *node, HAPTime ms, timerwheel_cb cb);
+
+/**
+ * Start the timer at an absolute time, it will be restarted if it is active.
+ *
+ * The deadline is delayed to the next multiple of the slack, so the timers
+ * with the same slack expiring in the same window are called in one round.
+ *
+ * @param node The timer node.
+ * @param deadline The time in milliseconds when the timer expires.
+ * @param slack Max delay of the deadline in milliseconds, 0 means no delay.
+ * @param cb Callback called when the timer expired.
+ */
+void timerwheel_start_at(timerwheel_node *node, HAPTime deadline, HAPTime slack, timerwheel_cb cb);
+
+/**
+ * Stop the timer, nothing to do if it is not active.
+ */
+void timerwheel_stop(timerwheel_node *node);
+
+/**
+ * Whether the timer is active.
+ */
+static inline bool timerwheel_is_active(const timerwheel_node *node) {
+    return node->pprev != NULL;
+}
+
+/**
+ * Whether there are expired timers to be called in the current round.
+ *
+ * The callbacks may use it to do the work needed once per round in the last callback.
+ */
+bool timerwheel_has_expired(void);
+
+/**
+ * Get the number of active timers.
+ */
+size_t timerwheel_count(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // BRIDGE_SRC_TIMERWHEEL_H_
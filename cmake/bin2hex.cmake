@@ -18,18 +18,127 @@ file(WRITE ${OUTPUT} "")
 file(APPEND ${OUTPUT} "// Auto generated. Don't edit it manually!\n\n")
 file(APPEND ${OUTPUT} "static const char ${filename}[] = {\n")
 
-set(offset 0)
-while(1)
-    file(READ ${INPUT} hex
-        OFFSET ${offset}
-        LIMIT 1
-        HEX
-    )
-    if("${hex}" STREQUAL "")
-        break()
+if(NOT COMPRESS)
+    set(offset 0)
+    while(1)
+        file(READ ${INPUT} hex
+            OFFSET ${offset}
+            LIMIT 1
+            HEX
+        )
+        if("${hex}" STREQUAL "")
+            break()
+        endif()
+        math(EXPR offset "${offset} + 1")
+        file(APPEND ${OUTPUT} "0x${hex}, ")
+    endwhile()
+    file(APPEND ${OUTPUT} "};\n")
+    file(APPEND ${OUTPUT} "#define ${filename}_len ${offset}\n")
+    file(APPEND ${OUTPUT} "#define ${filename}_size 0\n")
+    return()
+endif()
+
+#
+# Compress the file with the embedfs LZ format, see embedfs_read() in embedfs.c.
+#
+# The data is a sequence of tokens:
+# - 0LLLLLLL: L + 1 literal bytes follow.
+# - 1LLLLLLL OOOOOOOO OOOOOOOO: copy L + 4 bytes from O (little endian) bytes back.
+#
+# The window size must be the same as EMBEDFS_LZ_WINDOW.
+set(window_size 1024)
+set(min_match 4)
+set(max_match 131)
+set(max_literal 128)
+
+file(READ ${INPUT} hex HEX)
+string(LENGTH "${hex}" size)
+math(EXPR size "${size} / 2")
+
+# 3 characters per byte, so matches found by string(FIND) are always aligned
+string(REGEX REPLACE "(..)" "\\1," data "${hex}")
+
+set(out "")
+set(len 0)
+set(literals "")
+set(literal_count 0)
+
+macro(flush_literals)
+    if(literal_count GREATER 0)
+        math(EXPR token "${literal_count} - 1")
+        string(REGEX REPLACE "(..)," "0x\\1, " literals "${literals}")
+        string(APPEND out "${token}, ${literals}")
+        math(EXPR len "${len} + 1 + ${literal_count}")
+        set(literals "")
+        set(literal_count 0)
+    endif()
+endmacro()
+
+set(i 0)
+while(i LESS size)
+    set(match_len 0)
+    math(EXPR remain "${size} - ${i}")
+    if(i GREATER 0 AND NOT remain LESS min_match)
+        math(EXPR start "${i} - ${window_size}")
+        if(start LESS 0)
+            set(start 0)
+        endif()
+        math(EXPR window_begin "${start} * 3")
+        math(EXPR window_len "(${i} - ${start}) * 3")
+        string(SUBSTRING "${data}" ${window_begin} ${window_len} window)
+        math(EXPR pattern_begin "${i} * 3")
+
+        # find the longest match, the first occurrence is extended in place
+        # and searched again only when it cannot be extended
+        set(n ${min_match})
+        while(NOT n GREATER remain AND NOT n GREATER max_match)
+            math(EXPR pattern_len "${n} * 3")
+            if(match_len GREATER 0)
+                math(EXPR next "${match_pos} + ${pattern_len} - 3")
+                math(EXPR last "${pattern_begin} + ${pattern_len} - 3")
+                if(next LESS window_len)
+                    string(SUBSTRING "${window}" ${next} 3 a)
+                    string(SUBSTRING "${data}" ${last} 3 b)
+                    if(a STREQUAL b)
+                        set(match_len ${n})
+                        math(EXPR n "${n} + 1")
+                        continue()
+                    endif()
+                endif()
+            endif()
+            string(SUBSTRING "${data}" ${pattern_begin} ${pattern_len} pattern)
+            string(FIND "${window}" "${pattern}" pos)
+            if(pos EQUAL -1)
+                break()
+            endif()
+            set(match_len ${n})
+            set(match_pos ${pos})
+            math(EXPR n "${n} + 1")
+        endwhile()
+    endif()
+
+    if(match_len GREATER 0)
+        flush_literals()
+        math(EXPR token "128 + ${match_len} - ${min_match}")
+        math(EXPR distance "${i} - ${start} - ${match_pos} / 3")
+        math(EXPR lo "${distance} & 255")
+        math(EXPR hi "${distance} >> 8")
+        string(APPEND out "${token}, ${lo}, ${hi}, ")
+        math(EXPR len "${len} + 3")
+        math(EXPR i "${i} + ${match_len}")
+    else()
+        math(EXPR begin "${i} * 3")
+        string(SUBSTRING "${data}" ${begin} 3 byte)
+        string(APPEND literals "${byte}")
+        math(EXPR literal_count "${literal_count} + 1")
+        if(literal_count EQUAL max_literal)
+            flush_literals()
+        endif()
+        math(EXPR i "${i} + 1")
     endif()
-    math(EXPR offset "${offset} + 1")
-    file(APPEND ${OUTPUT} "0x${hex}, ")
 endwhile()
-file(APPEND ${OUTPUT} "};\n")
-file(APPEND ${OUTPUT} "#define ${filename}_len ${offset}\n")
+flush_literals()
+
+file(APPEND ${OUTPUT} "${out}};\n")
+file(APPEND ${OUTPUT} "#define ${filename}_len ${len}\n")
+file(APPEND ${OUTPUT} "#define ${filename}_size ${size}\n")
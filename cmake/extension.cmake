@@ -138,15 +138,22 @@ endfunction(target_add_embedfs)
 #
 # Add lua binary embedfs to a target.
 #
-# target_add_lua_binary_embedfs(<target> <root_name> [DEBUG]
+# COMPRESS: compress the binaries, see bin2hex.cmake
+#
+# target_add_lua_binary_embedfs(<target> <root_name> [DEBUG] [COMPRESS]
 #                               [SRC_DIRS dir1 [dir2...]])
 function(target_add_lua_binary_embedfs target root_name)
-    set(options DEBUG)
+    set(options DEBUG COMPRESS)
     set(multi SRC_DIRS)
     cmake_parse_arguments(arg "${options}" "" "${multi}" "${ARGN}")
     if(arg_DEBUG)
         set(GEN_LUA_LIBRARY_OPTIONS DEBUG)
     endif()
+    if(arg_COMPRESS)
+        set(compress ON)
+    else()
+        set(compress OFF)
+    endif()
 
     set(dest_dir ${CMAKE_BINARY_DIR}/${target}_${root_name})
     set(output ${dest_dir}/${target}_${root_name}.c)
@@ -171,8 +178,9 @@ function(target_add_lua_binary_embedfs target root_name)
                 COMMAND ${CMAKE_COMMAND}
                     -D OUTPUT=${header}
                     -D INPUT=${bin}
+                    -D COMPRESS=${compress}
                     -P ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/bin2hex.cmake
-                DEPENDS ${binary_dir}/${bin}
+                DEPENDS ${binary_dir}/${bin} ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/bin2hex.cmake
                 COMMENT "Generating ${header}"
             )
         endforeach()
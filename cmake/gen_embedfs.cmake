@@ -30,13 +30,8 @@ function(gen_embedfs_dir dir parent indent)
     foreach(file ${files})
         if(NOT IS_DIRECTORY ${ROOT_DIR}/${file})
             math(EXPR count "${count} + 1")
-            append_line("${indent}    & (const embedfs_file) {")
-            get_filename_component(filename ${file} NAME)
-            append_line("${indent}        .name = \"${filename}\",")
             string(REGEX REPLACE "[/.]" "_" filename ${file})
-            append_line("${indent}        .data = ${filename},")
-            append_line("${indent}        .len = ${filename}_len,")
-            append_line("${indent}    },")
+            append_line("${indent}    &${filename}_file,")
         endif()
     endforeach()
     append_line("${indent}},")
@@ -57,18 +52,158 @@ function(gen_embedfs_dir dir parent indent)
     append_line("${indent}.child_count = ${count},")
 endfunction()
 
+# Characters allowed in the paths, the index of a character plus 32 is its code.
+set(embedfs_chars "")
+foreach(code RANGE 32 126)
+    string(ASCII ${code} char)
+    set(embedfs_chars "${embedfs_chars}${char}")
+endforeach()
+
+# FNV-1a hash of the path, must be the same as embedfs_hash() in embedfs.c.
+function(embedfs_hash path out)
+    set(hash 2166136261)
+    string(LENGTH "${path}" len)
+    math(EXPR last "${len} - 1")
+    foreach(i RANGE ${last})
+        string(SUBSTRING "${path}" ${i} 1 char)
+        string(FIND "${embedfs_chars}" "${char}" code)
+        if(code EQUAL -1)
+            message(FATAL_ERROR "Invalid character in path \"${path}\"")
+        endif()
+        math(EXPR hash "((${hash} ^ (${code} + 32)) * 16777619) & 4294967295")
+    endforeach()
+    set(${out} ${hash} PARENT_SCOPE)
+endfunction()
+
+# Slot of the hash with the displacement, must be the same as embedfs_slot() in embedfs.c.
+function(embedfs_slot hash disp count out)
+    math(EXPR x "${hash} ^ ${disp}")
+    math(EXPR x "(((${x} >> 16) ^ ${x}) * 73244475) & 4294967295")
+    math(EXPR x "(((${x} >> 16) ^ ${x}) * 73244475) & 4294967295")
+    math(EXPR x "((${x} >> 16) ^ ${x}) % ${count}")
+    set(${out} ${x} PARENT_SCOPE)
+endfunction()
+
+#
+# Generate a minimal perfect hash index of all files.
+#
+# The files are divided into buckets by hash % count, the buckets are placed
+# from the largest, and each bucket gets the first displacement that maps all
+# of its files to free slots.
+function(gen_embedfs_index name paths)
+    list(LENGTH paths count)
+    math(EXPR last "${count} - 1")
+
+    set(max 0)
+    foreach(i RANGE ${last})
+        list(GET paths ${i} path)
+        embedfs_hash("${path}" hash)
+        set(hash_${i} ${hash})
+        math(EXPR bucket "${hash} % ${count}")
+        list(APPEND bucket_${bucket} ${i})
+        list(LENGTH bucket_${bucket} size)
+        if(size GREATER max)
+            set(max ${size})
+        endif()
+    endforeach()
+
+    set(size ${max})
+    while(size GREATER 0)
+        foreach(bucket RANGE ${last})
+            list(LENGTH bucket_${bucket} len)
+            if(NOT len EQUAL size)
+                continue()
+            endif()
+            set(disp 0)
+            while(1)
+                set(used "")
+                foreach(i ${bucket_${bucket}})
+                    embedfs_slot(${hash_${i}} ${disp} ${count} slot)
+                    list(FIND used ${slot} found)
+                    if(DEFINED slot_${slot} OR NOT found EQUAL -1)
+                        break()
+                    endif()
+                    list(APPEND used ${slot})
+                endforeach()
+                list(LENGTH used len)
+                if(len EQUAL size)
+                    break()
+                endif()
+                math(EXPR disp "${disp} + 1")
+                if(disp GREATER 65535)
+                    message(FATAL_ERROR "Failed to generate the embedfs index")
+                endif()
+            endwhile()
+            set(disp_${bucket} ${disp})
+            foreach(i ${bucket_${bucket}})
+                list(GET used 0 slot)
+                list(REMOVE_AT used 0)
+                set(slot_${slot} ${i})
+            endforeach()
+        endforeach()
+        math(EXPR size "${size} - 1")
+    endwhile()
+
+    append_line("static const embedfs_index ${name} = {")
+    append_line("    .disps = (const uint16_t []) {")
+    foreach(bucket RANGE ${last})
+        if(NOT DEFINED disp_${bucket})
+            set(disp_${bucket} 0)
+        endif()
+        append_line("        ${disp_${bucket}},")
+    endforeach()
+    append_line("    },")
+    append_line("    .paths = (const char * const[]) {")
+    foreach(slot RANGE ${last})
+        list(GET paths ${slot_${slot}} path)
+        append_line("        \"${path}\",")
+    endforeach()
+    append_line("    },")
+    append_line("    .files = (const embedfs_file * const[]) {")
+    foreach(slot RANGE ${last})
+        list(GET paths ${slot_${slot}} path)
+        string(REGEX REPLACE "[/.]" "_" filename ${path})
+        append_line("        &${filename}_file,")
+    endforeach()
+    append_line("    },")
+    append_line("    .count = ${count},")
+    append_line("};")
+endfunction()
+
 append_line("// Auto generated. Don't edit it manually!")
 append_line("")
 append_line("#include <embedfs.h>")
 
+set(paths "")
 file(GLOB_RECURSE files RELATIVE ${ROOT_DIR} ${ROOT_DIR}/*)
 foreach(file ${files})
     if(NOT IS_DIRECTORY ${ROOT_DIR}/${file})
         append_line("#include \"${file}.h\"")
+        list(APPEND paths ${file})
     endif()
 endforeach()
 
 append_line("")
+foreach(file ${paths})
+    get_filename_component(name ${file} NAME)
+    string(REGEX REPLACE "[/.]" "_" filename ${file})
+    append_line("static const embedfs_file ${filename}_file = {")
+    append_line("    .name = \"${name}\",")
+    append_line("    .data = ${filename},")
+    append_line("    .len = ${filename}_len,")
+    append_line("    .size = ${filename}_size,")
+    append_line("};")
+endforeach()
+
+append_line("")
+if(paths)
+    gen_embedfs_index(${EMBEDFS_ROOT_NAME}_index "${paths}")
+    append_line("")
+endif()
+
 append_line("const embedfs_dir ${EMBEDFS_ROOT_NAME} = {")
 gen_embedfs_dir("" ${ROOT_DIR} "    ")
+if(paths)
+    append_line("    .index = &${EMBEDFS_ROOT_NAME}_index,")
+endif()
 append_line("};")
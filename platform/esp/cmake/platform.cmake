@@ -20,6 +20,27 @@ set(CMAKE_EXPORT_COMPILE_COMMANDS ON)
 # set the embedfs root
 set(BRIDGE_EMBEDFS_ROOT bridge_embedfs_root)
 
+# compress the embedfs, saves flash but the loaded strings are copied to RAM
+set(BRIDGE_EMBEDFS_COMPRESS OFF)
+
+# GC scheduler: step size (KB), time budget per callback (ms) and
+# full collection threshold (KB)
+set(BRIDGE_GC_STEP_SIZE 8)
+set(BRIDGE_GC_TIME_BUDGET 0)
+set(BRIDGE_GC_FULL_THRESHOLD 128)
+
+# max idle coroutines kept in the pool
+set(BRIDGE_THREAD_POOL_MAX 32)
+
+# use the size-class memory pool for Lua
+set(BRIDGE_MEMPOOL OFF)
+
+# per-plugin memory accounting and limits
+set(BRIDGE_MEMPOOL_OWNER OFF)
+
+# allocate the memory of the HAP IP sessions when they are accepted
+set(BRIDGE_HAP_LAZY_SESSIONS OFF)
+
 include($ENV{IDF_PATH}/tools/cmake/idf.cmake)
 include($ENV{IDF_PATH}/tools/cmake/ldgen.cmake)
 include(${CMAKE_CURRENT_LIST_DIR}/extension.cmake)
@@ -35,6 +35,13 @@ extern "C" {
  */
 #define pal_mem_realloc(ptr, size) realloc(ptr, size)
 
+/**
+ * Allocate size bytes aligned to align, which must be a power of 2,
+ * and return a pointer to the allocated memory. The memory is not initialized
+ * and is freed by pal_mem_free().
+ */
+#define pal_mem_aligned_alloc(align, size) aligned_alloc(align, size)
+
 /**
  * Free the memory space pointed to by ptr, which must have been
  * returned by a previous call to pal_mem_alloc(), pal_mem_calloc(),
@@ -0,0 +1,28 @@
+// Copyright (c) 2021-2022 Zebin Wu and homekit-bridge contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of homekit-bridge project authors.
+
+#ifndef PLATFORM_INCLUDE_PAL_CLOCK_H_
+#define PLATFORM_INCLUDE_PAL_CLOCK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * Get the time of a monotonic clock in microseconds.
+ *
+ * The resolution is finer than HAPPlatformClockGetCurrent(),
+ * use it to measure short durations.
+ */
+uint64_t pal_clock_get_us(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PLATFORM_INCLUDE_PAL_CLOCK_H_
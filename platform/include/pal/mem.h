@@ -47,6 +47,15 @@ void *pal_mem_calloc(size_t nmemb, size_t size);
 void *pal_mem_realloc(void *ptr, size_t size);
 #endif
 
+#ifndef pal_mem_aligned_alloc
+/**
+ * Allocate size bytes aligned to align, which must be a power of 2,
+ * and return a pointer to the allocated memory. The memory is not initialized
+ * and is freed by pal_mem_free().
+ */
+void *pal_mem_aligned_alloc(size_t align, size_t size);
+#endif
+
 #ifndef pal_mem_free
 /**
  * Free the memory space pointed to by ptr, which must have been
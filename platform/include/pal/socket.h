@@ -303,6 +303,52 @@ pal_err pal_socket_recvfrom(pal_socket_obj *o, void *buf, size_t *len, char *add
  */
 bool pal_socket_readable(pal_socket_obj *o);
 
+/**
+ * A callback called when the socket is readable.
+ *
+ * @param o The pointer to the socket object.
+ * @param arg The last paramter of @b pal_socket_wait_readable().
+ */
+typedef void (*pal_socket_readable_cb)(pal_socket_obj *o, void *arg);
+
+/**
+ * Wait until the socket is readable, no data is received.
+ *
+ * The wait does not time out and it is done when @p readable_cb is called
+ * or it is canceled by @b pal_socket_cancel_wait().
+ *
+ * @param o The pointer to the socket object.
+ * @param readable_cb A callback called when the socket is readable.
+ * @param arg The value to be passed as the last argument to @p readable_cb.
+ *
+ * @return PAL_ERR_OK means the socket is readable now, @p readable_cb will not be called.
+ * @return PAL_ERR_IN_PROGRESS means @p readable_cb will be called when the socket is readable.
+ * @return PAL_ERR_BUSY means the socket is receiving.
+ * @return Other error numbers on failure.
+ */
+pal_err pal_socket_wait_readable(pal_socket_obj *o, pal_socket_readable_cb readable_cb, void *arg);
+
+/**
+ * Cancel waiting for the socket to be readable.
+ *
+ * Nothing to do if the socket is not waiting.
+ *
+ * @param o The pointer to the socket object.
+ */
+void pal_socket_cancel_wait(pal_socket_obj *o);
+
+/**
+ * Cancel the pending accepting or receiving.
+ *
+ * The callback is not called, and the socket can be used again.
+ *
+ * @param o The pointer to the socket object.
+ *
+ * @return true on success.
+ * @return false if the socket is not accepting or receiving.
+ */
+bool pal_socket_cancel(pal_socket_obj *o);
+
 /**
  * A callback called when the handshake is done.
  *
@@ -17,6 +17,27 @@ set(BRIDGE_WORK_DIR "/usr/local/lib/${TARGET}")
 # set the embedfs root
 set(BRIDGE_EMBEDFS_ROOT bridge_embedfs_root)
 
+# compress the embedfs, saves flash but the loaded strings are copied to RAM
+set(BRIDGE_EMBEDFS_COMPRESS OFF)
+
+# GC scheduler: step size (KB), time budget per callback (ms) and
+# full collection threshold (KB)
+set(BRIDGE_GC_STEP_SIZE 32)
+set(BRIDGE_GC_TIME_BUDGET 1)
+set(BRIDGE_GC_FULL_THRESHOLD 16384)
+
+# max idle coroutines kept in the pool
+set(BRIDGE_THREAD_POOL_MAX 64)
+
+# use the size-class memory pool for Lua
+set(BRIDGE_MEMPOOL ON)
+
+# per-plugin memory accounting and limits
+set(BRIDGE_MEMPOOL_OWNER ON)
+
+# allocate the memory of the HAP IP sessions when they are accepted
+set(BRIDGE_HAP_LAZY_SESSIONS ON)
+
 add_compile_options(-Wall -Werror)
 
 # install binaries
@@ -0,0 +1,16 @@
+// Copyright (c) 2021-2022 Zebin Wu and homekit-bridge contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of homekit-bridge project authors.
+
+#include <time.h>
+#include <HAPBase.h>
+#include <pal/clock.h>
+
+uint64_t pal_clock_get_us(void) {
+    struct timespec ts;
+    int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    HAPAssert(ret == 0);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
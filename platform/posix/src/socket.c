@@ -599,6 +599,15 @@ static void pal_socket_handle_recv_cb(
         return;
     }
 
+    if (!o->recv_buf) {
+        // waiting for readable
+        pal_socket_recv_reset(o);
+        pal_socket_readable_cb cb = o->cb;
+        o->cb = NULL;
+        cb((pal_socket_obj *)o, o->cb_arg);
+        return;
+    }
+
     if (o->timer) {
         HAPPlatformTimerDeregister(o->timer);
         o->timer = 0;
@@ -1150,6 +1159,72 @@ bool pal_socket_readable(pal_socket_obj *_o) {
     return select(o->fd + 1, &read_fds, NULL, NULL, &tv) == 1 && FD_ISSET(o->fd, &read_fds);
 }
 
+pal_err pal_socket_wait_readable(pal_socket_obj *_o, pal_socket_readable_cb readable_cb, void *arg) {
+    HAPPrecondition(_o);
+    HAPPrecondition(readable_cb);
+
+    pal_socket_obj_int *o = (pal_socket_obj_int *)_o;
+    HAPAssert(o->magic == PAL_SOCKET_OBJ_MAGIC);
+
+    if (o->type == PAL_SOCKET_TYPE_TCP && !pal_socket_connected(o)) {
+        return PAL_ERR_INVALID_STATE;
+    }
+
+    if (o->receiving) {
+        return PAL_ERR_BUSY;
+    }
+
+    if (pal_socket_readable(_o)) {
+        return PAL_ERR_OK;
+    }
+
+    // a receiving without buffer means waiting for readable
+    o->recv_buf = NULL;
+    o->recv_buflen = 0;
+    o->cb = readable_cb;
+    o->cb_arg = arg;
+    o->receiving = true;
+    pal_socket_enable_read(o, true);
+    SOCKET_LOG(Debug, o, "Waiting for readable ...");
+    return PAL_ERR_IN_PROGRESS;
+}
+
+void pal_socket_cancel_wait(pal_socket_obj *_o) {
+    HAPPrecondition(_o);
+
+    pal_socket_obj_int *o = (pal_socket_obj_int *)_o;
+    HAPAssert(o->magic == PAL_SOCKET_OBJ_MAGIC);
+
+    if (o->receiving && !o->recv_buf) {
+        pal_socket_recv_reset(o);
+        o->cb = NULL;
+    }
+}
+
+bool pal_socket_cancel(pal_socket_obj *_o) {
+    HAPPrecondition(_o);
+
+    pal_socket_obj_int *o = (pal_socket_obj_int *)_o;
+    HAPAssert(o->magic == PAL_SOCKET_OBJ_MAGIC);
+
+    if (o->state == PAL_SOCKET_ST_ACCEPTING) {
+        o->state = PAL_SOCKET_ST_LISTENED;
+        o->accept_new_obj = NULL;
+        pal_socket_enable_read(o, false);
+    } else if (o->receiving) {
+        pal_socket_recv_reset(o);
+    } else {
+        return false;
+    }
+    if (o->timer) {
+        HAPPlatformTimerDeregister(o->timer);
+        o->timer = 0;
+    }
+    o->cb = NULL;
+    SOCKET_LOG(Debug, o, "Canceled.");
+    return true;
+}
+
 pal_err pal_socket_handshake(pal_socket_obj *_o,
     pal_socket_handshaked_cb handshaked_cb, void *arg) {
     HAPPrecondition(_o);
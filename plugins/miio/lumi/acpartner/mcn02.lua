@@ -53,13 +53,13 @@ function M.gen(device, conf)
                 end, function (request, value)
                     device:setProp("power", searchKey(valMapping.power, value))
                     raiseEvent(request.aid, request.sid, request.cid)
+                    -- the request is reused after the callback returns
+                    local aid = request.aid
                     core.createTimer(function ()
-                        raiseEvent(request.aid, iids.heaterCooler, iids.curTemp)
-                        raiseEvent(request.aid, iids.heaterCooler, iids.tgtState)
-                        raiseEvent(request.aid, iids.heaterCooler, iids.curState)
-                        raiseEvent(request.aid, iids.heaterCooler, iids.coolThrTemp)
-                        raiseEvent(request.aid, iids.heaterCooler, iids.heatThrTemp)
-                        raiseEvent(request.aid, iids.heaterCooler, iids.swingMode)
+                        hap.raiseEvents(aid, iids.heaterCooler, {
+                            iids.curTemp, iids.tgtState, iids.curState,
+                            iids.coolThrTemp, iids.heatThrTemp, iids.swingMode
+                        })
                     end):start(500)
                 end),
                 CurTemp.new(iids.curTemp, function (request)
@@ -89,10 +89,11 @@ function M.gen(device, conf)
                 end, function (request, value)
                     device:setProp("mode", searchKey(valMapping.mode, value))
                     raiseEvent(request.aid, request.sid, request.cid)
+                    local aid = request.aid
                     core.createTimer(function ()
-                        raiseEvent(request.aid, iids.heaterCooler, iids.curState)
-                        raiseEvent(request.aid, iids.heaterCooler, iids.coolThrTemp)
-                        raiseEvent(request.aid, iids.heaterCooler, iids.heatThrTemp)
+                        raiseEvent(aid, iids.heaterCooler, iids.curState)
+                        raiseEvent(aid, iids.heaterCooler, iids.coolThrTemp)
+                        raiseEvent(aid, iids.heaterCooler, iids.heatThrTemp)
                     end):start(500)
                 end),
                 CoolThrholdTemp.new(iids.coolThrTemp, function (request)
@@ -1,6 +1,7 @@
 local suites = {
     "testsocket",
-    "testnvs"
+    "testnvs",
+    "testtlv8"
 }
 
 local function runSuite(s)
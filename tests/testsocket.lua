@@ -119,3 +119,48 @@ do
     end
     assert(client:send("") == 0)
 end
+
+---Test core.select() with a socket and a message queue
+do
+    local server <close> = socket.create("UDP", "IPV4")
+    server:bind("127.0.0.1", 8889)
+    local mq = core.createMQ(1)
+    assert(core.select({server, mq}, 0) == nil)
+    assert(core.select({server, mq}, 10) == nil)
+    core.createTimer(function ()
+        mq:send("msg")
+    end):start(5)
+    assert(core.select({server, mq}) == 2)
+    assert(mq:recv() == "msg")
+    local client <close> = socket.create("UDP", "IPV4")
+    client:connect("127.0.0.1", 8889)
+    assert(client:send("msg") == 3)
+    assert(core.select({server, mq}, 1000) == 1)
+    assert(server:recvfrom(1024) == "msg")
+end
+
+---Test core.spawn() with a task canceled while receiving
+do
+    local server = socket.create("UDP", "IPV4")
+    server:bind("127.0.0.1", 8890)
+    local task = core.spawn(function ()
+        return server:recvfrom(1024)
+    end)
+    local echo = core.spawn(function (...)
+        return ...
+    end, 1, 2)
+    assert(core.select({task, echo}, 1000) == 2)
+    local success, a, b = echo:join()
+    assert(success and a == 1 and b == 2)
+    assert(not task:done())
+    task:cancel()
+    assert(task:done())
+    assert(select(2, task:join()) == "canceled")
+
+    -- the socket is still usable after the receiving is canceled
+    local client = socket.create("UDP", "IPV4")
+    client:sendto("ping", "127.0.0.1", 8890)
+    assert(server:recvfrom(1024) == "ping")
+    client:destroy()
+    server:destroy()
+end
@@ -0,0 +1,143 @@
+local hap = require "hap"
+
+---Nest the items ``levels`` arrays deep, the innermost item has the value "x".
+local function nest(levels)
+    local items = {{ type = 1, value = "x" }}
+    for _ = 2, levels do
+        items = {{ type = 1, value = items }}
+    end
+    return items
+end
+
+---Test hap.encodeTLV8() and hap.decodeTLV8() round trip with string values.
+do
+    local data = hap.encodeTLV8({
+        { type = 1, value = "abc" },
+        { type = 2, value = "" },
+        { type = 3 },
+        { type = 255, value = "\0\1\2" },
+    })
+    assert(data == "\1\3abc\2\0\3\0\255\3\0\1\2")
+    local items = hap.decodeTLV8(data)
+    assert(#items == 4)
+    assert(items[1].type == 1 and items[1].value == "abc")
+    assert(items[2].type == 2 and items[2].value == "")
+    assert(items[3].type == 3 and items[3].value == "")
+    assert(items[4].type == 255 and items[4].value == "\0\1\2")
+end
+
+---Test hap.encodeTLV8() and hap.decodeTLV8() with an empty array.
+do
+    local data = hap.encodeTLV8({})
+    assert(data == "")
+    assert(#hap.decodeTLV8(data) == 0)
+end
+
+---Test hap.encodeTLV8() and hap.decodeTLV8() round trip with a value split into fragments.
+do
+    local value = ("0123456789"):rep(30)
+    local items = hap.decodeTLV8(hap.encodeTLV8({{ type = 1, value = value }}))
+    assert(#items == 1)
+    assert(items[1].type == 1 and items[1].value == value)
+end
+
+---Test hap.encodeTLV8() with the integers encoded in the minimal number of bytes.
+for _, case in ipairs({
+    { 0, "\0" },
+    { 255, "\255" },
+    { 256, "\0\1" },
+    { 65535, "\255\255" },
+    { 65536, "\0\0\1\0" },
+    { 0xFFFFFFFF, "\255\255\255\255" },
+    { 0x100000000, "\0\0\0\0\1\0\0\0" },
+    { -1, "\255\255\255\255\255\255\255\255" },
+}) do
+    local items = hap.decodeTLV8(hap.encodeTLV8({{ type = 1, value = case[1] }}))
+    assert(items[1].value == case[2])
+end
+
+---Test hap.encodeTLV8() with booleans.
+do
+    local items = hap.decodeTLV8(hap.encodeTLV8({
+        { type = 1, value = true },
+        { type = 2, value = false },
+    }))
+    assert(items[1].value == "\1")
+    assert(items[2].value == "\0")
+end
+
+---Test hap.encodeTLV8() with a float.
+do
+    local success = pcall(hap.encodeTLV8, {{ type = 1, value = 1.5 }})
+    assert(success == false)
+end
+
+---Test hap.encodeTLV8() with invalid types.
+for _, type in ipairs({ -1, 256, "1" }) do
+    local success = pcall(hap.encodeTLV8, {{ type = type, value = "x" }})
+    assert(success == false)
+end
+
+---Test hap.encodeTLV8() and hap.decodeTLV8() round trip with nested items.
+do
+    local data = hap.encodeTLV8({
+        { type = 1, value = {
+            { type = 2, value = 256 },
+            { type = 3, value = {
+                { type = 4, value = "abc" },
+            }},
+        }},
+        { type = 5, value = true },
+    })
+    local items = hap.decodeTLV8(data)
+    assert(#items == 2)
+    assert(items[1].type == 1)
+    assert(items[2].type == 5 and items[2].value == "\1")
+
+    -- the nested items are decoded from the value
+    local nested = hap.decodeTLV8(items[1].value)
+    assert(#nested == 2)
+    assert(nested[1].type == 2 and nested[1].value == "\0\1")
+    assert(nested[2].type == 3)
+    nested = hap.decodeTLV8(nested[2].value)
+    assert(#nested == 1)
+    assert(nested[1].type == 4 and nested[1].value == "abc")
+end
+
+---Test hap.encodeTLV8() with the items nested 8 levels deep.
+do
+    local items = hap.decodeTLV8(hap.encodeTLV8(nest(8)))
+    for _ = 2, 8 do
+        assert(#items == 1 and items[1].type == 1)
+        items = hap.decodeTLV8(items[1].value)
+    end
+    assert(#items == 1 and items[1].value == "x")
+end
+
+---Test hap.encodeTLV8() with the items nested deeper than 8 levels.
+do
+    local success, err = pcall(hap.encodeTLV8, nest(9))
+    assert(success == false)
+    assert(err:find("TLV8 items nested deeper than 8", 1, true))
+end
+
+---Test hap.encodeTLV8() with a result longer than maxBytes.
+do
+    local items = {{ type = 1, value = ("x"):rep(100) }}
+    assert(#hap.encodeTLV8(items, 102) == 102)
+    local success, err = pcall(hap.encodeTLV8, items, 101)
+    assert(success == false)
+    assert(err:find("TLV8 value too long", 1, true))
+end
+
+---Test hap.encodeTLV8() with invalid maxBytes.
+do
+    local success = pcall(hap.encodeTLV8, {}, 0)
+    assert(success == false)
+end
+
+---Test hap.decodeTLV8() with truncated data.
+do
+    local success = pcall(hap.decodeTLV8, "\1\3ab")
+    assert(success == false)
+end